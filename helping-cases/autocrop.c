@@ -0,0 +1,111 @@
+// Checks that --autocrop keeps thin and light marks at the edge of a jpeg
+// page, run it with `make test`. Every page is white with a black block in
+// the middle and one mark near a border that must stay inside the box
+#include "../src/autocrop.h"
+#include <stdio.h> // before jpeglib.h, it uses FILE
+#include <jpeglib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZE 256
+
+typedef struct {
+  const char *name;
+  uint32_t    x, y, width, height; // the mark
+  uint8_t     rgb[3];
+} test_case_t;
+
+static const test_case_t CASES[] = {
+    // a one pixel line that 1/8 of the size averages to 239
+    {"gray line left", 3, 0, 1, SIZE, {128, 128, 128}},
+    {"gray line right", SIZE - 4, 0, 1, SIZE, {128, 128, 128}},
+    {"black line top", 0, 2, SIZE, 1, {0, 0, 0}},
+    // as bright as the border in luma alone
+    {"yellow bar bottom", 96, SIZE - 12, 64, 8, {255, 255, 0}},
+};
+
+static void fill(uint8_t *rgb, uint32_t x, uint32_t y, uint32_t width,
+                 uint32_t height, const uint8_t colour[3]) {
+  for (uint32_t row = y; row < y + height; row++) {
+    for (uint32_t col = x; col < x + width; col++) {
+      memcpy(rgb + ((size_t)row * SIZE + col) * 3, colour, 3);
+    }
+  }
+}
+
+static uint8_t *encode(const uint8_t *rgb, unsigned long *size) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr       err;
+  uint8_t                    *data = NULL;
+  cinfo.err                        = jpeg_std_error(&err);
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &data, size);
+  cinfo.image_width      = SIZE;
+  cinfo.image_height     = SIZE;
+  cinfo.input_components = 3;
+  cinfo.in_color_space   = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 90, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < SIZE) {
+    JSAMPROW row = (JSAMPROW)(rgb + (size_t)cinfo.next_scanline * SIZE * 3);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return data;
+}
+
+static bool inside(const autocrop_box_t *box, uint32_t x, uint32_t y) {
+  return x >= box->x && x < box->x + box->width && y >= box->y &&
+         y < box->y + box->height;
+}
+
+int main(void) {
+  static const uint8_t WHITE[3] = {255, 255, 255};
+  static const uint8_t BLACK[3] = {0, 0, 0};
+  uint8_t             *rgb      = malloc((size_t)SIZE * SIZE * 3);
+  if (!rgb) {
+    return EXIT_FAILURE;
+  }
+
+  int      failed = 0;
+  uint32_t count  = sizeof(CASES) / sizeof(CASES[0]);
+  for (uint32_t i = 0; i < count; i++) {
+    const test_case_t *test = &CASES[i];
+    fill(rgb, 0, 0, SIZE, SIZE, WHITE);
+    fill(rgb, 112, 112, 32, 32, BLACK);
+    fill(rgb, test->x, test->y, test->width, test->height, test->rgb);
+
+    unsigned long  size     = 0;
+    uint8_t       *jpeg     = encode(rgb, &size);
+    bool           wanted[] = {true};
+    autocrop_box_t box      = {0, 0, SIZE, SIZE};
+    bool           decoded  = autocrop_jpeg_boxes(jpeg, size, 1, wanted, &box);
+    free(jpeg);
+
+    bool kept = decoded && inside(&box, test->x, test->y) &&
+                inside(&box, test->x + test->width - 1,
+                       test->y + test->height - 1);
+    printf("%-20s box %ux%u at %u,%u %s\n", test->name, box.width,
+           box.height, box.x, box.y, kept ? "ok" : "FAILED, mark cropped");
+    failed |= !kept;
+  }
+
+  // with only the block the borders have to go, or nothing above is tested
+  fill(rgb, 0, 0, SIZE, SIZE, WHITE);
+  fill(rgb, 112, 112, 32, 32, BLACK);
+  unsigned long  size     = 0;
+  uint8_t       *jpeg     = encode(rgb, &size);
+  bool           wanted[] = {true};
+  autocrop_box_t box      = {0, 0, SIZE, SIZE};
+  autocrop_jpeg_boxes(jpeg, size, 1, wanted, &box);
+  free(jpeg);
+  bool trimmed = autocrop_is_worth(&box, SIZE, SIZE);
+  printf("%-20s box %ux%u at %u,%u %s\n", "block only", box.width, box.height,
+         box.x, box.y, trimmed ? "ok" : "FAILED, nothing trimmed");
+  failed |= !trimmed;
+
+  free(rgb);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
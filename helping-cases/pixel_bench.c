@@ -0,0 +1,131 @@
+// Times every pixel kernel variant this cpu can run against the scalar one
+// and checks that they all give the same results. Run it with `make bench`
+#include "../src/pixels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// one 300 dpi spread, the size the kernels usually see
+#define WIDTH     4960
+#define HEIGHT    3508
+#define TOLERANCE 8
+#define RUNS      5
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// gray with a little noise in every channel and a colour block in the last
+// row, so the tolerance check has to look at every pixel
+static void fill_page(uint8_t *rgb) {
+  srand(1);
+  for (size_t i = 0; i < (size_t)WIDTH * HEIGHT; i++) {
+    uint8_t v      = (uint8_t)(rand() % 256);
+    rgb[i * 3]     = (uint8_t)(v - v % 4);
+    rgb[i * 3 + 1] = v;
+    rgb[i * 3 + 2] = (uint8_t)(v | 3);
+  }
+  uint8_t *last = rgb + (size_t)WIDTH * (HEIGHT - 1) * 3;
+  for (uint32_t x = WIDTH - 7; x < WIDTH; x++) {
+    last[x * 3] = (uint8_t)(last[x * 3 + 1] + 40);
+  }
+}
+
+// returns how many rows passed, so the calls can not be optimized away
+static uint32_t run_rgb_to_gray(const pixel_kernels_t *k, const uint8_t *rgb,
+                                uint8_t *gray) {
+  uint32_t passed = 0;
+  for (uint32_t y = 0; y < HEIGHT; y++) {
+    passed += k->rgb_to_gray(rgb + (size_t)y * WIDTH * 3,
+                             gray + (size_t)y * WIDTH, WIDTH, TOLERANCE);
+  }
+  return passed;
+}
+
+static uint32_t run_min_max(const pixel_kernels_t *k, const uint8_t *rgb) {
+  uint32_t sum = 0;
+  for (uint32_t y = 0; y < HEIGHT; y++) {
+    uint8_t min, max;
+    k->min_max(rgb + (size_t)y * WIDTH * 3, (size_t)WIDTH * 3, &min, &max);
+    sum += min + max;
+  }
+  return sum;
+}
+
+static uint32_t run_min_into(const pixel_kernels_t *k, const uint8_t *rgb,
+                             uint8_t *acc) {
+  memset(acc, 255, (size_t)WIDTH * 3);
+  for (uint32_t y = 0; y < HEIGHT; y++) {
+    k->min_into(acc, rgb + (size_t)y * WIDTH * 3, (size_t)WIDTH * 3);
+  }
+  uint32_t sum = 0;
+  for (uint32_t x = 0; x < WIDTH * 3; x++) {
+    sum += acc[x];
+  }
+  return sum;
+}
+
+int main(void) {
+  uint8_t *rgb   = malloc((size_t)WIDTH * HEIGHT * 3);
+  uint8_t *gray  = malloc((size_t)WIDTH * HEIGHT);
+  uint8_t *check = malloc((size_t)WIDTH * HEIGHT);
+  uint8_t *acc   = malloc((size_t)WIDTH * 3);
+  if (!rgb || !gray || !check || !acc) {
+    return EXIT_FAILURE;
+  }
+  fill_page(rgb);
+
+  const pixel_kernels_t *variants[8];
+  uint32_t               count = pixel_kernels_available(variants, 8);
+  printf("%u x %u rgb, best of %u runs, dispatch picks %s\n", WIDTH, HEIGHT,
+         RUNS, pixel_kernels()->name);
+  printf("%-8s %14s %14s %14s\n", "variant", "rgb_to_gray", "min_max",
+         "min_into");
+
+  uint32_t expected[3] = {0};
+  double   scalar[3]   = {0};
+  int      failed      = 0;
+  for (uint32_t v = 0; v < count; v++) {
+    const pixel_kernels_t *k       = variants[v];
+    double                 best[3] = {1e9, 1e9, 1e9};
+    uint32_t               got[3]  = {0};
+    for (int run = 0; run < RUNS; run++) {
+      double times[4];
+      times[0] = now();
+      got[0]   = run_rgb_to_gray(k, rgb, gray);
+      times[1] = now();
+      got[1]   = run_min_max(k, rgb);
+      times[2] = now();
+      got[2]   = run_min_into(k, rgb, acc);
+      times[3] = now();
+      for (int i = 0; i < 3; i++) {
+        double took = times[i + 1] - times[i];
+        best[i]     = took < best[i] ? took : best[i];
+      }
+    }
+
+    if (v == 0) {
+      memcpy(check, gray, (size_t)WIDTH * HEIGHT);
+      memcpy(expected, got, sizeof(got));
+      memcpy(scalar, best, sizeof(best));
+    } else if (memcmp(check, gray, (size_t)WIDTH * HEIGHT) != 0 ||
+               memcmp(expected, got, sizeof(got)) != 0) {
+      printf("%s does not match scalar\n", k->name);
+      failed = 1;
+    }
+    printf("%-8s", k->name);
+    for (int i = 0; i < 3; i++) {
+      printf(" %7.2fms %4.1fx", best[i] * 1e3, scalar[i] / best[i]);
+    }
+    printf("\n");
+  }
+
+  free(rgb);
+  free(gray);
+  free(check);
+  free(acc);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,441 +1,318 @@
-#include <assert.h>
-#include <stdbool.h>
-#include <stdint.h>
+// Checks src/imposition.c against every case of test-cases.txt, run it with
+// `make test`. With --bench it times the imposition against the two arrays
+// the pdf output used to build, and checks that both give the same order
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime */
+#include "../src/cli.h"
+#include "../src/imposition.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-typedef enum { NONE, LEFT, RIGHT } page_type_e;
-typedef struct {
-  uint32_t    n;
-  page_type_e t;
-} page_t;
-
-char *t_to_s(page_type_e t);
-void  test_case1(void);
-void  test_case2(void);
-void  test_case3(void);
-void  test_case4(void);
-void  test_case5(void);
-void  test_case6(void);
-void  test_case7(void);
-void  test_case8(void);
-void  test_case9(void);
-void  test_case10(void);
-
-#define HUMAN_READABLE_TO_STR(output_human, output_human_len, last_non_null)   \
-  ({                                                                           \
-    char result_str[200];                                                      \
-    if (result_str == NULL) {                                                  \
-      exit(EXIT_FAILURE);                                                      \
-    }              /* Handle allocation failure */                             \
-    char temp[20]; /* Temporary buffer for individual elements */              \
-    strcpy(result_str, "[");                                                   \
-    for (uint32_t i = 0; i < last_non_null; ++i) {                             \
-      if (!output_human[i]) {                                                  \
-        strcat(result_str, "X, ");                                             \
-        continue;                                                              \
-      }                                                                        \
-      sprintf(temp, "%u%s, ", output_human[i]->n, t_to_s(output_human[i]->t)); \
-      strcat(result_str, temp);                                                \
-    }                                                                          \
-    for (uint32_t i = last_non_null; i < output_human_len; ++i) {              \
-      if (!output_human[i]) {                                                  \
-        strcat(result_str, "N, ");                                             \
-      } else {                                                                 \
-        sprintf(temp, "%u%s, ", output_human[output_human_len - 1]->n,         \
-                t_to_s(output_human[output_human_len - 1]->t));                \
-        strcat(result_str, temp);                                              \
-      }                                                                        \
-    }                                                                          \
-    /* Remove the last comma and space */                                      \
-    size_t len = strlen(result_str);                                           \
-    if (len > 2) {                                                             \
-      result_str[len - 2] = ']';                                               \
-      result_str[len - 1] = '\0';                                              \
-    } else {                                                                   \
-      strcat(result_str, "]");                                                 \
-    }                                                                          \
-    result_str;                                                                \
-  })
-
-#define OUTPUT_TO_STR(output_human, output_human_len)                          \
-  ({                                                                           \
-    char result_str[200];                                                      \
-    if (result_str == NULL) {                                                  \
-      exit(EXIT_FAILURE);                                                      \
-    }              /* Handle allocation failure */                             \
-    char temp[20]; /* Temporary buffer for individual elements */              \
-    strcpy(result_str, "[");                                                   \
-    for (uint32_t i = 0; i < output_human_len; ++i) {                          \
-      if (!output_human[i]) {                                                  \
-        strcat(result_str, "X, ");                                             \
-        continue;                                                              \
-      }                                                                        \
-      sprintf(temp, "%u%s, ", output_human[i]->n, t_to_s(output_human[i]->t)); \
-      strcat(result_str, temp);                                                \
-    }                                                                          \
-    /* Remove the last comma and space */                                      \
-    size_t len = strlen(result_str);                                           \
-    if (len > 2) {                                                             \
-      result_str[len - 2] = ']';                                               \
-      result_str[len - 1] = '\0';                                              \
-    } else {                                                                   \
-      strcat(result_str, "]");                                                 \
-    }                                                                          \
-    result_str;                                                                \
-  })
+#define MAX_PAGES 64
 
-#define REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,       \
-                                  INPUT_SIZE, last_non_null)                   \
-  uint32_t start_index = 0;                                                    \
-  /* Check first */                                                            \
-  if (input[0].t == NONE) {                                                    \
-    output_human[output_human_len++] = &input[0];                              \
-    start_index                      = output_human_len;                       \
-  } else if (input[0].t == LEFT) {                                             \
-    output_human[output_human_len++] = NULL;                                   \
-    output_human[output_human_len++] = &input[1];                              \
-    output_human[output_human_len++] =                                         \
-        &input[0]; /* has to be L, we are ensured */                           \
-    start_index = output_human_len - 1;                                        \
-  }                                                                            \
-                                                                               \
-  for (uint32_t i = start_index; i < INPUT_SIZE; ++i) {                        \
-    page_t p             = input[i];                                           \
-    bool   on_right_page = (output_human_len - 1) % 2 == 0;                    \
-    if (p.t == NONE) {                                                         \
-      if (on_right_page && i < INPUT_SIZE - 1 && (input[i + 1].t != NONE)) {   \
-        output_human[output_human_len++] = NULL;                               \
-      }                                                                        \
-      output_human[output_human_len++] = &input[i];                            \
-    } else {                                                                   \
-      if (!on_right_page) { /* on left page_t */                               \
-        output_human[output_human_len++] = NULL;                               \
-      }                                                                        \
-      /* we are ensured that this will be in bounds since L then R */          \
-      output_human[output_human_len++] = &input[i + 1]; /* Add Right first */  \
-      output_human[output_human_len++] =                                       \
-          &input[i++]; /* Add Left second, inc to skip right */                \
-    }                                                                          \
-  }                                                                            \
-  last_non_null = output_human_len;                                            \
-  while (output_human_len % 4 != 0) {                                          \
-    output_human[output_human_len++] = NULL;                                   \
-  }
-
-#define REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output)        \
-  for (uint32_t i = 0, j = output_human_len - 1; i < j; ++i, --j) {            \
-    bool     on_front_side = (i % 2) != 0;                                     \
-    uint32_t idx1 = i, idx2 = j;                                               \
-                                                                               \
-    if (on_front_side) {                                                       \
-      idx1 = j;                                                                \
-      idx2 = i;                                                                \
-    }                                                                          \
-    output[output_len++] = output_human[idx1];                                 \
-    output[output_len++] = output_human[idx2];                                 \
-  }
+// every tenth page is a spread
+#define BENCH_PAGES 1000000
+#define RUNS        5
 
-int main(void) {
-  test_case1();
-  test_case2();
-  test_case3();
-  test_case4();
-  test_case5();
-  test_case6();
-  test_case7();
-  test_case8();
-  test_case9();
-  test_case10();
+typedef struct {
+  uint32_t           n;
+  double_page_mode_e t;
+  bool               blank; // X or N
+} token_t;
 
-  return 0;
+typedef struct {
+  char     name[32];
+  token_t  input[MAX_PAGES];
+  uint32_t input_len;
+  token_t  human[MAX_PAGES];
+  uint32_t human_len;
+  token_t  output[MAX_PAGES];
+  uint32_t output_len;
+  uint32_t signature; // pages, 0 for the whole booklet
+} test_case_t;
+
+// quiet, so the allocations are not printed
+static const cli_flags_t CLI_FLAGS = {0};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-char *t_to_s(page_type_e t) {
-  if (t == NONE) {
-    return "";
-  }
-  if (t == LEFT) {
-    return "L";
+// parses a list like [1, X, 2, 3R, 3L, N]
+static uint32_t parse_tokens(const char *s, token_t *tokens) {
+  uint32_t len = 0;
+  s            = strchr(s, '[');
+  while (s && *s != ']' && *s != '\0' && len < MAX_PAGES) {
+    s++;
+    while (*s == ' ') {
+      s++;
+    }
+    if (*s == ']') {
+      break;
+    }
+    token_t *token = &tokens[len++];
+    memset(token, 0, sizeof(*token));
+    if (*s == 'X' || *s == 'N') {
+      token->blank = true;
+      s++;
+    } else {
+      char *end = NULL;
+      token->n  = (uint32_t)strtoul(s, &end, 10);
+      s         = end;
+      if (*s == 'L' || *s == 'R') {
+        token->t = *s++ == 'L' ? DOUBLE_PAGE_LEFT : DOUBLE_PAGE_RIGHT;
+      }
+    }
+    while (*s == ' ') {
+      s++;
+    }
   }
-  return "R";
+  return len;
 }
 
-void test_case1(void) {
-  /*
-  input: [1, 2, 3L, 3R, 4L, 4R, 5, 6, 7L, 7R]
-  output_human: [1, X, 2, 3R, 3L, 4R, 4L, 5, 6, 7R, 7L, N]
-  output: [1, N, 7L, X, 2, 7R, 6, 3R, 3L, 5, 4L, 4R]
-  */
-#define TEST_CASE1_INPUT 10
-  page_t input[TEST_CASE1_INPUT] = {
-      {1, NONE},  {2, NONE}, {3, LEFT}, {3, RIGHT}, {4, LEFT},
-      {4, RIGHT}, {5, NONE}, {6, NONE}, {7, LEFT},  {7, RIGHT}};
-  const char *expected_output_human =
-      "[1, X, 2, 3R, 3L, 4R, 4L, 5, 6, 7R, 7L, N]";
-  page_t  *output_human[100];
-  uint32_t output_human_len = 0;
-  uint32_t last_non_null    = 0;
-
-  // const char *expected_output = "[1, N, 7L, X, 2, 7R, 6, 3R, 3L, 5, 4L, 4R]";
-  const char *expected_output = "[1, X, 7L, X, 2, 7R, 6, 3R, 3L, 5, 4L, 4R]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
-
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE1_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
-
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
-}
-
-void test_case2(void) {
-  /*
-  input: [1, 2, 3L, 3R, 4L, 4R, 5]
-  output_human: [1, X, 2, 3R, 3L, 4R, 4L, 5]
-  output: [1, 5, 4L, X, 2, 4R, 3L, 3R]
-  */
-#define TEST_CASE2_INPUT 7
-  page_t      input[TEST_CASE2_INPUT] = {{1, NONE},  {2, NONE}, {3, LEFT},
-                                         {3, RIGHT}, {4, LEFT}, {4, RIGHT},
-                                         {5, NONE}};
-  const char *expected_output_human   = "[1, X, 2, 3R, 3L, 4R, 4L, 5]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
-
-  const char *expected_output = "[1, 5, 4L, X, 2, 4R, 3L, 3R]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
-
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE2_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
-
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
-}
-
-void test_case3(void) {
-  /*
-  input: [1, 2L, 2R, 3L, 3R]
-  output_human: [1, 2R, 2L, 3R, 3L, N, N, N]
-  output: [1, N, N, 2R, 2L, N, 3L, 3R]
-  */
-#define TEST_CASE3_INPUT 5
-  page_t input[TEST_CASE2_INPUT] = {
-      {1, NONE}, {2, LEFT}, {2, RIGHT}, {3, LEFT}, {3, RIGHT}};
-  const char *expected_output_human = "[1, 2R, 2L, 3R, 3L, N, N, N]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
-
-  const char *expected_output = "[1, X, X, 2R, 2L, X, 3L, 3R]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
-
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE3_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
-
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+static bool same_token(const photo_t *photos, uint32_t photo,
+                       const token_t *token) {
+  if (photo == IMPOSITION_BLANK || token->blank) {
+    return photo == IMPOSITION_BLANK && token->blank;
+  }
+  return photos[photo].id == token->n &&
+         photos[photo].double_page == token->t;
 }
 
-void test_case4(void) {
-  // dont have a case for this right now
+static void print_photo(const photo_t *photos, uint32_t photo) {
+  if (photo == IMPOSITION_BLANK) {
+    printf(" X");
+    return;
+  }
+  const photo_t *p = &photos[photo];
+  printf(" %u%s", p->id,
+         p->double_page == DOUBLE_PAGE_LEFT    ? "L"
+         : p->double_page == DOUBLE_PAGE_RIGHT ? "R"
+                                               : "");
 }
 
-void test_case5(void) {
-  /*
-  input: [1, 2L, 2R, 3, 4L, 4R]
-  output_human: [1, 2R, 2L, X, 3, 4R, 4L, N]
-  output: [1, N, 4L, 2R, 2L, 4R, 3, X]
-  */
-#define TEST_CASE5_INPUT 6
-  page_t      input[TEST_CASE5_INPUT] = {{1, NONE}, {2, LEFT}, {2, RIGHT},
-                                         {3, NONE}, {4, LEFT}, {4, RIGHT}};
-  const char *expected_output_human   = "[1, 2R, 2L, X, 3, 4R, 4L, N]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
-
-  const char *expected_output = "[1, X, 4L, 2R, 2L, 4R, 3, X]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
+static bool run_case(const test_case_t *test) {
+  photo_t photos[MAX_PAGES];
+  memset(photos, 0, sizeof(photos));
+  for (uint32_t i = 0; i < test->input_len; i++) {
+    photos[i].id          = test->input[i].n;
+    photos[i].double_page = test->input[i].t;
+  }
 
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE5_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
+  imposition_t imposition;
+  if (!imposition_init(&CLI_FLAGS, &imposition, photos, test->input_len,
+                       test->signature)) {
+    return false;
+  }
+  bool ok = imposition.page_count == test->human_len &&
+            imposition_sheet_count(&imposition) * 2 == test->output_len;
+  for (uint32_t i = 0; ok && i < test->human_len; i++) {
+    ok = same_token(photos, imposition_page(&imposition, i), &test->human[i]);
+  }
+  for (uint32_t k = 0; ok && k < test->output_len / 2; k++) {
+    uint32_t sheet[2];
+    imposition_sheet(&imposition, k, sheet);
+    ok = same_token(photos, sheet[0], &test->output[k * 2]) &&
+         same_token(photos, sheet[1], &test->output[k * 2 + 1]);
+  }
 
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+  if (!ok) {
+    printf("%s failed\n  human_output:", test->name);
+    for (uint32_t i = 0; i < imposition.page_count; i++) {
+      print_photo(photos, imposition_page(&imposition, i));
+    }
+    printf("\n  output:");
+    for (uint32_t k = 0; k < imposition_sheet_count(&imposition); k++) {
+      uint32_t sheet[2];
+      imposition_sheet(&imposition, k, sheet);
+      print_photo(photos, sheet[0]);
+      print_photo(photos, sheet[1]);
+    }
+    printf("\n");
+  }
+  imposition_free(&CLI_FLAGS, &imposition);
+  return ok;
 }
-void test_case6(void) {
-  /*
-  input: [1L, 1R, 2, 3L, 3R]
-  output_human: [X, 1R, 1L, X, 2, 3R, 3L, N]
-  output: [X, N, 3L, 1R, 1L, 3R, 2, X]
-  */
-#define TEST_CASE6_INPUT 5
-  page_t input[TEST_CASE6_INPUT] = {
-      {1, LEFT}, {1, RIGHT}, {2, NONE}, {3, LEFT}, {3, RIGHT}};
-  const char *expected_output_human = "[X, 1R, 1L, X, 2, 3R, 3L, N]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
 
-  const char *expected_output = "[X, X, 3L, 1R, 1L, 3R, 2, X]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
+// cases start with #<n>, the ones that are commented out start with -
+static int run_cases(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("Failed to open %s\n", path);
+    return EXIT_FAILURE;
+  }
 
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE6_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
+  test_case_t test;
+  bool        open   = false;
+  uint32_t    passed = 0, failed = 0;
+  char        line[512];
+  for (bool more = true; more;) {
+    more          = fgets(line, sizeof(line), file) != NULL;
+    const char *s = line;
+    while (more && (*s == ' ' || *s == '\t')) {
+      s++;
+    }
+    if (open && (!more || *s == '#')) {
+      run_case(&test) ? passed++ : failed++;
+      open = false;
+    }
+    if (!more || *s == '-') {
+      continue;
+    }
+    if (*s == '#') {
+      memset(&test, 0, sizeof(test));
+      sscanf(s, "%31[^:]", test.name);
+      open = true;
+    } else if (strncmp(s, "input:", 6) == 0) {
+      test.input_len = parse_tokens(s, test.input);
+    } else if (strncmp(s, "human_output:", 13) == 0) {
+      test.human_len = parse_tokens(s, test.human);
+    } else if (strncmp(s, "output:", 7) == 0) {
+      test.output_len = parse_tokens(s, test.output);
+    } else if (strncmp(s, "signature:", 10) == 0) {
+      test.signature = (uint32_t)strtoul(s + 10, NULL, 10);
+    }
+  }
+  fclose(file);
 
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+  printf("%u of %u cases passed\n", passed, passed + failed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-void test_case7(void) {
-  /*
-  input: [1L, 1R, 2, 3L, 3R, 4]
-  output_human: [X, 1R, 1L, X, 2, 3R, 3L, 4]
-  output: [X, 4, 3L, 1R, 1L, 3R, 2, X]
-  */
-#define TEST_CASE7_INPUT 6
-  page_t      input[TEST_CASE7_INPUT] = {{1, LEFT}, {1, RIGHT}, {2, NONE},
-                                         {3, LEFT}, {3, RIGHT}, {4, NONE}};
-  const char *expected_output_human   = "[X, 1R, 1L, X, 2, 3R, 3L, 4]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
-
-  const char *expected_output = "[X, 4, 3L, 1R, 1L, 3R, 2, X]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
 
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE7_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
+// the reading order and the printed order as the pdf output used to build
+// them, two arrays of pointers with a slot for every page
+static uint32_t reference_order(photo_t *input, uint32_t input_size,
+                                photo_t **human, photo_t **output) {
+  uint32_t len = 0, start_index = 0;
+  if (input[0].double_page == DOUBLE_PAGE_FALSE) {
+    human[len++] = &input[0];
+    start_index  = len;
+  } else if (input[0].double_page == DOUBLE_PAGE_LEFT) {
+    human[len++] = NULL;
+    human[len++] = &input[1];
+    human[len++] = &input[0];
+    start_index  = len - 1;
+  }
+  for (uint32_t i = start_index; i < input_size; ++i) {
+    bool on_right_page = (len - 1) % 2 == 0;
+    if (input[i].double_page == DOUBLE_PAGE_FALSE) {
+      if (on_right_page && i < input_size - 1 &&
+          input[i + 1].double_page != DOUBLE_PAGE_FALSE) {
+        human[len++] = NULL;
+      }
+      human[len++] = &input[i];
+    } else {
+      if (!on_right_page) {
+        human[len++] = NULL;
+      }
+      human[len++] = &input[i + 1];
+      human[len++] = &input[i++];
+    }
+  }
+  while (len % 4 != 0) {
+    human[len++] = NULL;
+  }
 
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+  uint32_t output_len = 0;
+  for (uint32_t i = 0, j = len - 1; i < j; ++i, --j) {
+    output[output_len++] = human[i % 2 ? j : i];
+    output[output_len++] = human[i % 2 ? i : j];
+  }
+  return len;
 }
-void test_case8(void) {
-  /*
-  input: [1L, 1R, 2, 3, 4L, 4R, 5, 6]
-  output_human: [X, 1R, 1L, 2, 3, 4R, 4L, 5, 6, N, N, N]
-  output: [X, N, N, 1R, 1L, N, 6, 2, 3, 5, 4L, 4R]
-  */
-#define TEST_CASE8_INPUT 8
-  page_t      input[TEST_CASE8_INPUT] = {{1, LEFT}, {1, RIGHT}, {2, NONE},
-                                         {3, NONE}, {4, LEFT},  {4, RIGHT},
-                                         {5, NONE}, {6, NONE}};
-  const char *expected_output_human =
-      "[X, 1R, 1L, 2, 3, 4R, 4L, 5, 6, N, N, N]";
-  page_t  *output_human[100];
-  uint32_t output_human_len = 0;
-  uint32_t last_non_null    = 0;
 
-  const char *expected_output = "[X, X, X, 1R, 1L, X, 6, 2, 3, 5, 4L, 4R]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
-
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE8_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
-
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
-}
-void test_case9(void) {
-  /*
-  input: [1, 2, 3, 4L, 4R, 5, 6, 7]
-  output_human: [1, 2, 3, 4R, 4L, 5, 6, 7]
-  output: [1, 7, 6, 2, 3, 5, 4L, 4R]
-  */
-#define TEST_CASE9_INPUT 8
-  page_t      input[TEST_CASE9_INPUT] = {{1, NONE}, {2, NONE},  {3, NONE},
-                                         {4, LEFT}, {4, RIGHT}, {5, NONE},
-                                         {6, NONE}, {7, NONE}};
-  const char *expected_output_human   = "[1, 2, 3, 4R, 4L, 5, 6, 7]";
-  page_t     *output_human[100];
-  uint32_t    output_human_len = 0;
-  uint32_t    last_non_null    = 0;
+static int run_bench(void) {
+  photo_t  *photos = calloc(BENCH_PAGES, sizeof(photo_t));
+  photo_t **human  = malloc((BENCH_PAGES * 2 + 4) * sizeof(photo_t *));
+  photo_t **output = malloc((BENCH_PAGES * 2 + 4) * sizeof(photo_t *));
+  if (!photos || !human || !output) {
+    return EXIT_FAILURE;
+  }
+  srand(1);
+  for (uint32_t i = 0; i < BENCH_PAGES; i++) {
+    photos[i].id = i;
+    if (i + 1 < BENCH_PAGES && rand() % 10 == 0) {
+      photos[i].double_page   = DOUBLE_PAGE_LEFT;
+      photos[++i].double_page = DOUBLE_PAGE_RIGHT;
+      photos[i].id            = i;
+    }
+  }
 
-  const char *expected_output = "[1, 7, 6, 2, 3, 5, 4L, 4R]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
+  // both sides sum what they place, so the loops can not be optimized away
+  double   best[2] = {1e9, 1e9};
+  uint64_t sum[2]  = {0};
+  uint32_t len     = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    len          = reference_order(photos, BENCH_PAGES, human, output);
+    sum[0]       = 0;
+    for (uint32_t k = 0; k < len; k++) {
+      sum[0] += output[k] ? (uint64_t)(output[k] - photos) * (k + 1) : k;
+    }
+    double middle = now();
+
+    imposition_t imposition;
+    if (!imposition_init(&CLI_FLAGS, &imposition, photos, BENCH_PAGES, 0)) {
+      return EXIT_FAILURE;
+    }
+    sum[1] = 0;
+    for (uint32_t k = 0; k < imposition_sheet_count(&imposition); k++) {
+      uint32_t sheet[2];
+      imposition_sheet(&imposition, k, sheet);
+      for (uint32_t i = 0; i < 2; i++) {
+        uint32_t at  = k * 2 + i;
+        sum[1]      += sheet[i] != IMPOSITION_BLANK
+                           ? (uint64_t)sheet[i] * (at + 1)
+                           : at;
+      }
+    }
+    double end = now();
+
+    imposition_free(&CLI_FLAGS, &imposition);
+    best[0] = middle - start < best[0] ? middle - start : best[0];
+    best[1] = end - middle < best[1] ? end - middle : best[1];
+  }
 
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE9_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
+  imposition_t imposition;
+  if (!imposition_init(&CLI_FLAGS, &imposition, photos, BENCH_PAGES, 0)) {
+    return EXIT_FAILURE;
+  }
+  int failed = sum[0] != sum[1] || imposition.page_count != len;
+  for (uint32_t k = 0; !failed && k < len; k++) {
+    uint32_t sheet[2];
+    imposition_sheet(&imposition, k / 2, sheet);
+    failed = sheet[k % 2] != (output[k] ? (uint32_t)(output[k] - photos)
+                                        : IMPOSITION_BLANK);
+  }
+  // the bits of the blanks with their ranks and the bits of the spreads
+  uint64_t words = (BENCH_PAGES * 2 + 4) / 64 + 1;
+  uint64_t memory[2] = {(uint64_t)len * 2 * sizeof(photo_t *),
+                        words * (sizeof(uint64_t) + sizeof(uint32_t)) +
+                            (BENCH_PAGES / 64 + 1) * sizeof(uint64_t)};
+
+  printf("%u pages, %u blanks, %u spreads, best of %u runs\n", len,
+         imposition.blank_count, imposition.spread_count, RUNS);
+  printf("%-12s %8.2fms %8lluKB\n", "arrays", best[0] * 1e3,
+         (unsigned long long)memory[0] / 1024);
+  printf("%-12s %8.2fms %8lluKB\n", "imposition", best[1] * 1e3,
+         (unsigned long long)memory[1] / 1024);
+  if (failed) {
+    printf("the imposition does not match the arrays\n");
+  }
+  imposition_free(&CLI_FLAGS, &imposition);
 
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+  free(photos);
+  free(human);
+  free(output);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-void test_case10(void) {
-  /*
-  input: [1, 2, 3L, 3R, 4, 5, 6L, 6R]
-  output_human: [1, X, 2, 3R, 3L, 4, 5, 6R, 6L, N, N, N]
-  output: [1, N, N, X, 2, N, 6L, 3R, 3L, 6R, 5, 4]
-  */
-#define TEST_CASE10_INPUT 8
-  page_t      input[TEST_CASE10_INPUT] = {{1, NONE},  {2, NONE}, {3, LEFT},
-                                          {3, RIGHT}, {4, NONE}, {5, NONE},
-                                          {6, LEFT},  {6, RIGHT}};
-  const char *expected_output_human =
-      "[1, X, 2, 3R, 3L, 4, 5, 6R, 6L, N, N, N]";
-  page_t  *output_human[100];
-  uint32_t output_human_len = 0;
-  uint32_t last_non_null    = 0;
 
-  const char *expected_output = "[1, X, X, X, 2, X, 6L, 3R, 3L, 6R, 5, 4]";
-  page_t     *output[100];
-  uint32_t    output_len = 0;
-
-  /* First order the output_human in human readable form */
-  REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,
-                            TEST_CASE10_INPUT, last_non_null);
-  assert(strcmp(HUMAN_READABLE_TO_STR(output_human, output_human_len,
-                                      last_non_null),
-                expected_output_human) == 0);
-
-  /* Second reorder the output in printable form */
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
-  assert(strcmp(OUTPUT_TO_STR(output, output_len), expected_output) == 0);
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--bench") == 0) {
+    return run_bench();
+  }
+  return run_cases(argc > 1 ? argv[1] : "helping-cases/test-cases.txt");
 }
@@ -0,0 +1,137 @@
+#include "archive_pool.h"
+#include "cli.h"
+#include "extras.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <zip.h>
+
+bool archive_pool_init(const cli_flags_t *cli_flags, archive_pool_t *pool,
+                       uint32_t leases) {
+  memset(pool, 0, sizeof(*pool));
+  // half of the open file limit is left for the output, the cache and the
+  // temp files
+  uint64_t      open_max = ARCHIVE_POOL_SIZE;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY) {
+    open_max = MIN(open_max, (uint64_t)limit.rlim_cur / 2);
+  }
+  pool->capacity = (uint32_t)MAX(open_max, (uint64_t)MAX(leases, 1));
+  pool->entries  = (archive_pool_entry_t *)callocv(
+      *cli_flags, "pool->entries", pool->capacity,
+      sizeof(archive_pool_entry_t), -1);
+  if (!pool->entries) {
+    return false;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->returned, NULL);
+  printfv(*cli_flags, DARK_GREEN, "Keeping up to %u source archives open\n",
+          pool->capacity);
+  return true;
+}
+
+/// an open handle of cbz_path that is not leased, a free slot, or the least
+/// recently used handle that is not leased, in that order. -1 if every slot
+/// is leased
+static int64_t _pick_entry(const archive_pool_t *pool, const char *cbz_path) {
+  int64_t free_slot = -1, oldest = -1;
+  for (uint32_t i = 0; i < pool->capacity; i++) {
+    const archive_pool_entry_t *entry = &pool->entries[i];
+    if (!entry->cbz_path && !entry->leased) {
+      free_slot = free_slot < 0 ? i : free_slot;
+    } else if (!entry->leased) {
+      if (strcmp(entry->cbz_path, cbz_path) == 0) {
+        return i;
+      }
+      if (oldest < 0 || entry->last_used < pool->entries[oldest].last_used) {
+        oldest = i;
+      }
+    }
+  }
+  return free_slot >= 0 ? free_slot : oldest;
+}
+
+static void _clear_entry(const cli_flags_t *cli_flags,
+                         archive_pool_entry_t *entry) {
+  if (entry->zip) {
+    zip_close(entry->zip);
+  }
+  freev(*cli_flags, entry->cbz_path, "entry->cbz_path", -1);
+  memset(entry, 0, sizeof(*entry));
+}
+
+zip_t *archive_pool_get(const cli_flags_t *cli_flags, archive_pool_t *pool,
+                        const char *cbz_path) {
+  pthread_mutex_lock(&pool->lock);
+  int64_t i;
+  while ((i = _pick_entry(pool, cbz_path)) < 0) {
+    pthread_cond_wait(&pool->returned, &pool->lock);
+  }
+  archive_pool_entry_t *entry = &pool->entries[i];
+  entry->leased               = true;
+  entry->last_used            = ++pool->clock;
+  if (entry->cbz_path && strcmp(entry->cbz_path, cbz_path) == 0) {
+    pthread_mutex_unlock(&pool->lock);
+    return entry->zip;
+  }
+
+  if (entry->cbz_path) {
+    printfv(*cli_flags, DARK_GREEN, "Closing source archive %s\n",
+            entry->cbz_path);
+    _clear_entry(cli_flags, entry);
+    entry->leased = true;
+  }
+  size_t path_size = strlen(cbz_path) + 1;
+  entry->cbz_path =
+      (char *)mallocv(*cli_flags, "entry->cbz_path", path_size, -1);
+  if (entry->cbz_path) {
+    memcpy(entry->cbz_path, cbz_path, path_size);
+  }
+  // the slot is leased, so the archive is opened without holding the lock
+  pthread_mutex_unlock(&pool->lock);
+
+  zip_t *zip = entry->cbz_path ? zip_open(cbz_path, ZIP_RDONLY, NULL) : NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (zip) {
+    printfv(*cli_flags, DARK_GREEN, "Opened source archive %s\n", cbz_path);
+    entry->zip = zip;
+  } else {
+    printfv(*cli_flags, RED, "Failed to open %s\n", cbz_path);
+    _clear_entry(cli_flags, entry);
+    pthread_cond_broadcast(&pool->returned);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return zip;
+}
+
+void archive_pool_put(archive_pool_t *pool, zip_t *zip) {
+  if (!zip) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  for (uint32_t i = 0; i < pool->capacity; i++) {
+    if (pool->entries[i].zip == zip) {
+      pool->entries[i].leased = false;
+      break;
+    }
+  }
+  pthread_cond_broadcast(&pool->returned);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void archive_pool_close(const cli_flags_t *cli_flags, archive_pool_t *pool) {
+  if (!pool->entries) {
+    return;
+  }
+  for (uint32_t i = 0; i < pool->capacity; i++) {
+    _clear_entry(cli_flags, &pool->entries[i]);
+  }
+  freev(*cli_flags, pool->entries, "pool->entries", -1);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->returned);
+}
@@ -0,0 +1,79 @@
+#ifndef ARCHIVE_POOL_H
+#define ARCHIVE_POOL_H
+
+#include "cli.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <zip.h>
+
+/// the most source archives that are kept open at once, fewer when the open
+/// file limit is low
+#define ARCHIVE_POOL_SIZE 64
+
+typedef struct {
+  char    *cbz_path; // NULL for a free slot
+  zip_t   *zip;      // NULL while the archive is being opened
+  bool     leased;
+  uint64_t last_used;
+} archive_pool_entry_t;
+
+/// Keeps source archives open so each central directory is only parsed once.
+/// A handle is leased to one thread at a time, so every worker can share the
+/// pool, and an archive that is read by several workers at once is opened
+/// more than once. At most capacity archives are open, the least recently
+/// used one that is not leased is closed to make room. All functions but init
+/// and close are thread safe
+typedef struct {
+  archive_pool_entry_t *entries;
+  uint32_t              capacity;
+  uint64_t              clock;
+  pthread_mutex_t       lock;
+  pthread_cond_t        returned;
+} archive_pool_t;
+
+/**
+ * Initializes an empty archive pool
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param pool Pointer to the pool
+ * @param leases The most handles that are leased at the same time, the pool
+ * keeps at least that many open
+ * @return bool false if memory ran out
+ */
+bool archive_pool_init(const cli_flags_t *cli_flags, archive_pool_t *pool,
+                       uint32_t leases);
+
+/**
+ * Leases an open handle of an archive, opening it if every open handle of it
+ * is leased. Waits when the pool is full and every handle is leased. The
+ * handle is owned by the pool, it must not be closed but given back with
+ * archive_pool_put
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param pool Pointer to the pool
+ * @param cbz_path The path of the archive
+ * @return zip_t* the handle or NULL if the archive could not be opened
+ */
+zip_t *archive_pool_get(const cli_flags_t *cli_flags, archive_pool_t *pool,
+                        const char *cbz_path);
+
+/**
+ * Gives back a handle from archive_pool_get, it can be closed afterwards
+ *
+ * @param pool Pointer to the pool
+ * @param zip The handle, NULL is ignored
+ * @return void
+ */
+void archive_pool_put(archive_pool_t *pool, zip_t *zip);
+
+/**
+ * Closes every archive in the pool and frees the pool
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param pool Pointer to the pool
+ * @return void
+ */
+void archive_pool_close(const cli_flags_t *cli_flags, archive_pool_t *pool);
+
+#endif // ARCHIVE_POOL_H
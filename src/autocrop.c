@@ -0,0 +1,191 @@
+#include "autocrop.h"
+#include "extras.h"
+#include "pixels.h"
+#include <jpeglib.h>
+#include <setjmp.h>
+#include <string.h>
+
+/// the jpeg scan decodes at 1/AUTOCROP_JPEG_SCALE of the size. At 1/2 a one
+/// pixel line is still mixed with only one pixel of border
+#define AUTOCROP_JPEG_SCALE 2
+
+void autocrop_scan_init(autocrop_scan_t *scan, uint8_t *column_min,
+                        uint32_t width, uint32_t channels) {
+  memset(scan, 0, sizeof(*scan));
+  memset(column_min, 0xFF, (size_t)width * channels);
+  scan->column_min = column_min;
+  scan->width      = width;
+  scan->channels   = channels;
+}
+
+void autocrop_scan_row(autocrop_scan_t *scan, const uint8_t *row) {
+  const pixel_kernels_t *kernels = pixel_kernels();
+  size_t                 size    = (size_t)scan->width * scan->channels;
+  uint32_t               y       = scan->rows++;
+  uint8_t                min, max;
+  kernels->min_max(row, size, &min, &max);
+  if (min >= AUTOCROP_WHITE) {
+    return; // a white row can not move the left or right edge either
+  }
+  if (!scan->found) {
+    scan->top   = y;
+    scan->found = true;
+  }
+  scan->bottom = y + 1;
+  kernels->min_into(scan->column_min, row, size);
+}
+
+/// a column is content if any of its channels went below AUTOCROP_WHITE
+static bool _is_content_column(const autocrop_scan_t *scan, uint32_t x) {
+  const uint8_t *pixel = scan->column_min + (size_t)x * scan->channels;
+  for (uint32_t c = 0; c < scan->channels; c++) {
+    if (pixel[c] < AUTOCROP_WHITE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool autocrop_scan_box(const autocrop_scan_t *scan, uint32_t margin,
+                       autocrop_box_t *box) {
+  if (!scan->found) {
+    return false;
+  }
+  // a content row has a content column, so both loops stop
+  uint32_t left = 0;
+  while (!_is_content_column(scan, left)) {
+    left++;
+  }
+  uint32_t right = scan->width;
+  while (!_is_content_column(scan, right - 1)) {
+    right--;
+  }
+
+  uint32_t top    = scan->top;
+  uint32_t bottom = scan->bottom;
+  left            = left > margin ? left - margin : 0;
+  top             = top > margin ? top - margin : 0;
+  right           = scan->width - right > margin ? right + margin : scan->width;
+  bottom          = scan->rows - bottom > margin ? bottom + margin : scan->rows;
+
+  box->x      = left;
+  box->y      = top;
+  box->width  = right - left;
+  box->height = bottom - top;
+  return true;
+}
+
+bool autocrop_is_worth(const autocrop_box_t *box, uint32_t width,
+                       uint32_t height) {
+  uint64_t kept  = (uint64_t)box->width * box->height;
+  uint64_t total = (uint64_t)width * height;
+  return kept * 100 <= total * (100 - AUTOCROP_MIN_GAIN);
+}
+
+/// libjpeg calls exit on errors by default, this jumps back instead
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf               jump;
+} autocrop_jpeg_error_t;
+
+static void _jpeg_error_exit(j_common_ptr cinfo) {
+  autocrop_jpeg_error_t *err = (autocrop_jpeg_error_t *)cinfo->err;
+  longjmp(err->jump, 1);
+}
+
+bool autocrop_jpeg_boxes(const uint8_t *buffer, uint64_t buffer_size,
+                         uint32_t count, const bool wanted[],
+                         autocrop_box_t boxes[]) {
+  struct jpeg_decompress_struct cinfo;
+  autocrop_jpeg_error_t         err;
+
+  cinfo.err          = jpeg_std_error(&err.pub);
+  err.pub.error_exit = _jpeg_error_exit;
+  jpeg_create_decompress(&cinfo);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  jpeg_mem_src(&cinfo, buffer, buffer_size);
+  jpeg_read_header(&cinfo, TRUE);
+  if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
+    cinfo.out_color_space = JCS_GRAYSCALE;
+  } else if (cinfo.jpeg_color_space == JCS_YCbCr ||
+             cinfo.jpeg_color_space == JCS_RGB) {
+    // every channel is looked at like in a png, a yellow mark is as bright
+    // as the border in luma alone
+    cinfo.out_color_space = JCS_RGB;
+  } else {
+    jpeg_destroy_decompress(&cinfo); // CMYK can not be turned into rgb
+    return true;
+  }
+  cinfo.scale_num   = 1;
+  cinfo.scale_denom = AUTOCROP_JPEG_SCALE;
+  jpeg_start_decompress(&cinfo);
+  uint32_t channels = (uint32_t)cinfo.output_components;
+
+  // boxes in scaled pixels
+  JDIMENSION      starts[2], ends[2], tops[2], bottoms[2];
+  autocrop_scan_t scans[2];
+  for (uint32_t i = 0; i < count; i++) {
+    if (!wanted[i]) {
+      continue;
+    }
+    starts[i]  = boxes[i].x / AUTOCROP_JPEG_SCALE;
+    ends[i]    = MIN((boxes[i].x + boxes[i].width + AUTOCROP_JPEG_SCALE - 1) /
+                         AUTOCROP_JPEG_SCALE,
+                     cinfo.output_width);
+    tops[i]    = boxes[i].y / AUTOCROP_JPEG_SCALE;
+    bottoms[i] = MIN((boxes[i].y + boxes[i].height + AUTOCROP_JPEG_SCALE - 1) /
+                         AUTOCROP_JPEG_SCALE,
+                     cinfo.output_height);
+    uint8_t *column_min = (uint8_t *)(*cinfo.mem->alloc_small)(
+        (j_common_ptr)&cinfo, JPOOL_IMAGE,
+        (size_t)(ends[i] - starts[i]) * channels);
+    autocrop_scan_init(&scans[i], column_min, ends[i] - starts[i], channels);
+  }
+
+  JDIMENSION batch_height = cinfo.rec_outbuf_height;
+  JSAMPARRAY batch        = (*cinfo.mem->alloc_sarray)(
+      (j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width * channels,
+      batch_height);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JDIMENSION first = cinfo.output_scanline;
+    JDIMENSION read  = jpeg_read_scanlines(&cinfo, batch, batch_height);
+    for (JDIMENSION row = 0; row < read; row++) {
+      for (uint32_t i = 0; i < count; i++) {
+        if (wanted[i] && first + row >= tops[i] && first + row < bottoms[i]) {
+          autocrop_scan_row(&scans[i],
+                            batch[row] + (size_t)starts[i] * channels);
+        }
+      }
+    }
+  }
+  JDIMENSION imcu_width  = cinfo.max_h_samp_factor * DCTSIZE;
+  JDIMENSION imcu_height = cinfo.max_v_samp_factor * DCTSIZE;
+
+  // the column mins live in the decoder's pool, so it is kept until here
+  for (uint32_t i = 0; i < count; i++) {
+    autocrop_box_t found;
+    if (!wanted[i] ||
+        !autocrop_scan_box(&scans[i], AUTOCROP_MARGIN / AUTOCROP_JPEG_SCALE,
+                           &found)) {
+      continue;
+    }
+    JDIMENSION left = found.x * AUTOCROP_JPEG_SCALE / imcu_width * imcu_width;
+    JDIMENSION top =
+        found.y * AUTOCROP_JPEG_SCALE / imcu_height * imcu_height;
+    JDIMENSION right  = MIN((found.x + found.width) * AUTOCROP_JPEG_SCALE,
+                            boxes[i].width);
+    JDIMENSION bottom = MIN((found.y + found.height) * AUTOCROP_JPEG_SCALE,
+                            boxes[i].height);
+    boxes[i].x       += left;
+    boxes[i].y       += top;
+    boxes[i].width    = right - left;
+    boxes[i].height   = bottom - top;
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
@@ -0,0 +1,97 @@
+#ifndef AUTOCROP_H
+#define AUTOCROP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// a pixel with every channel at least this bright is part of the border
+#define AUTOCROP_WHITE 224
+
+/// pixels of border that are kept around the content
+#define AUTOCROP_MARGIN 16
+
+/// a crop has to save at least this many percent of the pixels of a page to
+/// be worth encoding the page again
+#define AUTOCROP_MIN_GAIN 3
+
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} autocrop_box_t;
+
+/// Finds the box around everything that is not white, one row at a time.
+/// The rows have to be fed top to bottom
+typedef struct {
+  uint8_t *column_min; // the darkest byte of every column of the content rows
+  uint32_t width;
+  uint32_t channels;
+  uint32_t rows; // rows seen so far
+  uint32_t top;
+  uint32_t bottom; // one past the last content row
+  bool     found;  // a content row was seen
+} autocrop_scan_t;
+
+/**
+ * Starts a scan
+ *
+ * @param scan Pointer to the scan
+ * @param column_min Buffer of width * channels bytes, it is owned by the
+ * caller so it can come from any allocator
+ * @param width The width of the rows in pixels
+ * @param channels The bytes per pixel
+ * @return void
+ */
+void autocrop_scan_init(autocrop_scan_t *scan, uint8_t *column_min,
+                        uint32_t width, uint32_t channels);
+
+/**
+ * Adds the next row to a scan
+ *
+ * @param scan Pointer to the scan
+ * @param row The row, width * channels bytes
+ * @return void
+ */
+void autocrop_scan_row(autocrop_scan_t *scan, const uint8_t *row);
+
+/**
+ * Gets the box around the content of every row that was added
+ *
+ * @param scan Pointer to the scan
+ * @param margin The pixels of border to keep on every side
+ * @param box Pointer to the box that will be filled in
+ * @return bool false if every row was white
+ */
+bool autocrop_scan_box(const autocrop_scan_t *scan, uint32_t margin,
+                       autocrop_box_t *box);
+
+/**
+ * Checks if a crop saves enough to encode a page again for it
+ *
+ * @param box Pointer to the box
+ * @param width The width of the page
+ * @param height The height of the page
+ * @return bool true if the box leaves out at least AUTOCROP_MIN_GAIN percent
+ */
+bool autocrop_is_worth(const autocrop_box_t *box, uint32_t width,
+                       uint32_t height);
+
+/**
+ * Shrinks every wanted box of a jpeg to the content inside it. The page is
+ * decoded at half its size and every channel is checked, like a png is. x
+ * and y are moved down to the iMCU boundary a lossless crop needs, boxes
+ * must start on one already. A box without content is left as it is
+ *
+ * @param buffer The jpeg
+ * @param buffer_size The size of the jpeg
+ * @param count The number of boxes, 1 or 2
+ * @param wanted Which boxes to shrink
+ * @param boxes The boxes, in pixels of the page
+ * @return bool false if the jpeg could not be decoded
+ */
+bool autocrop_jpeg_boxes(const uint8_t *buffer, uint64_t buffer_size,
+                         uint32_t count, const bool wanted[],
+                         autocrop_box_t boxes[]);
+
+#endif // AUTOCROP_H
@@ -1,4 +1,5 @@
 #include "cli.h"
+#include "compression.h"
 #include "extras.h"
 #include "file_entry_t.h"
 #include <stdint.h>
@@ -37,6 +38,19 @@ void free_memory(const cli_flags_t *cli_flags, char **input,
   free_output_file(cli_flags, output_file);
 }
 
+uint32_t parse_cli_number(const cli_flags_t *cli_flags, const char *arg,
+                          int error_code, char **input,
+                          const uint32_t *input_count, char **output_file) {
+  char         *end   = NULL;
+  unsigned long value = strtoul(arg, &end, 10);
+  if (end == arg || *end != '\0' || value == 0 || value > UINT32_MAX) {
+    // must free
+    free_memory(cli_flags, input, input_count, output_file);
+    print_error_s(error_code, arg);
+  }
+  return (uint32_t)value;
+}
+
 void handle_cli(cli_flags_t *cli_flags, const int *argc, const char **argv,
                 uint32_t *input_count, char **output_file, char **input) {
   for (uint32_t i = 1; i < *argc; ++i) {
@@ -76,6 +90,67 @@ void handle_cli(cli_flags_t *cli_flags, const int *argc, const char **argv,
       cli_flags->input_mode = DIRECTORIES;
     } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--color") == 0) {
       cli_flags->color_mode = COLOR_ENABLED;
+    } else if (strcmp(argv[i], "-a") == 0 ||
+               strcmp(argv[i], "--append") == 0) {
+      cli_flags->append_mode = APPEND_ENABLED;
+    } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+      check_arg(i++, *argc, 9);
+      cli_flags->jobs = parse_cli_number(cli_flags, argv[i], 9, input,
+                                         input_count, output_file);
+    } else if (strcmp(argv[i], "-w") == 0 ||
+               strcmp(argv[i], "--window") == 0) {
+      check_arg(i++, *argc, 11);
+      cli_flags->window = parse_cli_number(cli_flags, argv[i], 11, input,
+                                           input_count, output_file);
+    } else if (strcmp(argv[i], "--dpi") == 0) {
+      check_arg(i++, *argc, 13);
+      cli_flags->dpi = parse_cli_number(cli_flags, argv[i], 13, input,
+                                        input_count, output_file);
+    } else if (strcmp(argv[i], "--read-buffer") == 0) {
+      check_arg(i++, *argc, 15);
+      cli_flags->read_buffer = parse_cli_number(cli_flags, argv[i], 15,
+                                                input, input_count,
+                                                output_file);
+    } else if (strcmp(argv[i], "--signature") == 0) {
+      check_arg(i++, *argc, 16);
+      cli_flags->signature = parse_cli_number(cli_flags, argv[i], 16, input,
+                                              input_count, output_file);
+      if (cli_flags->signature % 4 != 0) {
+        // must free
+        free_memory(cli_flags, input, input_count, output_file);
+        print_error_s(16, argv[i]);
+      }
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      cli_flags->cache_mode = CACHE_ENABLED;
+    } else if (strcmp(argv[i], "--cache-file") == 0) {
+      check_arg(i++, *argc, 12);
+      cli_flags->cache_mode = CACHE_ENABLED;
+      cli_flags->cache_file = argv[i];
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      cli_flags->cache_mode = CACHE_DISABLED;
+    } else if (strcmp(argv[i], "--rebuild-cache") == 0) {
+      cli_flags->cache_mode = CACHE_REBUILD;
+    } else if (strcmp(argv[i], "--dedup") == 0) {
+      cli_flags->dedup_mode = DEDUP_ENABLED;
+    } else if (strcmp(argv[i], "--dedup-report") == 0) {
+      check_arg(i++, *argc, 14);
+      cli_flags->dedup_mode   = DEDUP_ENABLED;
+      cli_flags->dedup_report = argv[i];
+    } else if (strcmp(argv[i], "--autocrop") == 0) {
+      cli_flags->autocrop_mode = AUTOCROP_ENABLED;
+    } else if (strcmp(argv[i], "--baseline") == 0) {
+      cli_flags->baseline_mode = BASELINE_ENABLED;
+    } else if (strcmp(argv[i], "--baseline-optimize") == 0) {
+      cli_flags->baseline_mode = BASELINE_OPTIMIZED;
+    } else if (strcmp(argv[i], "-z") == 0 ||
+               strcmp(argv[i], "--compression") == 0) {
+      check_arg(i++, *argc, 10);
+      if (!parse_compression_policy(argv[i], &cli_flags->compression_policy,
+                                    &cli_flags->compression_level)) {
+        // must free
+        free_memory(cli_flags, input, input_count, output_file);
+        print_error_s(10, argv[i]);
+      }
     } else {
       // store the input files or directories
       if (cli_flags->input_mode == INPUT_MODE_E_NONE) {
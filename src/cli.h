@@ -7,9 +7,23 @@
 typedef enum { INPUT_MODE_E_NONE, FILES, DIRECTORIES } input_mode_e;
 
 typedef struct {
-  verbose_mode_e verbose_mode;
-  color_mode_e   color_mode;
-  input_mode_e   input_mode;
+  verbose_mode_e       verbose_mode;
+  color_mode_e         color_mode;
+  input_mode_e         input_mode;
+  append_mode_e        append_mode;
+  uint32_t             jobs;
+  uint32_t             window;
+  uint32_t             dpi; // 0 keeps the pdf images as they are
+  compression_policy_e compression_policy;
+  uint32_t             compression_level;
+  cache_mode_e         cache_mode;
+  const char          *cache_file; // NULL for the default, points into argv
+  dedup_mode_e         dedup_mode;
+  const char          *dedup_report; // NULL for none, points into argv
+  autocrop_mode_e      autocrop_mode;
+  baseline_mode_e      baseline_mode; // only used for cbz output
+  uint32_t             read_buffer;   // MiB, only used for pdf output
+  uint32_t             signature;     // pages per pdf signature, 0 for one
 } cli_flags_t;
 
 /**
@@ -41,6 +55,21 @@ void free_output_file(const cli_flags_t *cli_flags, char **output_file);
  */
 void free_memory(const cli_flags_t *cli_flags, char **input_files,
                  const uint32_t *file_count, char **output_file);
+/**
+ * Parses a positive number passed to an option, on failure everything is
+ * freed and the program exits with error_code
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param arg The argument to parse
+ * @param error_code The error code to exit with
+ * @param input Pointer to array of input file/dir names
+ * @param input_count Pointer to the file/dir count
+ * @param output_file Pointer to the output file name
+ * @return uint32_t the parsed number
+ */
+uint32_t parse_cli_number(const cli_flags_t *cli_flags, const char *arg,
+                          int error_code, char **input,
+                          const uint32_t *input_count, char **output_file);
 /**
  * Handles command line arguments, populates input files, output file name, and
  * flags
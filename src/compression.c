@@ -0,0 +1,99 @@
+#include "compression.h"
+#include "cli.h"
+#include "extras.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool parse_compression_policy(const char *arg, compression_policy_e *policy,
+                              uint32_t *level) {
+  if (strcmp(arg, "auto") == 0) {
+    *policy = COMPRESSION_POLICY_AUTO;
+    return true;
+  }
+  if (strcmp(arg, "store") == 0) {
+    *policy = COMPRESSION_POLICY_STORE;
+    return true;
+  }
+  if (strncmp(arg, "deflate", 7) != 0) {
+    return false;
+  }
+
+  *policy = COMPRESSION_POLICY_DEFLATE;
+  if (arg[7] == '\0') {
+    return true;
+  }
+  if (arg[7] != ':' || arg[8] < '1' || arg[8] > '9' || arg[9] != '\0') {
+    return false;
+  }
+  *level = (uint32_t)(arg[8] - '0');
+  return true;
+}
+
+compression_choice_t choose_compression(const cli_flags_t *cli_flags) {
+  compression_choice_t choice = {.method = COMPRESSION_METHOD_STORE,
+                                 .level  = cli_flags->compression_level};
+  switch (cli_flags->compression_policy) {
+  case COMPRESSION_POLICY_AUTO:
+    // jpeg/png barely shrink (<1%) so deflating them is wasted cpu
+  case COMPRESSION_POLICY_STORE:
+    break;
+  case COMPRESSION_POLICY_DEFLATE:
+    choice.method = COMPRESSION_METHOD_DEFLATE;
+    break;
+  }
+  return choice;
+}
+
+compression_choice_t
+choose_passthrough_compression(const cli_flags_t *cli_flags,
+                               uint16_t           source_method) {
+  compression_choice_t choice = choose_compression(cli_flags);
+  // auto never pays to recompress something that is already in the archive,
+  // the other policies only do when the method actually differs
+  if (cli_flags->compression_policy == COMPRESSION_POLICY_AUTO ||
+      choice.method == source_method) {
+    choice.method = source_method;
+  }
+  return choice;
+}
+
+void compression_stats_add(compression_stats_t *stats, entry_source_e source,
+                           uint16_t method, uint64_t raw_bytes,
+                           uint64_t written_bytes) {
+  compression_tally_t *tally =
+      &stats->tallies[source][method == COMPRESSION_METHOD_STORE ? 0 : 1];
+  tally->entries++;
+  tally->raw_bytes     += raw_bytes;
+  tally->written_bytes += written_bytes;
+}
+
+void print_compression_report(const cli_flags_t         *cli_flags,
+                              const compression_stats_t *stats) {
+  static const char *source_names[ENTRY_SOURCE_COUNT] = {
+      "passthrough", "recompressed", "encoded"};
+  static const char *method_names[2] = {"stored", "deflated"};
+
+  printfv(*cli_flags, BLUE, "Compression report:\n");
+  for (uint32_t source = 0; source < ENTRY_SOURCE_COUNT; source++) {
+    for (uint32_t method = 0; method < 2; method++) {
+      const compression_tally_t *tally = &stats->tallies[source][method];
+      if (tally->entries == 0) {
+        continue;
+      }
+      int64_t delta = (int64_t)tally->raw_bytes - (int64_t)tally->written_bytes;
+      printfv(*cli_flags, BLUE,
+              "  %-11s %-8s %6u entries %12llu -> %12llu bytes (%s %llu "
+              "bytes, %.2f%%)\n",
+              source_names[source], method_names[method], tally->entries,
+              (unsigned long long)tally->raw_bytes,
+              (unsigned long long)tally->written_bytes,
+              delta >= 0 ? "saved" : "cost",
+              (unsigned long long)llabs(delta),
+              tally->raw_bytes
+                  ? 100.0 * (double)llabs(delta) / (double)tally->raw_bytes
+                  : 0.0);
+    }
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "cli.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// zip compression methods, the values are the ones used in the zip format
+#define COMPRESSION_METHOD_STORE   0
+#define COMPRESSION_METHOD_DEFLATE 8
+
+#define DEFAULT_COMPRESSION_LEVEL 6
+
+typedef enum {
+  ENTRY_SOURCE_PASSTHROUGH,  // copied from a source archive
+  ENTRY_SOURCE_RECOMPRESSED, // read from a source archive, compressed again
+  ENTRY_SOURCE_ENCODED,      // produced by this program (split halves)
+  ENTRY_SOURCE_COUNT,
+} entry_source_e;
+
+typedef struct {
+  uint16_t method;
+  uint32_t level; // only used by deflate
+} compression_choice_t;
+
+typedef struct {
+  uint32_t entries;
+  uint64_t raw_bytes;
+  uint64_t written_bytes;
+} compression_tally_t;
+
+/// tallies[source][0] is stored entries, tallies[source][1] is deflated ones
+typedef struct {
+  compression_tally_t tallies[ENTRY_SOURCE_COUNT][2];
+} compression_stats_t;
+
+/**
+ * Parses the argument of --compression (auto, store, deflate or deflate:N)
+ *
+ * @param arg The argument
+ * @param policy Pointer to the policy that will be set
+ * @param level Pointer to the deflate level that will be set
+ * @return bool false if arg is not a valid policy
+ */
+bool parse_compression_policy(const char *arg, compression_policy_e *policy,
+                              uint32_t *level);
+
+/**
+ * Picks the compression method for a new entry, every entry that is written
+ * is a jpeg or a png
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @return compression_choice_t the method and level to use
+ */
+compression_choice_t choose_compression(const cli_flags_t *cli_flags);
+
+/**
+ * Picks the compression method for an entry copied from a source archive.
+ * When the returned method is source_method the compressed bytes can be
+ * copied as they are
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param source_method The method the entry uses in the source archive
+ * @return compression_choice_t the method and level to use
+ */
+compression_choice_t
+choose_passthrough_compression(const cli_flags_t *cli_flags,
+                               uint16_t           source_method);
+
+/**
+ * Records how many bytes an entry took before and after compression
+ *
+ * @param stats Pointer to the stats
+ * @param source Where the entry came from
+ * @param method The method the entry was written with
+ * @param raw_bytes The uncompressed size
+ * @param written_bytes The compressed size
+ * @return void
+ */
+void compression_stats_add(compression_stats_t *stats, entry_source_e source,
+                           uint16_t method, uint64_t raw_bytes,
+                           uint64_t written_bytes);
+
+/**
+ * Prints how many bytes each compression choice saved or cost
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param stats Pointer to the stats
+ * @return void
+ */
+void print_compression_report(const cli_flags_t         *cli_flags,
+                              const compression_stats_t *stats);
+
+#endif // COMPRESSION_H
@@ -0,0 +1,102 @@
+#include "dedup.h"
+#include "cli.h"
+#include "extras.h"
+#include "sha256.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  uint32_t crc;
+  uint64_t size;
+  uint32_t item;
+} dedup_order_t;
+
+static int _compare_order(const void *a, const void *b) {
+  const dedup_order_t *x = (const dedup_order_t *)a;
+  const dedup_order_t *y = (const dedup_order_t *)b;
+  if (x->crc != y->crc) {
+    return x->crc < y->crc ? -1 : 1;
+  }
+  if (x->size != y->size) {
+    return x->size < y->size ? -1 : 1;
+  }
+  return x->item < y->item ? -1 : x->item > y->item;
+}
+
+/// hashes the items of a run with the same crc and size and drops the ones
+/// that have the same digest as an item of an earlier group
+static void _resolve_run(const dedup_key_t *keys, const dedup_order_t *run,
+                         uint32_t run_len, dedup_hash_fn hash, void *ctx,
+                         uint8_t *digests, bool *hashed, uint32_t *duplicate_of,
+                         uint32_t *dropped) {
+  for (uint32_t j = 0; j < run_len; j++) {
+    hashed[j] = hash(ctx, run[j].item, digests + j * SHA256_DIGEST_SIZE);
+  }
+  for (uint32_t j = 1; j < run_len; j++) {
+    const dedup_key_t *key = &keys[run[j].item];
+    for (uint32_t i = 0; hashed[j] && i < j; i++) {
+      if (hashed[i] && keys[run[i].item].group < key->group &&
+          memcmp(digests + i * SHA256_DIGEST_SIZE,
+                 digests + j * SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE) == 0) {
+        duplicate_of[run[j].item] = run[i].item;
+        (*dropped)++;
+        break;
+      }
+    }
+  }
+}
+
+uint32_t *dedup_find(const cli_flags_t *cli_flags, const dedup_key_t *keys,
+                     uint32_t count, dedup_hash_fn hash, void *ctx,
+                     uint32_t *dropped) {
+  *dropped               = 0;
+  uint32_t *duplicate_of = (uint32_t *)mallocv(
+      *cli_flags, "duplicate_of", MAX(count, 1) * sizeof(uint32_t), -1);
+  dedup_order_t *order = (dedup_order_t *)mallocv(
+      *cli_flags, "order", MAX(count, 1) * sizeof(dedup_order_t), -1);
+  uint8_t *digests = (uint8_t *)mallocv(
+      *cli_flags, "digests", MAX(count, 1) * (size_t)SHA256_DIGEST_SIZE, -1);
+  bool *hashed =
+      (bool *)mallocv(*cli_flags, "hashed", MAX(count, 1) * sizeof(bool), -1);
+  if (!duplicate_of || !order || !digests || !hashed) {
+    freev(*cli_flags, duplicate_of, "duplicate_of", -1);
+    freev(*cli_flags, order, "order", -1);
+    freev(*cli_flags, digests, "digests", -1);
+    freev(*cli_flags, hashed, "hashed", -1);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    duplicate_of[i] = DEDUP_KEPT;
+    order[i]        = (dedup_order_t){keys[i].crc, keys[i].size, i};
+  }
+  qsort(order, count, sizeof(dedup_order_t), _compare_order);
+
+  // only runs that span more than one group can drop anything, so most items
+  // are never read
+  uint32_t hashes = 0;
+  for (uint32_t start = 0, end; start < count; start = end) {
+    bool groups = false;
+    for (end = start + 1; end < count && order[end].crc == order[start].crc &&
+                          order[end].size == order[start].size;
+         end++) {
+      groups |= keys[order[end].item].group != keys[order[start].item].group;
+    }
+    if (!groups || order[start].size == 0) {
+      continue;
+    }
+    _resolve_run(keys, &order[start], end - start, hash, ctx, digests, hashed,
+                 duplicate_of, dropped);
+    hashes += end - start;
+  }
+  printfv(*cli_flags, DARK_GREEN,
+          "Hashed %u of %u entries to find %u duplicates\n", hashes, count,
+          *dropped);
+
+  freev(*cli_flags, order, "order", -1);
+  freev(*cli_flags, digests, "digests", -1);
+  freev(*cli_flags, hashed, "hashed", -1);
+  return duplicate_of;
+}
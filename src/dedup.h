@@ -0,0 +1,43 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "cli.h"
+#include "sha256.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// duplicate_of value of an item that is kept
+#define DEDUP_KEPT UINT32_MAX
+
+/// what is known about an item without reading it, from the zip central
+/// directory. Items with a size of 0 are never dropped
+typedef struct {
+  uint32_t crc;
+  uint64_t size;
+  uint32_t group; // the archive the item is in
+} dedup_key_t;
+
+/// hashes the contents of an item, false if it could not be read
+typedef bool (*dedup_hash_fn)(void *ctx, uint32_t item,
+                              uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Finds the items that are a copy of an item in an earlier group. Items are
+ * matched by crc and size first and only the ones that match an item of
+ * another group are hashed, a drop needs the same sha256 as well. Copies
+ * inside one group are kept since they are part of that archive's layout
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param keys The keys of the items, ordered by group
+ * @param count The number of items
+ * @param hash The function that hashes an item
+ * @param ctx Passed to hash
+ * @param dropped Pointer that will be set to the number of dropped items
+ * @return uint32_t* for every item the earliest item it is a copy of or
+ * DEDUP_KEPT, free with free. NULL if memory ran out
+ */
+uint32_t *dedup_find(const cli_flags_t *cli_flags, const dedup_key_t *keys,
+                     uint32_t count, dedup_hash_fn hash, void *ctx,
+                     uint32_t *dropped);
+
+#endif // DEDUP_H
@@ -1,71 +1,65 @@
 #define _POSIX_C_SOURCE 200809L /* for strdup */
 #include "extract.h"
+#include "archive_pool.h"
+#include "autocrop.h"
 #include "cli.h"
+#include "compression.h"
+#include "dedup.h"
 #include "extras.h"
 #include "file_entry_t.h"
-#include <hpdf.h>
+#include "image_probe.h"
+#include "imposition.h"
+#include "page_cache.h"
+#include "pdf_writer.h"
+#include "pixels.h"
+#include "png_chunks.h"
+#include "reorder_buffer.h"
+#include "sha256.h"
+#include "split_cache.h"
+#include "worker_pool.h"
+#include "zip_writer.h"
+#include <jerror.h>
 #include <jpeglib.h>
 #include <linux/limits.h> // for PATH_MAX
 #include <math.h>
 #include <png.h>
+#include <pthread.h>
 #include <regex.h>
+#include <setjmp.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
 #include <zip.h>
 #include <zipconf.h>
+#include <zlib.h>
 
-#define REORDER_TO_HUMAN_READABLE(input, output_human, output_human_len,       \
-                                  INPUT_SIZE)                                  \
-  uint32_t start_index = 0;                                                    \
-  /* Check first */                                                            \
-  if (input[0].double_page == DOUBLE_PAGE_FALSE) {                             \
-    output_human[output_human_len++] = &input[0];                              \
-    start_index                      = output_human_len;                       \
-  } else if (input[0].double_page == DOUBLE_PAGE_LEFT) {                       \
-    output_human[output_human_len++] = NULL;                                   \
-    output_human[output_human_len++] = &input[1];                              \
-    output_human[output_human_len++] =                                         \
-        &input[0]; /* has to be L, we are ensured */                           \
-    start_index = output_human_len - 1;                                        \
-  }                                                                            \
-                                                                               \
-  for (uint32_t i = start_index; i < INPUT_SIZE; ++i) {                        \
-    photo_t p             = input[i];                                          \
-    bool    on_right_page = (output_human_len - 1) % 2 == 0;                   \
-    if (p.double_page == DOUBLE_PAGE_FALSE) {                                  \
-      if (on_right_page && i < INPUT_SIZE - 1 &&                               \
-          (input[i + 1].double_page != DOUBLE_PAGE_FALSE)) {                   \
-        output_human[output_human_len++] = NULL;                               \
-      }                                                                        \
-      output_human[output_human_len++] = &input[i];                            \
-    } else {                                                                   \
-      if (!on_right_page) { /* on left page_t */                               \
-        output_human[output_human_len++] = NULL;                               \
-      }                                                                        \
-      /* we are ensured that this will be in bounds since L then R */          \
-      output_human[output_human_len++] = &input[i + 1]; /* Add Right first */  \
-      output_human[output_human_len++] =                                       \
-          &input[i++]; /* Add Left second, inc to skip right */                \
-    }                                                                          \
-  }                                                                            \
-  while (output_human_len % 4 != 0) {                                          \
-    output_human[output_human_len++] = NULL;                                   \
-  }
-
-#define REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output)        \
-  uint32_t output_len = 0;                                                     \
-  for (uint32_t i = 0, j = output_human_len - 1; i < j; ++i, --j) {            \
-    bool     on_front_side = (i % 2) != 0;                                     \
-    uint32_t idx1 = i, idx2 = j;                                               \
-                                                                               \
-    if (on_front_side) {                                                       \
-      idx1 = j;                                                                \
-      idx2 = i;                                                                \
-    }                                                                          \
-    output[output_len++] = output_human[idx1];                                 \
-    output[output_len++] = output_human[idx2];                                 \
-  }
+/// the cbz output records the chapter number of its last archive in the
+/// archive comment so --append knows where to continue
+#define OUTPUT_COMMENT_PREFIX "cbz-combiner last chapter: "
+
+/// pdf images are shrunk to the pixels they are printed with when --dpi is
+/// given, shrunk jpegs are encoded again at this quality
+#define PDF_POINTS_PER_INCH 72.0f
+#define SHRINK_JPEG_QUALITY 90
+
+/// every pdf sheet is an A4 page in landscape, in pdf points
+#define PDF_SHEET_WIDTH  841.89f
+#define PDF_SHEET_HEIGHT 595.276f
+
+/// a sheet is two pages side by side, each with a border around it
+#define PDF_SHEET_BORDER 10.0f
+#define PDF_SLOT_WIDTH   (PDF_SHEET_WIDTH / 2 - 2 * PDF_SHEET_BORDER)
+#define PDF_SLOT_HEIGHT  (PDF_SHEET_HEIGHT - 2 * PDF_SHEET_BORDER)
+
+/// a re-encoded rgb page whose channels are never further apart than this is
+/// encoded with one channel
+#define GRAY_TOLERANCE 8
+
+/// first size of the buffer a jpeg is encoded into, it doubles from there
+#define JPEG_DEST_CHUNK 65536
+
+/// entries are inflated this much at a time while they are hashed for --dedup
+#define DEDUP_CHUNK_SIZE 32768
 
 /// the file names must follow [<number>]_<name>.cbz
 /// patern will get the <number> portion
@@ -139,50 +133,152 @@ static void _get_jpeg_dimensions_from_memory(const cli_flags_t   *cli_flags,
   cinfo.err = jpeg_std_error(&jerr);
   jpeg_create_decompress(&cinfo);
 
+  // the header is all that is needed, no need to decode any scanlines
   jpeg_mem_src(&cinfo, (unsigned char *)data, size);
   jpeg_read_header(&cinfo, TRUE);
-  jpeg_start_decompress(&cinfo);
 
-  *width  = cinfo.output_width;
-  *height = cinfo.output_height;
+  *width  = cinfo.image_width;
+  *height = cinfo.image_height;
 
-  while (cinfo.output_scanline < cinfo.output_height) {
-    unsigned char *row_pointer = (unsigned char *)mallocv(
-        *cli_flags, "row_pointer",
-        (size_t)(cinfo.output_width * cinfo.output_components), -1);
-    jpeg_read_scanlines(&cinfo, &row_pointer, 1);
-    freev(*cli_flags, row_pointer, "row_pointer", -1);
-  }
-
-  jpeg_finish_decompress(&cinfo);
   jpeg_destroy_decompress(&cinfo);
 }
 
-static bool _get_width_height_and_type(const cli_flags_t *cli_flags,
+static const char *_image_type_ext(image_type_e type) {
+  switch (type) {
+  case IMAGE_TYPE_JPEG:
+    return ".jpg";
+  case IMAGE_TYPE_PNG:
+    return ".png";
+  default:
+    return "";
+  }
+}
+
+/// takes what probe_image_header made of contents, so the header is probed
+/// once. libpng/libjpeg only parse contents when the probe failed
+static bool _get_width_height_and_type(const cli_flags_t  *cli_flags,
+                                       probe_status_e      status,
+                                       const image_info_t *info,
                                        uint32_t *width, uint32_t *height,
-                                       char **ext, const uint8_t *contents,
-                                       struct zip_stat *st) {
+                                       image_type_e  *type,
+                                       const uint8_t *contents, size_t size) {
   // Note: cannot use filetype variable since it might be named as a png
   // but be a jpeg
-  if (is_png((unsigned char *)contents, st->size)) {
-    _get_png_dimensions_from_memory(cli_flags, (uint8_t *)contents, st->size,
+  if (status == PROBE_OK) {
+    printfv(*cli_flags, DARK_YELLOW, "File header was probed (%ux%u)\n",
+            info->width, info->height);
+    *width  = info->width;
+    *height = info->height;
+    *type   = info->type;
+    return true;
+  }
+
+  // header is unusual, let libpng/libjpeg parse it
+  if (is_png((unsigned char *)contents, size)) {
+    _get_png_dimensions_from_memory(cli_flags, (uint8_t *)contents, size,
                                     width, height);
-    strncpyv(*cli_flags, *ext, ".png\0", 5, 5);
+    *type = IMAGE_TYPE_PNG;
     return true;
   }
-  if (is_jpeg((unsigned char *)contents, st->size)) {
+  if (is_jpeg((unsigned char *)contents, size)) {
     printfv(*cli_flags, DARK_YELLOW, "File is detected as a JPEG\n");
     _get_jpeg_dimensions_from_memory(cli_flags, (unsigned char *)contents,
-                                     st->size, width, height);
-    strncpyv(*cli_flags, *ext, ".jpg\0", 5, 5);
+                                     size, width, height);
+    *type = IMAGE_TYPE_JPEG;
     return true;
   }
   return false;
 }
 
+/// reads only the first PROBE_HEADER_SIZE bytes of the entry, the whole entry
+/// is read only if the header cannot be probed from that. status and info are
+/// set to what the probe made of the returned contents
+static unsigned char *_read_zip_entry_header(const cli_flags_t *cli_flags,
+                                             zip_file_t        *zf,
+                                             const struct zip_stat *st,
+                                             size_t                *size,
+                                             probe_status_e        *status,
+                                             image_info_t          *info) {
+  size_t         probe_size = MIN(st->size, PROBE_HEADER_SIZE);
+  unsigned char *contents =
+      (unsigned char *)mallocv(*cli_flags, "contents", probe_size, -1);
+  if (!contents) {
+    return NULL;
+  }
+
+  zip_int64_t bytes_read = zip_fread(zf, contents, probe_size);
+  if (bytes_read < 0) {
+    freev(*cli_flags, contents, "contents", -1);
+    return NULL;
+  }
+  *size = (size_t)bytes_read;
+
+  *status = probe_image_header(contents, *size, info);
+  if (*status != PROBE_NEEDS_FULL_READ || *size == st->size) {
+    return contents;
+  }
+
+  printfv(*cli_flags, DARK_YELLOW,
+          "Header of %s could not be probed, reading the whole entry\n",
+          st->name);
+  unsigned char *full_contents =
+      (unsigned char *)mallocv(*cli_flags, "full_contents", st->size, -1);
+  if (!full_contents) {
+    return contents; // the fallback parsers will do what they can
+  }
+  memcpy(full_contents, contents, *size);
+  freev(*cli_flags, contents, "contents", -1);
+
+  bytes_read = zip_fread(zf, full_contents + *size, st->size - *size);
+  if (bytes_read > 0) {
+    *size += (size_t)bytes_read;
+  }
+  *status = probe_image_header(full_contents, *size, info);
+  return full_contents;
+}
+
+/// probes the start of an entry, page->type is left as IMAGE_TYPE_UNKNOWN if
+/// the entry is not an image
+static bool _probe_zip_entry(const cli_flags_t *cli_flags, zip_t *src_zip,
+                             const struct zip_stat *st,
+                             page_cache_page_t     *page) {
+  page->type = IMAGE_TYPE_UNKNOWN;
+  if (st->size == 0) {
+    return true; // an empty entry is not an image, nothing to allocate
+  }
+
+  zip_file_t *zf = zip_fopen_index(src_zip, page->index, 0);
+  if (!zf) {
+    return false; // Skip if cannot open file
+  }
+
+  size_t         contents_size = 0;
+  probe_status_e status;
+  image_info_t   info;
+  unsigned char *contents = _read_zip_entry_header(cli_flags, zf, st,
+                                                   &contents_size, &status,
+                                                   &info);
+  zip_fclose(zf);
+  if (!contents) {
+    printfv(*cli_flags, RED, "Failed to read %s\n", st->name);
+    return false;
+  }
+
+  // Use contents to get width and height
+  if (_get_width_height_and_type(cli_flags, status, &info, &page->width,
+                                 &page->height, &page->type, contents,
+                                 contents_size)) {
+    page->double_page = (page->width > page->height) ? DOUBLE_PAGE_TRUE
+                                                     : DOUBLE_PAGE_FALSE;
+  }
+  freev(*cli_flags, contents, "contents", -1);
+  return true;
+}
+
 static void _handle_cbz_entry(const cli_flags_t *cli_flags,
-                              const char *cbz_path, uint32_t *photo_counter,
-                              photo_t **photos, uint32_t *photos_arr_len) {
+                              page_cache_t *cache, const char *cbz_path,
+                              uint32_t *photo_counter, photo_t **photos,
+                              uint32_t *photos_arr_len) {
   // Open the zip file
   int    err;
   zip_t *dest = zip_open(cbz_path, 0, &err);
@@ -191,6 +287,9 @@ static void _handle_cbz_entry(const cli_flags_t *cli_flags,
     return;
   }
 
+  // unchanged archives only have their central directory read
+  page_cache_archive_t *cached = page_cache_archive(cli_flags, cache, cbz_path);
+
   // Get the number of entries in the zip file
   zip_int64_t num_entries = zip_get_num_entries(dest, 0);
 
@@ -200,583 +299,2826 @@ static void _handle_cbz_entry(const cli_flags_t *cli_flags,
     zip_stat_init(&st);
     zip_stat_index(dest, i, 0, &st);
 
-    // Extract file into memory
-    zip_file_t *zf = zip_fopen_index(dest, i, 0);
-    if (!zf) {
-      continue; // Skip if cannot open file
+    page_cache_page_t page = {.index = i, .crc = st.crc};
+    if (!page_cache_get(cache, cached, i, st.crc, &page)) {
+      if (!_probe_zip_entry(cli_flags, dest, &st, &page)) {
+        continue;
+      }
+      page_cache_put(cache, cached, &page);
     }
-
-    unsigned char *contents =
-        (unsigned char *)mallocv(*cli_flags, "contents", st.size, -1);
-    if (!contents) {
-      printfv(*cli_flags, RED, "Failed to allocate memory\n");
-      zip_fclose(zf);
+    if (page.type == IMAGE_TYPE_UNKNOWN) {
       continue;
     }
 
-    zip_fread(zf, contents, st.size);
-
-    // Use contents to get width and height
-    uint32_t width, height;
-    char    *ext = mallocv(*cli_flags, "ext", sizeof(char) * 5, -1);
-    strncpyv(*cli_flags, ext, "\0\0\0\0\0", 5, 5);
-    if (_get_width_height_and_type(cli_flags, &width, &height, &ext, contents,
-                                   &st)) {
-      // Check if we need to resize the photos array
-      if (*photo_counter >= *photos_arr_len) {
-        *photos_arr_len *= 2; // Double the size
-        *photos          = reallocv(*cli_flags, *photos, "photos",
-                                    *photos_arr_len * sizeof(photo_t), -1);
-        if (*photos == NULL) {
-          printfv(*cli_flags, RED, "Failed to reallocate memory\n");
-          freev(*cli_flags, contents, "contents", -1);
-          zip_fclose(zf);
-          break;
-        }
+    // Check if we need to resize the photos array
+    if (*photo_counter >= *photos_arr_len) {
+      *photos_arr_len *= 2; // Double the size
+      *photos          = reallocv(*cli_flags, *photos, "photos",
+                                  *photos_arr_len * sizeof(photo_t), -1);
+      if (*photos == NULL) {
+        printfv(*cli_flags, RED, "Failed to reallocate memory\n");
+        break;
       }
-
-      // Update the photos array
-      photo_t *photo  = &(*photos)[*photo_counter];
-      photo->cbz_path = strdup(cbz_path);
-      photo->name     = strdup(st.name);
-      photo->ext      = strdup(ext);
-      photo->width    = width;
-      photo->height   = height;
-      photo->id       = *photo_counter;
-      photo->double_page =
-          (width > height) ? DOUBLE_PAGE_TRUE : DOUBLE_PAGE_FALSE;
-
-      (*photo_counter)++;
     }
 
-    freev(*cli_flags, contents, "contents", -1);
-    freev(*cli_flags, ext, "ext", -1);
-    zip_fclose(zf);
+    // Update the photos array
+    photo_t *photo     = &(*photos)[*photo_counter];
+    photo->cbz_path    = strdup(cbz_path);
+    photo->name        = strdup(st.name);
+    photo->ext         = strdup(_image_type_ext(page.type));
+    photo->width       = page.width;
+    photo->height      = page.height;
+    photo->id          = *photo_counter;
+    photo->index       = i;
+    photo->double_page = page.double_page;
+
+    (*photo_counter)++;
   }
 
   zip_close(dest);
 }
 
-static bool _open_source_zip_archive(const cli_flags_t *cli_flags,
-                                     const char *cbz_path, zip_t **src_zip) {
-  *src_zip = zip_open(cbz_path, 0, NULL);
-  if (!(*src_zip)) {
-    printfv(*cli_flags, RED, "Failed to open %s\n", cbz_path);
-    return false;
+typedef struct {
+  photo_t *photos;
+  uint32_t count;
+  uint32_t len;
+} photo_list_t;
+
+typedef struct {
+  const cli_flags_t  *cli_flags;
+  const file_entry_t *sorted_files;
+  photo_list_t       *lists;
+  page_cache_t       *cache;
+} scan_ctx_t;
+
+/// every archive is scanned into its own list so workers never share state
+static void _scan_cbz_job(void *ctx, uint32_t index, uint32_t worker) {
+  scan_ctx_t   *scan = (scan_ctx_t *)ctx;
+  photo_list_t *list = &scan->lists[index];
+
+  list->count  = 0;
+  list->len    = 10; // Initial array size
+  list->photos = (photo_t *)mallocv(*scan->cli_flags, "list->photos",
+                                    list->len * sizeof(photo_t), -1);
+  if (list->photos == NULL) {
+    printfv(*scan->cli_flags, RED, "Failed to allocate memory for photos\n");
+    return;
   }
-  return true;
+  _handle_cbz_entry(scan->cli_flags, scan->cache,
+                    scan->sorted_files[index].filename, &list->count,
+                    &list->photos, &list->len);
 }
 
-static bool _get_photo_index_from_source_zip(const cli_flags_t *cli_flags,
-                                             zip_t *src_zip, const char *name,
-                                             zip_int64_t *idx) {
-  *idx = zip_name_locate(src_zip, name, 0);
-  if (*idx < 0) {
-    printfv(*cli_flags, RED, "Failed to find index for %s\n", name);
-    return false;
+/// scans every archive on cli_flags->jobs workers, the lists are merged in
+/// sorted_files order so the ids are the same as a serial scan
+static photo_t *_scan_cbz_files(const cli_flags_t  *cli_flags,
+                                page_cache_t       *cache,
+                                const file_entry_t *sorted_files,
+                                uint32_t file_count, uint32_t *photo_counter) {
+  photo_list_t *lists = (photo_list_t *)callocv(*cli_flags, "lists", file_count,
+                                                sizeof(photo_list_t), -1);
+  if (lists == NULL) {
+    return NULL;
   }
-  return true;
-}
-
-static void _split_png_buffer(const cli_flags_t *cli_flags, photo_t photo,
-                              uint8_t **buffer, uint64_t *buffer_size) {
-  /// TODO !!
-}
-
-static void _split_jpeg_buffer(const cli_flags_t *cli_flags, photo_t photo,
-                               uint8_t **buffer, uint64_t *buffer_size) {
-  struct jpeg_decompress_struct cinfo;
-  struct jpeg_error_mgr         jerr;
-
-  cinfo.err = jpeg_std_error(&jerr);
-  jpeg_create_decompress(&cinfo);
-
-  // Setup decompression for buffer
-  jpeg_mem_src(&cinfo, *buffer, *buffer_size);
-  jpeg_read_header(&cinfo, TRUE);
-  jpeg_start_decompress(&cinfo);
-
-  int width      = cinfo.output_width;
-  int height     = cinfo.output_height;
-  int row_stride = width * cinfo.output_components;
 
-  // Allocate memory for the raw image
-  unsigned char *raw_image =
-      (unsigned char *)malloc(width * height * cinfo.output_components);
+  scan_ctx_t scan = {.cli_flags    = cli_flags,
+                     .sorted_files = sorted_files,
+                     .lists        = lists,
+                     .cache        = cache};
+  run_parallel(cli_flags->jobs, file_count, _scan_cbz_job, &scan);
 
-  // Read scanlines
-  while (cinfo.output_scanline < cinfo.output_height) {
-    unsigned char *buffer_array[1];
-    buffer_array[0] = raw_image + (cinfo.output_scanline) * row_stride;
-    jpeg_read_scanlines(&cinfo, buffer_array, 1);
+  *photo_counter = 0;
+  for (uint32_t i = 0; i < file_count; i++) {
+    *photo_counter += lists[i].count;
   }
 
-  jpeg_finish_decompress(&cinfo);
-  jpeg_destroy_decompress(&cinfo);
-
-  // Calculate new dimensions based on double_page flag
-  int            new_width = width / 2;
-  unsigned char *cropped_image =
-      (unsigned char *)malloc(new_width * height * cinfo.output_components);
-
-  // Crop the image
-  for (int y = 0; y < height; y++) {
-    memcpy(cropped_image + y * new_width * cinfo.output_components,
-           raw_image + y * row_stride +
-               (photo.double_page == DOUBLE_PAGE_RIGHT
-                    ? new_width * cinfo.output_components
-                    : 0),
-           new_width * cinfo.output_components);
+  photo_t *photos = (photo_t *)mallocv(*cli_flags, "photos",
+                                       MAX(*photo_counter, 1) * sizeof(photo_t),
+                                       -1);
+  uint32_t id     = 0;
+  for (uint32_t i = 0; i < file_count; i++) {
+    for (uint32_t j = 0; photos && j < lists[i].count; j++) {
+      photos[id]    = lists[i].photos[j];
+      photos[id].id = id;
+      id++;
+    }
+    freev(*cli_flags, lists[i].photos, "lists[].photos", i);
   }
+  freev(*cli_flags, lists, "lists", -1);
+  return photos;
+}
 
-  // Free original raw image
-  free(raw_image);
-
-  // Re-encode the cropped image back into JPEG
-  struct jpeg_compress_struct cinfo_compress;
-  struct jpeg_error_mgr       jerr_compress;
-  unsigned long               new_buff_size = 0;
-  unsigned char              *new_buffer    = NULL;
+typedef struct {
+  const uint8_t *data;
+  uint64_t       size;
+  uint64_t       pos;
+} png_reader_t;
+
+typedef struct {
+  uint8_t *data;
+  uint64_t size;
+  uint64_t len;
+} png_buffer_t;
+
+/// everything libpng can longjmp out of lives on the heap
+typedef struct {
+  png_structp  read;
+  png_infop    read_info;
+  png_structp  write[2]; // left and right half
+  png_infop    write_info[2];
+  png_buffer_t out[2];
+  png_bytep    row;
+  png_bytep   *rows; // only for interlaced images
+  uint64_t    *sums;        // only for shrinking
+  uint8_t     *column_mins; // only for trimming
+} png_split_t;
+
+static void _png_read_fn(png_structp png, png_bytep out, size_t len) {
+  png_reader_t *reader = (png_reader_t *)png_get_io_ptr(png);
+  if (len > reader->size - reader->pos) {
+    png_error(png, "Read past the end of the png");
+  }
+  memcpy(out, reader->data + reader->pos, len);
+  reader->pos += len;
+}
 
-  cinfo_compress.err = jpeg_std_error(&jerr_compress);
-  jpeg_create_compress(&cinfo_compress);
-  jpeg_mem_dest(&cinfo_compress, &new_buffer, &new_buff_size);
+static void _png_write_fn(png_structp png, png_bytep in, size_t len) {
+  png_buffer_t *out = (png_buffer_t *)png_get_io_ptr(png);
+  if (out->size + len > out->len) {
+    uint64_t len_needed = MAX(out->len * 2, out->size + len);
+    uint8_t *data       = (uint8_t *)realloc(out->data, len_needed);
+    if (!data) {
+      png_error(png, "Failed to grow the png buffer");
+    }
+    out->data = data;
+    out->len  = len_needed;
+  }
+  memcpy(out->data + out->size, in, len);
+  out->size += len;
+}
 
-  cinfo_compress.image_width      = new_width;
-  cinfo_compress.image_height     = height;
-  cinfo_compress.input_components = cinfo.output_components;
-  cinfo_compress.in_color_space   = cinfo.out_color_space;
+static void _png_flush_fn(png_structp png) { (void)png; }
 
-  jpeg_set_defaults(&cinfo_compress);
-  jpeg_set_quality(&cinfo_compress, 100, TRUE);
-  jpeg_start_compress(&cinfo_compress, TRUE);
+static void _free_png_split(png_split_t *split) {
+  for (int h = 0; h < 2; h++) {
+    if (split->write[h]) {
+      png_destroy_write_struct(&split->write[h], &split->write_info[h]);
+    }
+    free(split->out[h].data);
+  }
+  png_destroy_read_struct(&split->read, &split->read_info, NULL);
+  free(split->row);
+  if (split->rows) {
+    free(split->rows[0]);
+  }
+  free(split->rows);
+  free(split->sums);
+  free(split->column_mins);
+  free(split);
+}
 
-  while (cinfo_compress.next_scanline < cinfo_compress.image_height) {
-    unsigned char *row_pointer[1];
-    row_pointer[0] = &cropped_image[cinfo_compress.next_scanline * new_width *
-                                    cinfo.output_components];
-    jpeg_write_scanlines(&cinfo_compress, row_pointer, 1);
+/// copies the chunks that change how the pixels look. Without same_pixels
+/// (the pixels were expanded or resampled) only the colour space is copied
+static void _copy_png_chunks(png_structp read, png_infop read_info,
+                             png_structp write, png_infop write_info,
+                             bool same_pixels) {
+  png_colorp palette;
+  int        num_palette;
+  if (same_pixels && png_get_PLTE(read, read_info, &palette, &num_palette)) {
+    png_set_PLTE(write, write_info, palette, num_palette);
+  }
+  png_bytep     trans;
+  int           num_trans;
+  png_color_16p trans_color;
+  if (same_pixels &&
+      png_get_tRNS(read, read_info, &trans, &num_trans, &trans_color)) {
+    png_set_tRNS(write, write_info, trans, num_trans, trans_color);
   }
+  png_fixed_point gamma;
+  if (png_get_gAMA_fixed(read, read_info, &gamma)) {
+    png_set_gAMA_fixed(write, write_info, gamma);
+  }
+  int intent;
+  if (png_get_sRGB(read, read_info, &intent)) {
+    png_set_sRGB(write, write_info, intent);
+  }
+  png_charp   name;
+  int         compression;
+  png_bytep   profile;
+  png_uint_32 profile_len;
+  if (png_get_iCCP(read, read_info, &name, &compression, &profile,
+                   &profile_len)) {
+    png_set_iCCP(write, write_info, name, compression, profile, profile_len);
+  }
+  png_uint_32 res_x, res_y;
+  int         unit;
+  if (same_pixels && png_get_pHYs(read, read_info, &res_x, &res_y, &unit)) {
+    png_set_pHYs(write, write_info, res_x, res_y, unit);
+  }
+}
 
-  jpeg_finish_compress(&cinfo_compress);
-  jpeg_destroy_compress(&cinfo_compress);
+/// shrinks every wanted box to the content inside it with a decode of its
+/// own. Only the scan sees the pixels expanded to 8 bit without alpha, so
+/// every kind of png can be looked at. Interlaced images are not trimmed
+static void _png_content_boxes(const cli_flags_t *cli_flags,
+                               const uint8_t *data, uint64_t size,
+                               uint32_t count, const bool wanted[],
+                               autocrop_box_t boxes[]) {
+  png_split_t *scan = (png_split_t *)calloc(1, sizeof(png_split_t));
+  if (!scan) {
+    return;
+  }
+  png_reader_t reader = {.data = data, .size = size, .pos = 0};
+  scan->read = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  scan->read_info = scan->read ? png_create_info_struct(scan->read) : NULL;
+  if (!scan->read_info) {
+    _free_png_split(scan);
+    return;
+  }
+  if (setjmp(png_jmpbuf(scan->read))) {
+    printfv(*cli_flags, DARK_YELLOW, "Failed to look for the borders\n");
+    _free_png_split(scan);
+    return;
+  }
 
-  // Replace old buffer with new buffer
-  freev(*cli_flags, *buffer, "buffer", -1);
-  *buffer      = new_buffer;
-  *buffer_size = new_buff_size;
+  png_set_read_fn(scan->read, &reader, _png_read_fn);
+  png_read_info(scan->read, scan->read_info);
+  if (png_get_interlace_type(scan->read, scan->read_info) !=
+      PNG_INTERLACE_NONE) {
+    _free_png_split(scan);
+    return;
+  }
+  png_set_expand(scan->read);
+  png_set_strip_16(scan->read);
+  png_set_strip_alpha(scan->read);
+  png_read_update_info(scan->read, scan->read_info);
+  png_uint_32 width    = png_get_image_width(scan->read, scan->read_info);
+  png_uint_32 height   = png_get_image_height(scan->read, scan->read_info);
+  png_byte    channels = png_get_channels(scan->read, scan->read_info);
+
+  // the boxes do not overlap, so they share one buffer of column mins
+  scan->row = (png_bytep)malloc(png_get_rowbytes(scan->read, scan->read_info));
+  scan->column_mins = (uint8_t *)malloc((size_t)width * channels);
+  if (!scan->row || !scan->column_mins) {
+    _free_png_split(scan);
+    return;
+  }
+  autocrop_scan_t scans[2];
+  for (uint32_t i = 0; i < count; i++) {
+    if (wanted[i]) {
+      autocrop_scan_init(&scans[i],
+                         scan->column_mins + (size_t)boxes[i].x * channels,
+                         boxes[i].width, channels);
+    }
+  }
 
-  // Free cropped image
-  free(cropped_image);
-}
+  for (png_uint_32 y = 0; y < height; y++) {
+    png_read_row(scan->read, scan->row, NULL);
+    for (uint32_t i = 0; i < count; i++) {
+      if (wanted[i] && y >= boxes[i].y && y < boxes[i].y + boxes[i].height) {
+        autocrop_scan_row(&scans[i],
+                          scan->row + (size_t)boxes[i].x * channels);
+      }
+    }
+  }
 
-static void _pdf_error_handler(HPDF_STATUS error_no, HPDF_STATUS detail_no,
-                               void *user_data) {
-  printf("ERROR: error_no=%04X, detail_no=%u\n", (unsigned int)error_no,
-         (unsigned int)detail_no);
-  exit(-99);
+  for (uint32_t i = 0; i < count; i++) {
+    autocrop_box_t found;
+    if (wanted[i] && autocrop_scan_box(&scans[i], AUTOCROP_MARGIN, &found)) {
+      boxes[i].x      += found.x;
+      boxes[i].y      += found.y;
+      boxes[i].width   = found.width;
+      boxes[i].height  = found.height;
+    }
+  }
+  _free_png_split(scan);
 }
 
-static bool _extact_image_from_source_to_buffer(
-    const cli_flags_t *cli_flags, zip_t *src_zip, const char *name,
-    zip_int64_t idx, photo_t photo, uint8_t **buffer, uint64_t *buffer_size,
-    char new_filename[PATH_MAX]) {
-  /* extract image from source to buffer */
-  zip_file_t *zfile = zip_fopen_index(src_zip, idx, 0);
-  if (!zfile) {
-    printfv(*cli_flags, RED,
-            "Error opening file %s within source zip archive\n", name);
+/// splits a png spread into its halves while it is decoded, every row is
+/// written to the halves as soon as it is read so only one row is held in
+/// memory. Interlaced images need every pass before a row is done, so those
+/// are read whole. count and wanted work like in _crop_jpeg_lossless
+static bool _split_png_rows(const cli_flags_t *cli_flags, const uint8_t *data,
+                            uint64_t size, uint32_t count, const bool wanted[],
+                            uint8_t *halves[], uint64_t sizes[]) {
+  png_split_t *split = (png_split_t *)calloc(1, sizeof(png_split_t));
+  if (!split) {
     return false;
   }
-
-  zip_stat_t zstat;
-  zip_stat_index(src_zip, idx, 0, &zstat);
-  *buffer = (uint8_t *)mallocv(*cli_flags, "buffer", zstat.size, -1);
-  if (!buffer) {
-    zip_fclose(zfile);
+  png_reader_t reader = {.data = data, .size = size, .pos = 0};
+  split->read =
+      png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  split->read_info = split->read ? png_create_info_struct(split->read) : NULL;
+  if (!split->read_info) {
+    _free_png_split(split);
     return false;
   }
-
-  zip_int64_t bytes_read = zip_fread(zfile, *buffer, zstat.size);
-  if (bytes_read < 0) {
-    printfv(*cli_flags, RED, "Failed to read %s within source zip archive\n ",
-            name);
-    zip_fclose(zfile);
-    freev(*cli_flags, *buffer, "buffer", -1);
+  if (setjmp(png_jmpbuf(split->read))) {
+    printfv(*cli_flags, RED, "Failed to decode the png\n");
+    _free_png_split(split);
     return false;
   }
-  zip_fclose(zfile);
 
-  /* create newfilename */
-  snprintf(new_filename, PATH_MAX, "%05u%s", photo.id, photo.ext);
+  png_set_read_fn(split->read, &reader, _png_read_fn);
+  png_read_info(split->read, split->read_info);
+  png_uint_32 width, height;
+  int         bit_depth, color_type, interlace;
+  png_get_IHDR(split->read, split->read_info, &width, &height, &bit_depth,
+               &color_type, &interlace, NULL, NULL);
+  if (bit_depth < 8) {
+    png_set_packing(split->read); // one byte per pixel so rows can be cut
+  }
+  int passes = png_set_interlace_handling(split->read);
+  png_read_update_info(split->read, split->read_info);
+  size_t row_bytes   = png_get_rowbytes(split->read, split->read_info);
+  size_t pixel_bytes = row_bytes / width;
+
+  autocrop_box_t boxes[2] = {{0, 0, width, height}, {0, 0, 0, 0}};
+  if (count == 2) {
+    boxes[0].width = width / 2;
+    boxes[1]       = (autocrop_box_t){width / 2, 0, width - width / 2, height};
+  }
+  if (cli_flags->autocrop_mode == AUTOCROP_ENABLED) {
+    _png_content_boxes(cli_flags, data, size, count, wanted, boxes);
+  }
+  if (count == 1 && !autocrop_is_worth(&boxes[0], width, height)) {
+    _free_png_split(split);
+    return false;
+  }
 
-  *buffer_size = zstat.size;
-  /* Handle double page */
-  if (photo.double_page != DOUBLE_PAGE_FALSE) {
-    // split the file [X|X] [X|_] or [_|X]
-    if (strncmp(photo.ext, ".jpg", 4) == 0) {
-      _split_jpeg_buffer(cli_flags, photo, buffer, buffer_size);
-    } else if (strncmp(photo.ext, ".png", 4) == 0) {
-      _split_png_buffer(cli_flags, photo, buffer, buffer_size);
-    } else {
-      printfv(*cli_flags, RED, "Error: Unsupported file type\n");
+  for (uint32_t h = 0; h < count; h++) {
+    if (!wanted[h]) {
+      continue;
+    }
+    split->write[h] =
+        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    split->write_info[h] =
+        split->write[h] ? png_create_info_struct(split->write[h]) : NULL;
+    if (!split->write_info[h]) {
+      _free_png_split(split);
+      return false;
+    }
+    if (setjmp(png_jmpbuf(split->write[h]))) {
+      printfv(*cli_flags, RED, "Failed to encode the png\n");
+      _free_png_split(split);
       return false;
     }
+    png_set_write_fn(split->write[h], &split->out[h], _png_write_fn,
+                     _png_flush_fn);
+    png_set_IHDR(split->write[h], split->write_info[h], boxes[h].width,
+                 boxes[h].height, bit_depth, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    _copy_png_chunks(split->read, split->read_info, split->write[h],
+                     split->write_info[h], true);
+    png_write_info(split->write[h], split->write_info[h]);
+    if (bit_depth < 8) {
+      png_set_packing(split->write[h]);
+    }
   }
-  return true;
-}
-void _draw_pdf_png_image(HPDF_Doc pdf, HPDF_Page page,
-                         const unsigned char *buffer, unsigned int buffer_size,
-                         float x_position, float available_width,
-                         float available_height, float border) {
-  /// TODO !!
-}
-
-void _draw_pdf_jpeg_image(HPDF_Doc pdf, HPDF_Page page,
-                          const unsigned char *buffer, unsigned int buffer_size,
-                          float x_position, float available_width,
-                          float available_height, float border) {
-  HPDF_Image image = HPDF_LoadJpegImageFromMem(pdf, buffer, buffer_size);
-  if (image) {
-    float img_width  = HPDF_Image_GetWidth(image);
-    float img_height = HPDF_Image_GetHeight(image);
-    float scale =
-        fmin(available_height / img_height, available_width / img_width);
-    img_width  *= scale;
-    img_height *= scale;
 
-    // Draw the image centered within the available space
-    float x_offset = (available_width - img_width) / 2;
-    float y_offset = (available_height - img_height) / 2;
-    HPDF_Page_DrawImage(page, image, x_position + x_offset, border + y_offset,
-                        img_width, img_height);
+  if (passes > 1) {
+    split->rows = (png_bytep *)calloc(height, sizeof(png_bytep));
+    if (split->rows) {
+      split->rows[0] = (png_bytep)malloc(row_bytes * height);
+    }
+    if (!split->rows || !split->rows[0]) {
+      _free_png_split(split);
+      return false;
+    }
+    for (png_uint_32 y = 1; y < height; y++) {
+      split->rows[y] = split->rows[0] + y * row_bytes;
+    }
+    png_read_image(split->read, split->rows);
+  } else {
+    split->row = (png_bytep)malloc(row_bytes);
+    if (!split->row) {
+      _free_png_split(split);
+      return false;
+    }
   }
-}
-
-static void _draw_pdf_dashed_line(HPDF_Page page, float page_width,
-                                  float page_height, float border) {
-  // Set the line style to dashed
-  HPDF_UINT16 dash_pattern[] = {3, 3}; // Pattern: 3 units on, 3 units off
-  HPDF_Page_SetDash(page, dash_pattern, 2,
-                    0); // Set the dash pattern for the line
-
-  // Set the line width
-  HPDF_Page_SetLineWidth(page, 1); // Set the line width to 1 unit
 
-  // Calculate the vertical center of the page
-  float y = border; // Starting Y coordinate of the dashed line
-  float line_height =
-      page_height - (2 * border); // Ending Y coordinate of the dashed line
-
-  // Calculate the horizontal position for the dashed line, which is in the
-  // middle of the page
-  float x = page_width / 2;
-
-  // Draw the dashed line from the top to the bottom at the middle of the page
-  HPDF_Page_MoveTo(page, x, y); // Move to the starting point of the dashed line
-  HPDF_Page_LineTo(page, x,
-                   y + line_height); // Draw the line to the ending point
-
-  // Stroke the path to actually draw the line on the page
-  HPDF_Page_Stroke(page);
-}
-
-static bool _handle_pdf_buffer(const cli_flags_t *cli_flags, zip_t *src_zip1,
-                               zip_t *src_zip2, HPDF_Doc *pdf, zip_int64_t idx1,
-                               zip_int64_t idx2, photo_t *photo1,
-                               photo_t *photo2) {
-  uint8_t *buffer1 = NULL, *buffer2 = NULL;
-  uint64_t buffer_size1 = 0, buffer_size2 = 0;
-  char     new_filename1[PATH_MAX], new_filename2[PATH_MAX];
-
-  if (photo1) {
-    _extact_image_from_source_to_buffer(cli_flags, src_zip1, photo1->name, idx1,
-                                        *photo1, &buffer1, &buffer_size1,
-                                        new_filename1);
-  }
-  if (photo2) {
-    _extact_image_from_source_to_buffer(cli_flags, src_zip2, photo2->name, idx2,
-                                        *photo2, &buffer2, &buffer_size2,
-                                        new_filename2);
-  }
-
-  /// ADD TO PDF
-  HPDF_Page page = HPDF_AddPage(*pdf);
-  HPDF_Page_SetSize(page, HPDF_PAGE_SIZE_A4, HPDF_PAGE_LANDSCAPE);
-  float page_width       = HPDF_Page_GetWidth(page);
-  float page_height      = HPDF_Page_GetHeight(page);
-  // float available_height = page_height - (2 * border);
-  float border           = 10; // fixed size
-  float available_width  = (page_width / 2) - (2 * border);
-  float available_height = page_height - (2 * border);
-
-  // Only now does it matter if its jpeg or png
-  if (photo1) {
-    if (strncmp(photo1->ext, ".jpg", 4) == 0) {
-      _draw_pdf_jpeg_image(*pdf, page, buffer1, buffer_size1, border,
-                           available_width, available_height, border);
-    } else if (strncmp(photo1->ext, ".png", 4) == 0) {
-      _draw_pdf_png_image(*pdf, page, buffer1, buffer_size1, border,
-                          available_width, available_height, border);
+  for (png_uint_32 y = 0; y < height; y++) {
+    png_bytep row = split->row;
+    if (passes > 1) {
+      row = split->rows[y];
     } else {
-      printfv(*cli_flags, RED, "Error: Unsupported file type\n");
-      return false;
+      png_read_row(split->read, row, NULL);
+    }
+    for (uint32_t h = 0; h < count; h++) {
+      if (wanted[h] && y >= boxes[h].y && y < boxes[h].y + boxes[h].height) {
+        png_write_row(split->write[h], row + boxes[h].x * pixel_bytes);
+      }
     }
   }
 
-  if (photo2) {
-    if (strncmp(photo2->ext, ".jpg", 4) == 0) {
-      _draw_pdf_jpeg_image(*pdf, page, buffer2, buffer_size2,
-                           (page_width / 2) + border, available_width,
-                           available_height, border);
-    } else if (strncmp(photo2->ext, ".png", 4) == 0) {
-      _draw_pdf_png_image(*pdf, page, buffer2, buffer_size2,
-                          (page_width / 2) + border, available_width,
-                          available_height, border);
-    } else {
-      printfv(*cli_flags, RED, "Error: Unsupported file type\n");
-      return false;
+  for (uint32_t h = 0; h < count; h++) {
+    if (wanted[h]) {
+      png_write_end(split->write[h], NULL);
+      halves[h]          = split->out[h].data;
+      sizes[h]           = split->out[h].size;
+      split->out[h].data = NULL;
     }
   }
+  _free_png_split(split);
+  return true;
+}
 
-  _draw_pdf_dashed_line(page, page_width, page_height, border);
+/// libjpeg calls exit on errors by default, this jumps back instead so a
+/// failed lossless crop can fall back to decoding the image
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf               jump;
+} jpeg_error_t;
 
-  return true;
+static void _jpeg_error_exit(j_common_ptr cinfo) {
+  jpeg_error_t *err = (jpeg_error_t *)cinfo->err;
+  longjmp(err->jump, 1);
 }
 
-static bool _handle_zip_buffer(const cli_flags_t *cli_flags, zip_t *src_zip,
-                               zip_t **dest_zip, const char *name,
-                               zip_int64_t idx, photo_t photo) {
-  // NOTE: Since the image is in the buffer the filetype doesnt matter
-  // JPEG and PNG are treated the same (it matters for pdf though)
-  uint8_t *buffer;
-  uint64_t buffer_size;
-  char     new_filename[PATH_MAX];
-  _extact_image_from_source_to_buffer(cli_flags, src_zip, name, idx, photo,
-                                      &buffer, &buffer_size, new_filename);
-  /// ADD TO ZIP
-  /* create new source from buffer */
-  zip_source_t *zip_source = zip_source_buffer(*dest_zip, buffer, buffer_size,
-                                               1); // let libzip take ownership
-  if (!zip_source) {
-    // manually free buffer if zip_source creation fails
-    freev(*cli_flags, buffer, "buffer", -1);
-    return false;
+/// libjpeg's memory destination frees its buffer when it grows without
+/// telling the caller, so a compress that jumps out could not free it. This
+/// one keeps the buffer where the error path can see it
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  uint8_t                    *data;
+  uint64_t                    len;  // allocated size of data
+  uint64_t                    size; // bytes written, set when it is done
+} jpeg_dest_t;
+
+static void _jpeg_dest_init(j_compress_ptr cinfo) {
+  jpeg_dest_t *dest = (jpeg_dest_t *)cinfo->dest;
+  dest->len         = JPEG_DEST_CHUNK;
+  dest->data        = (uint8_t *)malloc(dest->len);
+  if (!dest->data) {
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
   }
+  dest->pub.next_output_byte = dest->data;
+  dest->pub.free_in_buffer   = dest->len;
+}
 
-  /* add image to dest zip */
-  if (zip_file_add(*dest_zip, new_filename, zip_source, ZIP_FL_OVERWRITE) < 0) {
-    // this will also free the buffer since the zip_source owns it now
-    zip_source_free(zip_source);
-    return false;
+static boolean _jpeg_dest_grow(j_compress_ptr cinfo) {
+  jpeg_dest_t *dest = (jpeg_dest_t *)cinfo->dest;
+  uint8_t     *data = (uint8_t *)realloc(dest->data, dest->len * 2);
+  if (!data) {
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
   }
+  dest->data                 = data;
+  dest->pub.next_output_byte = data + dest->len;
+  dest->pub.free_in_buffer   = dest->len;
+  dest->len *= 2;
+  return TRUE;
+}
 
-  // no need to free the buffer here, as it's now managed by libzip
-  return true;
+static void _jpeg_dest_term(j_compress_ptr cinfo) {
+  jpeg_dest_t *dest = (jpeg_dest_t *)cinfo->dest;
+  dest->size        = dest->len - dest->pub.free_in_buffer;
 }
 
-static void _make_output_cbz(const cli_flags_t *cli_flags, photo_t *photos,
-                             uint32_t photo_count, const char *output_file) {
-  zip_t *dest_zip = zip_open(output_file, ZIP_CREATE | ZIP_TRUNCATE, NULL);
-  if (!dest_zip) {
-    printfv(*cli_flags, RED, "Failed to open destination zip file: %s\n",
-            zip_strerror(dest_zip));
-    return;
-  }
+static void _jpeg_dest(j_compress_ptr cinfo, jpeg_dest_t *dest) {
+  memset(dest, 0, sizeof(*dest));
+  dest->pub.init_destination    = _jpeg_dest_init;
+  dest->pub.empty_output_buffer = _jpeg_dest_grow;
+  dest->pub.term_destination    = _jpeg_dest_term;
+  cinfo->dest                   = &dest->pub;
+}
 
-  for (uint32_t i = 0; i < photo_count; i++) {
-    if (photos[i].ext[0] == '\0') {
-      printfv(*cli_flags, RED, "File has unknown type: %s\n", photos[i].name);
+/// size of a component in blocks, rounded up to a whole iMCU like libjpeg
+/// does for its own coefficient arrays
+static JDIMENSION _blocks_per_imcu_row(JDIMENSION pixels, int samp_factor,
+                                       int max_samp_factor) {
+  JDIMENSION blocks =
+      (pixels * samp_factor + max_samp_factor * DCTSIZE - 1) /
+      (max_samp_factor * DCTSIZE);
+  return (blocks + samp_factor - 1) / samp_factor * samp_factor;
+}
+
+/// copies the APPn and COM markers of the source, except the JFIF and Adobe
+/// ones that libjpeg writes by itself
+static void _copy_jpeg_markers(struct jpeg_decompress_struct *src,
+                               struct jpeg_compress_struct   *dst) {
+  for (jpeg_saved_marker_ptr marker = src->marker_list; marker;
+       marker = marker->next) {
+    if (dst->write_JFIF_header && marker->marker == JPEG_APP0 &&
+        marker->data_length >= 5 && memcmp(marker->data, "JFIF", 5) == 0) {
       continue;
     }
-    zip_t *src_zip = NULL;
-    if (!_open_source_zip_archive(cli_flags, photos[i].cbz_path, &src_zip)) {
+    if (dst->write_Adobe_marker && marker->marker == JPEG_APP0 + 14 &&
+        marker->data_length >= 5 && memcmp(marker->data, "Adobe", 5) == 0) {
       continue;
     }
-
-    zip_int64_t idx;
-    if (!_get_photo_index_from_source_zip(cli_flags, src_zip, photos[i].name,
-                                          &idx)) {
-      zip_close(src_zip);
+    // a colour profile does not describe a page that was made gray
+    if (dst->jpeg_color_space == JCS_GRAYSCALE &&
+        src->jpeg_color_space != JCS_GRAYSCALE &&
+        marker->marker == JPEG_APP0 + 2 && marker->data_length >= 12 &&
+        memcmp(marker->data, "ICC_PROFILE", 12) == 0) {
       continue;
     }
+    jpeg_write_marker(dst, marker->marker, marker->data, marker->data_length);
+  }
+}
 
-    if (!_handle_zip_buffer(cli_flags, src_zip, &dest_zip, photos[i].name, idx,
-                            photos[i])) {
-      zip_close(src_zip);
-      continue;
+/// crops parts out of a jpeg without decoding it, the DCT blocks are copied
+/// as they are. With a count of 2 the parts are the halves of a spread, the
+/// cut has to be on an iMCU boundary so it is moved to the one closest to the
+/// middle (at most 8 or 16 pixels off). A count of 1 keeps the page whole and
+/// is only for trimming its borders, it fails if there is nothing worth
+/// trimming. With --autocrop every part is trimmed to its content. The
+/// coefficients are read once for every part that is wanted
+static bool _crop_jpeg_lossless(const cli_flags_t *cli_flags, photo_t photo,
+                                const uint8_t *buffer, uint64_t buffer_size,
+                                uint32_t count, const bool wanted[],
+                                uint8_t *halves[], uint64_t sizes[]) {
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct   dst[2];
+  jpeg_error_t                  err;
+  jpeg_dest_t                   dests[2] = {0};
+
+  // every struct shares the error manager so one jump covers them
+  src.err            = jpeg_std_error(&err.pub);
+  dst[0].err         = &err.pub;
+  dst[1].err         = &err.pub;
+  err.pub.error_exit = _jpeg_error_exit;
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst[0]);
+  jpeg_create_compress(&dst[1]);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&dst[0]);
+    jpeg_destroy_compress(&dst[1]);
+    jpeg_destroy_decompress(&src);
+    free(dests[0].data);
+    free(dests[1].data);
+    return false;
+  }
+
+  jpeg_mem_src(&src, buffer, buffer_size);
+  jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+  for (int m = 0; m < 16; m++) {
+    jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+  }
+  jpeg_read_header(&src, TRUE);
+
+  JDIMENSION     width    = src.image_width;
+  JDIMENSION     height   = src.image_height;
+  autocrop_box_t boxes[2] = {{0, 0, width, height}, {0, 0, 0, 0}};
+  JDIMENSION     cut      = 0;
+  if (count == 2) {
+    JDIMENSION imcu_size = src.max_h_samp_factor * DCTSIZE;
+    cut = (width / 2 + imcu_size / 2) / imcu_size * imcu_size;
+    // too narrow for the closest boundary to be anywhere near the middle
+    if (cut == 0 || cut >= width ||
+        (cut > width / 2 ? cut - width / 2 : width / 2 - cut) > width / 8) {
+      jpeg_destroy_compress(&dst[0]);
+      jpeg_destroy_compress(&dst[1]);
+      jpeg_destroy_decompress(&src);
+      return false;
     }
-    zip_close(src_zip);
+    boxes[0].width = cut;
+    boxes[1]       = (autocrop_box_t){cut, 0, width - cut, height};
+  }
+  if (cli_flags->autocrop_mode == AUTOCROP_ENABLED &&
+      !autocrop_jpeg_boxes(buffer, buffer_size, count, wanted, boxes)) {
+    printfv(*cli_flags, DARK_YELLOW, "Failed to look for the borders\n");
+  }
+  if (count == 1 && !autocrop_is_worth(&boxes[0], width, height)) {
+    jpeg_destroy_compress(&dst[0]);
+    jpeg_destroy_compress(&dst[1]);
+    jpeg_destroy_decompress(&src);
+    return false;
   }
-  zip_close(dest_zip);
-}
 
-static photo_t _deep_copy_photo(const photo_t *src) {
-  photo_t copy;
-  copy.cbz_path    = strdup(src->cbz_path);
-  copy.name        = strdup(src->name);
-  copy.ext         = strdup(src->ext);
-  copy.width       = src->width;
-  copy.height      = src->height;
-  copy.id          = src->id;
-  copy.double_page = src->double_page;
-  return copy;
-}
+  // the arrays have to be requested before jpeg_read_coefficients realizes
+  // every virtual array
+  jvirt_barray_ptr dst_coef[2][MAX_COMPONENTS];
+  for (uint32_t h = 0; h < count; h++) {
+    for (int ci = 0; wanted[h] && ci < src.num_components; ci++) {
+      jpeg_component_info *comp = &src.comp_info[ci];
+      dst_coef[h][ci]           = src.mem->request_virt_barray(
+          (j_common_ptr)&src, JPOOL_IMAGE, FALSE,
+          _blocks_per_imcu_row(boxes[h].width, comp->h_samp_factor,
+                               src.max_h_samp_factor),
+          _blocks_per_imcu_row(boxes[h].height, comp->v_samp_factor,
+                               src.max_v_samp_factor),
+          comp->v_samp_factor);
+    }
+  }
+  jvirt_barray_ptr *src_coef = jpeg_read_coefficients(&src);
+
+  for (int ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info *comp          = &src.comp_info[ci];
+    JDIMENSION           height_blocks = _blocks_per_imcu_row(
+        src.image_height, comp->v_samp_factor, src.max_v_samp_factor);
+
+    for (JDIMENSION y = 0; y < height_blocks; y += comp->v_samp_factor) {
+      JBLOCKARRAY src_rows = src.mem->access_virt_barray(
+          (j_common_ptr)&src, src_coef[ci], y, comp->v_samp_factor, FALSE);
+      for (uint32_t h = 0; h < count; h++) {
+        if (!wanted[h]) {
+          continue;
+        }
+        JDIMENSION y_blocks = boxes[h].y * comp->v_samp_factor /
+                              (src.max_v_samp_factor * DCTSIZE);
+        JDIMENSION box_height_blocks = _blocks_per_imcu_row(
+            boxes[h].height, comp->v_samp_factor, src.max_v_samp_factor);
+        if (y < y_blocks || y >= y_blocks + box_height_blocks) {
+          continue;
+        }
+        JDIMENSION x_blocks = boxes[h].x * comp->h_samp_factor /
+                              (src.max_h_samp_factor * DCTSIZE);
+        JDIMENSION width_blocks = _blocks_per_imcu_row(
+            boxes[h].width, comp->h_samp_factor, src.max_h_samp_factor);
+        JBLOCKARRAY dst_rows = src.mem->access_virt_barray(
+            (j_common_ptr)&src, dst_coef[h][ci], y - y_blocks,
+            comp->v_samp_factor, TRUE);
+        for (int row = 0; row < comp->v_samp_factor; row++) {
+          memcpy(dst_rows[row], src_rows[row] + x_blocks,
+                 width_blocks * sizeof(JBLOCK));
+        }
+      }
+    }
+  }
 
-static void _reorder_double_page_photos(const cli_flags_t *cli_flags,
-                                        photo_t          **photos,
-                                        uint32_t          *photo_counter) {
-  for (uint32_t i = 0; i < *photo_counter; i++) {
-    if ((*photos)[i].double_page == DOUBLE_PAGE_FALSE) {
+  for (uint32_t h = 0; h < count; h++) {
+    if (!wanted[h]) {
       continue;
     }
-    if ((*photos)[i].double_page == DOUBLE_PAGE_TRUE) {
-      *photos = realloc(*photos, sizeof(photo_t) * (*photo_counter + 1));
-      for (uint32_t j = *photo_counter; j > i + 1; j--) {
-        (*photos)[j] = (*photos)[j - 1]; // shift photos down by one
-        (*photos)[j].id++;
-      }
-      (*photos)[i + 1]              = _deep_copy_photo(&(*photos)[i]);
-      (*photos)[i + 1].id          += 1;
-      (*photos)[i + 1].double_page  = DOUBLE_PAGE_RIGHT;
-      (*photos)[i].double_page      = DOUBLE_PAGE_LEFT;
-      (*photo_counter)++;
-      i++; // skip the new photo to avoid reprocessing
+    jpeg_copy_critical_parameters(&src, &dst[h]);
+    dst[h].optimize_coding = cli_flags->baseline_mode == BASELINE_OPTIMIZED;
+    dst[h].image_width     = boxes[h].width;
+    dst[h].image_height    = boxes[h].height;
+    _jpeg_dest(&dst[h], &dests[h]);
+    jpeg_write_coefficients(&dst[h], dst_coef[h]);
+    _copy_jpeg_markers(&src, &dst[h]);
+    jpeg_finish_compress(&dst[h]);
+  }
+  jpeg_destroy_compress(&dst[0]);
+  jpeg_destroy_compress(&dst[1]);
+  jpeg_finish_decompress(&src);
+  jpeg_destroy_decompress(&src);
+
+  if (count == 2) {
+    printfv(*cli_flags, DARK_GREEN, "Cropped %s losslessly at x=%u\n",
+            photo.name, cut);
+  }
+  for (uint32_t h = 0; h < count; h++) {
+    if (wanted[h] && cli_flags->autocrop_mode == AUTOCROP_ENABLED) {
+      printfv(*cli_flags, DARK_GREEN, "Trimmed %s to %ux%u at %u,%u\n",
+              photo.name, boxes[h].width, boxes[h].height, boxes[h].x,
+              boxes[h].y);
     }
+    halves[h] = dests[h].data;
+    sizes[h]  = dests[h].size;
   }
+  return true;
 }
 
-static bool _str_ends_with(const char *str, const char *suffix) {
-  if (!str || !suffix) {
+/// rewrites a progressive jpeg as a baseline one without decoding it, the DCT
+/// coefficients are copied as they are so nothing is lost. Readers decode a
+/// baseline jpeg in one pass instead of one per scan
+static bool _jpeg_to_baseline(const cli_flags_t *cli_flags,
+                              const uint8_t *buffer, uint64_t buffer_size,
+                              uint8_t **baseline, uint64_t *baseline_size) {
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct   dst;
+  jpeg_error_t                  err;
+  jpeg_dest_t                   dest = {0};
+
+  src.err            = jpeg_std_error(&err.pub);
+  dst.err            = &err.pub;
+  err.pub.error_exit = _jpeg_error_exit;
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    free(dest.data);
     return false;
   }
 
-  size_t str_len    = strlen(str);
-  size_t suffix_len = strlen(suffix);
-
-  if (suffix_len > str_len) {
-    return false;
+  jpeg_mem_src(&src, buffer, buffer_size);
+  jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+  for (int m = 0; m < 16; m++) {
+    jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
   }
+  jpeg_read_header(&src, TRUE);
+  jvirt_barray_ptr *coef = jpeg_read_coefficients(&src);
+
+  // without a scan script the output is sequential
+  jpeg_copy_critical_parameters(&src, &dst);
+  dst.optimize_coding = cli_flags->baseline_mode == BASELINE_OPTIMIZED;
+  _jpeg_dest(&dst, &dest);
+  jpeg_write_coefficients(&dst, coef);
+  _copy_jpeg_markers(&src, &dst);
+  jpeg_finish_compress(&dst);
+  jpeg_destroy_compress(&dst);
+  jpeg_finish_decompress(&src);
+  jpeg_destroy_decompress(&src);
+
+  *baseline      = dest.data;
+  *baseline_size = dest.size;
+  return true;
+}
 
-  const char *start_pos = str + str_len - suffix_len;
-
-  return strcmp(start_pos, suffix) == 0;
+/// how a re-encode went, a page that was tried as gray but turned out to have
+/// colour has to be encoded again with every channel
+typedef enum {
+  REENCODE_FAILED,
+  REENCODE_DONE,
+  REENCODE_NOT_GRAY,
+} reencode_result_e;
+
+/// only a 3 channel YCbCr jpeg can look gray without being stored as gray
+static bool _can_be_gray(const struct jpeg_decompress_struct *src) {
+  return src->jpeg_color_space == JCS_YCbCr && src->num_components == 3 &&
+         src->out_color_space == JCS_RGB;
 }
 
-static void _make_output_pdf(const cli_flags_t *cli_flags, photo_t *photos,
-                             uint32_t photos_count, const char *output_file) {
-  /* INIT */
-  HPDF_Doc pdf = HPDF_New(_pdf_error_handler, NULL);
-  if (!pdf) {
-    printfv(*cli_flags, "RED", "Failed to open destination pdf file\n");
-    return;
+/// turns a batch of decoded rgb rows into one channel, false if any pixel has
+/// channels more than GRAY_TOLERANCE apart
+static bool _rgb_batch_to_gray(JSAMPARRAY rgb, JSAMPARRAY gray,
+                               JDIMENSION rows, JDIMENSION width) {
+  const pixel_kernels_t *kernels = pixel_kernels();
+  for (JDIMENSION row = 0; row < rows; row++) {
+    if (!kernels->rgb_to_gray(rgb[row], gray[row], width, GRAY_TOLERANCE)) {
+      return false;
+    }
   }
+  return true;
+}
 
-  /* REORDER */
-  uint32_t  output_human_len = 0;
-  photo_t **output_human     = (photo_t **)mallocv(
-      *cli_flags, "output_human", sizeof(photo_t) * photos_count, -1);
-
-  REORDER_TO_HUMAN_READABLE(photos, output_human, output_human_len,
-                            photos_count);
-  photo_t **output = (photo_t **)mallocv(
-      *cli_flags, "output", sizeof(photo_t) * output_human_len, -1);
-  REORDER_HUMAN_TO_OUTPUT(output_human, output_human_len, output);
+/// decodes the spread a few rows at a time and hands every batch straight to
+/// the encoder of each wanted half, so no frame buffer is ever allocated.
+/// When only one half is wanted the decoder skips the other half's columns
+/// with jpeg_crop_scanline. With try_gray the halves are encoded with one
+/// channel until a row with colour shows up
+static reencode_result_e _split_jpeg_reencode_pass(
+    const cli_flags_t *cli_flags, const uint8_t *buffer, uint64_t buffer_size,
+    const bool wanted[2], uint8_t *halves[2], uint64_t sizes[2],
+    bool try_gray) {
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_compress_struct   cinfo_compress[2];
+  jpeg_error_t                  err;
+  jpeg_dest_t                   dests[2] = {0};
+
+  cinfo.err             = jpeg_std_error(&err.pub);
+  cinfo_compress[0].err = &err.pub;
+  cinfo_compress[1].err = &err.pub;
+  err.pub.error_exit    = _jpeg_error_exit;
+  jpeg_create_decompress(&cinfo);
+  jpeg_create_compress(&cinfo_compress[0]);
+  jpeg_create_compress(&cinfo_compress[1]);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo_compress[0]);
+    jpeg_destroy_compress(&cinfo_compress[1]);
+    jpeg_destroy_decompress(&cinfo);
+    free(dests[0].data);
+    free(dests[1].data);
+    return REENCODE_FAILED;
+  }
 
-  /* WRITE IMAGES */
-  for (uint32_t i = 0, j = 1; j < output_human_len;) {
-    photo_t *photo1 = output[i];
-    photo_t *photo2 = output[j];
+  // Setup decompression for buffer
+  jpeg_mem_src(&cinfo, buffer, buffer_size);
+  jpeg_read_header(&cinfo, TRUE);
+  bool gray = try_gray && _can_be_gray(&cinfo);
+  jpeg_start_decompress(&cinfo);
 
-    zip_t      *src_zip1 = NULL, *src_zip2 = NULL;
-    zip_int64_t idx1 = -1, idx2 = -1;
+  JDIMENSION width      = cinfo.output_width;
+  JDIMENSION offsets[2] = {0, width / 2};
+  JDIMENSION widths[2]  = {width / 2, width - width / 2};
+
+  // the crop starts on an iMCU boundary, so crop_x can end up left of the
+  // half and the rows are still cut at the half's own offset
+  JDIMENSION crop_x     = 0;
+  JDIMENSION crop_width = width;
+  if (wanted[0] != wanted[1]) {
+    int h      = wanted[1];
+    crop_x     = offsets[h];
+    crop_width = widths[h];
+    jpeg_crop_scanline(&cinfo, &crop_x, &crop_width);
+  }
 
-    i += 2;
-    j += 2;
+  // the batches live in the decoder's pool, so they are freed on errors too
+  JDIMENSION batch_height = cinfo.rec_outbuf_height;
+  JSAMPARRAY batch        = (*cinfo.mem->alloc_sarray)(
+      (j_common_ptr)&cinfo, JPOOL_IMAGE,
+      cinfo.output_width * cinfo.output_components, batch_height);
+  JSAMPARRAY gray_batch =
+      gray ? (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                        cinfo.output_width, batch_height)
+           : NULL;
+  int      components = gray ? 1 : cinfo.output_components;
+  JSAMPROW rows[MAX_SAMP_FACTOR * DCTSIZE];
+
+  for (int h = 0; h < 2; h++) {
+    if (!wanted[h]) {
+      continue;
+    }
+    struct jpeg_compress_struct *out = &cinfo_compress[h];
+    _jpeg_dest(out, &dests[h]);
+
+    out->image_width      = widths[h];
+    out->image_height     = cinfo.output_height;
+    out->input_components = components;
+    out->in_color_space   = gray ? JCS_GRAYSCALE : cinfo.out_color_space;
+
+    jpeg_set_defaults(out);
+    jpeg_set_quality(out, 100, TRUE);
+    out->optimize_coding = cli_flags->baseline_mode == BASELINE_OPTIMIZED;
+    jpeg_start_compress(out, TRUE);
+  }
 
-    if (photo1 && photo1->ext[0] != '\0') {
-      if (!_open_source_zip_archive(cli_flags, photo1->cbz_path, &src_zip1)) {
-        continue;
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JDIMENSION read  = jpeg_read_scanlines(&cinfo, batch, batch_height);
+    JSAMPARRAY input = batch;
+    if (gray) {
+      if (!_rgb_batch_to_gray(batch, gray_batch, read, cinfo.output_width)) {
+        jpeg_destroy_compress(&cinfo_compress[0]);
+        jpeg_destroy_compress(&cinfo_compress[1]);
+        jpeg_destroy_decompress(&cinfo);
+        free(dests[0].data);
+        free(dests[1].data);
+        return REENCODE_NOT_GRAY;
       }
-      if (!_get_photo_index_from_source_zip(cli_flags, src_zip1, photo1->name,
-                                            &idx1)) {
-        zip_close(src_zip1);
+      input = gray_batch;
+    }
+    for (int h = 0; h < 2; h++) {
+      if (!wanted[h]) {
         continue;
       }
+      for (JDIMENSION row = 0; row < read; row++) {
+        rows[row] = input[row] + (size_t)(offsets[h] - crop_x) * components;
+      }
+      jpeg_write_scanlines(&cinfo_compress[h], rows, read);
     }
+  }
 
-    if (photo2 && photo2->ext[0] != '\0') {
-      if (!_open_source_zip_archive(cli_flags, photo2->cbz_path, &src_zip2)) {
-        continue;
+  for (int h = 0; h < 2; h++) {
+    if (wanted[h]) {
+      jpeg_finish_compress(&cinfo_compress[h]);
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_compress(&cinfo_compress[0]);
+  jpeg_destroy_compress(&cinfo_compress[1]);
+  jpeg_destroy_decompress(&cinfo);
+  if (gray) {
+    printfv(*cli_flags, DARK_GREEN, "Encoded a gray spread with one channel\n");
+  }
+  for (int h = 0; h < 2; h++) {
+    halves[h] = dests[h].data;
+    sizes[h]  = dests[h].size;
+  }
+  return REENCODE_DONE;
+}
+
+/// splits a spread by decoding it and encoding the halves again, only used
+/// when the lossless crop is not possible
+static bool _split_jpeg_buffer_reencode(const cli_flags_t *cli_flags,
+                                        const uint8_t     *buffer,
+                                        uint64_t           buffer_size,
+                                        const bool         wanted[2],
+                                        uint8_t *halves[2], uint64_t sizes[2]) {
+  reencode_result_e result = _split_jpeg_reencode_pass(
+      cli_flags, buffer, buffer_size, wanted, halves, sizes, true);
+  if (result == REENCODE_NOT_GRAY) {
+    result = _split_jpeg_reencode_pass(cli_flags, buffer, buffer_size, wanted,
+                                       halves, sizes, false);
+  }
+  return result == REENCODE_DONE;
+}
+
+/// trims the white borders of a page that is not split, false if it has none
+/// worth encoding the page again for. The buffer is left as it is
+static bool _autocrop_image(const cli_flags_t *cli_flags, photo_t photo,
+                            const uint8_t *buffer, uint64_t buffer_size,
+                            uint8_t **cropped, uint64_t *cropped_size) {
+  bool wanted[1] = {true};
+  if (strncmp(photo.ext, ".jpg", 4) == 0) {
+    return _crop_jpeg_lossless(cli_flags, photo, buffer, buffer_size, 1,
+                               wanted, cropped, cropped_size);
+  } else if (strncmp(photo.ext, ".png", 4) == 0) {
+    return _split_png_rows(cli_flags, buffer, buffer_size, 1, wanted, cropped,
+                           cropped_size);
+  }
+  return false;
+}
+
+/// split the file [X|X] into [X|_] and [_|X] with a single decode, wanted
+/// says which halves to make. With --autocrop the halves are trimmed while
+/// they are cut out. The buffer is left as it is
+static bool _split_image_halves(const cli_flags_t *cli_flags, photo_t photo,
+                                const uint8_t *buffer, uint64_t buffer_size,
+                                const bool wanted[2], uint8_t *halves[2],
+                                uint64_t sizes[2]) {
+  halves[0] = halves[1] = NULL;
+  sizes[0] = sizes[1] = 0;
+  if (strncmp(photo.ext, ".jpg", 4) == 0) {
+    if (_crop_jpeg_lossless(cli_flags, photo, buffer, buffer_size, 2, wanted,
+                            halves, sizes)) {
+      return true;
+    }
+    printfv(*cli_flags, DARK_YELLOW,
+            "Lossless crop of %s failed, decoding it instead\n", photo.name);
+    if (!_split_jpeg_buffer_reencode(cli_flags, buffer, buffer_size, wanted,
+                                     halves, sizes)) {
+      return false;
+    }
+    // the halves are baseline now, so they can be trimmed losslessly
+    for (int h = 0; h < 2 && cli_flags->autocrop_mode == AUTOCROP_ENABLED;
+         h++) {
+      uint8_t *cropped;
+      uint64_t cropped_size;
+      if (wanted[h] && _autocrop_image(cli_flags, photo, halves[h], sizes[h],
+                                       &cropped, &cropped_size)) {
+        free(halves[h]);
+        halves[h] = cropped;
+        sizes[h]  = cropped_size;
+      }
+    }
+    return true;
+  } else if (strncmp(photo.ext, ".png", 4) == 0) {
+    return _split_png_rows(cli_flags, buffer, buffer_size, 2, wanted, halves,
+                           sizes);
+  }
+  printfv(*cli_flags, RED, "Error: Unsupported file type\n");
+  return false;
+}
+
+/// decodes a jpeg with libjpeg's DCT scaling at the smallest n/8 that still
+/// covers max_width x max_height and encodes it again, batch by batch. With
+/// try_gray it is encoded with one channel until a row with colour shows up
+static reencode_result_e _shrink_jpeg_pass(const cli_flags_t *cli_flags,
+                                           const uint8_t     *buffer,
+                                           uint64_t           buffer_size,
+                                           uint32_t           max_width,
+                                           uint32_t           max_height,
+                                           uint8_t          **shrunk,
+                                           uint64_t          *shrunk_size,
+                                           bool               try_gray) {
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct   dst;
+  jpeg_error_t                  err;
+  jpeg_dest_t                   dest = {0};
+
+  src.err            = jpeg_std_error(&err.pub);
+  dst.err            = &err.pub;
+  err.pub.error_exit = _jpeg_error_exit;
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    free(dest.data);
+    return REENCODE_FAILED;
+  }
+
+  jpeg_mem_src(&src, buffer, buffer_size);
+  jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+  for (int m = 0; m < 16; m++) {
+    jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+  }
+  jpeg_read_header(&src, TRUE);
+  bool gray = try_gray && _can_be_gray(&src);
+
+  double fit = fmin((double)max_width / src.image_width,
+                    (double)max_height / src.image_height);
+  unsigned int scale_num = (unsigned int)MAX(ceil(fit * DCTSIZE), 1);
+  if (scale_num >= DCTSIZE) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    return REENCODE_FAILED; // already at (or below) the size it is printed at
+  }
+  src.scale_num   = scale_num;
+  src.scale_denom = DCTSIZE;
+  jpeg_start_decompress(&src);
+
+  JDIMENSION batch_height = src.rec_outbuf_height;
+  JSAMPARRAY batch        = (*src.mem->alloc_sarray)(
+      (j_common_ptr)&src, JPOOL_IMAGE,
+      src.output_width * src.output_components, batch_height);
+  JSAMPARRAY gray_batch =
+      gray ? (*src.mem->alloc_sarray)((j_common_ptr)&src, JPOOL_IMAGE,
+                                      src.output_width, batch_height)
+           : NULL;
+
+  _jpeg_dest(&dst, &dest);
+  dst.image_width      = src.output_width;
+  dst.image_height     = src.output_height;
+  dst.input_components = gray ? 1 : src.output_components;
+  dst.in_color_space   = gray ? JCS_GRAYSCALE : src.out_color_space;
+  jpeg_set_defaults(&dst);
+  jpeg_set_quality(&dst, SHRINK_JPEG_QUALITY, TRUE);
+  jpeg_start_compress(&dst, TRUE);
+  _copy_jpeg_markers(&src, &dst);
+
+  while (src.output_scanline < src.output_height) {
+    JDIMENSION read = jpeg_read_scanlines(&src, batch, batch_height);
+    if (!gray) {
+      jpeg_write_scanlines(&dst, batch, read);
+    } else if (_rgb_batch_to_gray(batch, gray_batch, read, src.output_width)) {
+      jpeg_write_scanlines(&dst, gray_batch, read);
+    } else {
+      jpeg_destroy_compress(&dst);
+      jpeg_destroy_decompress(&src);
+      free(dest.data);
+      return REENCODE_NOT_GRAY;
+    }
+  }
+
+  printfv(*cli_flags, DARK_GREEN, "Shrunk a %s jpeg from %ux%u to %ux%u\n",
+          gray ? "gray" : "colour", src.image_width, src.image_height,
+          src.output_width, src.output_height);
+  jpeg_finish_compress(&dst);
+  jpeg_destroy_compress(&dst);
+  jpeg_finish_decompress(&src);
+  jpeg_destroy_decompress(&src);
+  *shrunk      = dest.data;
+  *shrunk_size = dest.size;
+  return REENCODE_DONE;
+}
+
+static bool _shrink_jpeg_buffer(const cli_flags_t *cli_flags,
+                                const uint8_t *buffer, uint64_t buffer_size,
+                                uint32_t max_width, uint32_t max_height,
+                                uint8_t **shrunk, uint64_t *shrunk_size) {
+  reencode_result_e result =
+      _shrink_jpeg_pass(cli_flags, buffer, buffer_size, max_width, max_height,
+                        shrunk, shrunk_size, true);
+  if (result == REENCODE_NOT_GRAY) {
+    result = _shrink_jpeg_pass(cli_flags, buffer, buffer_size, max_width,
+                               max_height, shrunk, shrunk_size, false);
+  }
+  return result == REENCODE_DONE;
+}
+
+/// resamples a png to fit max_width x max_height with a box filter, every
+/// output pixel is the average of the source pixels it covers. Rows are
+/// streamed like in _split_png_rows, interlaced images are read whole
+static bool _shrink_png_buffer(const cli_flags_t *cli_flags,
+                               const uint8_t *buffer, uint64_t buffer_size,
+                               uint32_t max_width, uint32_t max_height,
+                               uint8_t **shrunk, uint64_t *shrunk_size) {
+  png_split_t *split = (png_split_t *)calloc(1, sizeof(png_split_t));
+  if (!split) {
+    return false;
+  }
+  png_reader_t reader = {.data = buffer, .size = buffer_size, .pos = 0};
+  split->read =
+      png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  split->read_info = split->read ? png_create_info_struct(split->read) : NULL;
+  split->write[0] =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  split->write_info[0] =
+      split->write[0] ? png_create_info_struct(split->write[0]) : NULL;
+  if (!split->read_info || !split->write_info[0]) {
+    _free_png_split(split);
+    return false;
+  }
+  if (setjmp(png_jmpbuf(split->read))) {
+    printfv(*cli_flags, RED, "Failed to decode a png to shrink\n");
+    _free_png_split(split);
+    return false;
+  }
+  if (setjmp(png_jmpbuf(split->write[0]))) {
+    printfv(*cli_flags, RED, "Failed to encode a shrunk png\n");
+    _free_png_split(split);
+    return false;
+  }
+
+  png_set_read_fn(split->read, &reader, _png_read_fn);
+  png_read_info(split->read, split->read_info);
+  png_uint_32 width  = png_get_image_width(split->read, split->read_info);
+  png_uint_32 height = png_get_image_height(split->read, split->read_info);
+  double      fit    = fmin((double)max_width / width,
+                            (double)max_height / height);
+  if (fit >= 1) {
+    _free_png_split(split);
+    return false; // already at (or below) the size it is printed at
+  }
+  png_uint_32 new_width  = (png_uint_32)MAX(ceil(width * fit), 1);
+  png_uint_32 new_height = (png_uint_32)MAX(ceil(height * fit), 1);
+
+  // 8 bits per channel, palettes and tRNS become plain channels
+  png_set_expand(split->read);
+  png_set_strip_16(split->read);
+  int passes = png_set_interlace_handling(split->read);
+  png_read_update_info(split->read, split->read_info);
+  int    channels  = png_get_channels(split->read, split->read_info);
+  size_t row_bytes = png_get_rowbytes(split->read, split->read_info);
+
+  png_set_write_fn(split->write[0], &split->out[0], _png_write_fn,
+                   _png_flush_fn);
+  png_set_IHDR(split->write[0], split->write_info[0], new_width, new_height, 8,
+               png_get_color_type(split->read, split->read_info),
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  _copy_png_chunks(split->read, split->read_info, split->write[0],
+                   split->write_info[0], false);
+  png_write_info(split->write[0], split->write_info[0]);
+
+  split->sums = (uint64_t *)calloc((size_t)new_width * channels,
+                                   sizeof(uint64_t));
+  if (passes > 1) {
+    split->rows = (png_bytep *)calloc(height, sizeof(png_bytep));
+    if (split->rows) {
+      split->rows[0] = (png_bytep)malloc(row_bytes * height);
+    }
+  } else {
+    split->row = (png_bytep)malloc(row_bytes);
+  }
+  if (!split->sums || (passes > 1 ? !split->rows || !split->rows[0]
+                                  : !split->row)) {
+    _free_png_split(split);
+    return false;
+  }
+  if (passes > 1) {
+    for (png_uint_32 y = 1; y < height; y++) {
+      split->rows[y] = split->rows[0] + y * row_bytes;
+    }
+    png_read_image(split->read, split->rows);
+  }
+
+  png_uint_32 y = 0;
+  for (png_uint_32 new_y = 0; new_y < new_height; new_y++) {
+    png_uint_32 y_end = (uint64_t)(new_y + 1) * height / new_height;
+    png_uint_32 rows  = y_end - y;
+    png_bytep   row   = split->row;
+    for (; y < y_end; y++) {
+      if (passes > 1) {
+        row = split->rows[y];
+      } else {
+        png_read_row(split->read, row, NULL);
       }
-      if (!_get_photo_index_from_source_zip(cli_flags, src_zip2, photo2->name,
-                                            &idx2)) {
-        zip_close(src_zip2);
-        if (src_zip1) {
-          zip_close(src_zip1);
+      for (png_uint_32 new_x = 0, x = 0; new_x < new_width; new_x++) {
+        png_uint_32 x_end = (uint64_t)(new_x + 1) * width / new_width;
+        uint64_t   *sum   = split->sums + (size_t)new_x * channels;
+        for (; x < x_end; x++) {
+          for (int c = 0; c < channels; c++) {
+            sum[c] += row[(size_t)x * channels + c];
+          }
         }
-        continue;
       }
     }
 
-    if (!_handle_pdf_buffer(cli_flags, src_zip1, src_zip2, &pdf, idx1, idx2,
-                            photo1, photo2)) {
-      if (src_zip1) {
-        zip_close(src_zip1);
+    // the last row read is not needed anymore, the output row goes there
+    for (png_uint_32 new_x = 0; new_x < new_width; new_x++) {
+      uint64_t  x_start = (uint64_t)new_x * width / new_width;
+      uint64_t  x_end   = (uint64_t)(new_x + 1) * width / new_width;
+      uint64_t  count   = (x_end - x_start) * rows;
+      uint64_t *sum     = split->sums + (size_t)new_x * channels;
+      for (int c = 0; c < channels; c++) {
+        row[(size_t)new_x * channels + c] = (sum[c] + count / 2) / count;
+        sum[c]                            = 0;
+      }
+    }
+    png_write_row(split->write[0], row);
+  }
+  png_write_end(split->write[0], NULL);
+
+  printfv(*cli_flags, DARK_GREEN, "Shrunk a png from %ux%u to %ux%u\n", width,
+          height, new_width, new_height);
+  *shrunk            = split->out[0].data;
+  *shrunk_size       = split->out[0].size;
+  split->out[0].data = NULL;
+  _free_png_split(split);
+  return true;
+}
+
+/// shrinks an image to the pixels it is printed with at cli_flags->dpi, width
+/// and height are the box it is drawn in (in pdf points). The buffer is kept
+/// as it is when the image is small enough already or cannot be shrunk
+static void _shrink_image_buffer(const cli_flags_t *cli_flags,
+                                 const photo_t *photo, uint8_t **buffer,
+                                 uint64_t *buffer_size, float width,
+                                 float height) {
+  if (cli_flags->dpi == 0 || !*buffer) {
+    return;
+  }
+  uint32_t max_width  = (uint32_t)ceilf(width / PDF_POINTS_PER_INCH *
+                                        cli_flags->dpi);
+  uint32_t max_height = (uint32_t)ceilf(height / PDF_POINTS_PER_INCH *
+                                        cli_flags->dpi);
+  uint8_t *shrunk      = NULL;
+  uint64_t shrunk_size = 0;
+  bool     ok          = false;
+  if (strncmp(photo->ext, ".jpg", 4) == 0) {
+    ok = _shrink_jpeg_buffer(cli_flags, *buffer, *buffer_size, max_width,
+                             max_height, &shrunk, &shrunk_size);
+  } else if (strncmp(photo->ext, ".png", 4) == 0) {
+    ok = _shrink_png_buffer(cli_flags, *buffer, *buffer_size, max_width,
+                            max_height, &shrunk, &shrunk_size);
+  }
+  if (ok) {
+    freev(*cli_flags, *buffer, "buffer", -1);
+    *buffer      = shrunk;
+    *buffer_size = shrunk_size;
+  }
+}
+
+/// reads a whole entry of an archive into a buffer
+static bool _read_zip_entry_buffer(const cli_flags_t *cli_flags,
+                                   zip_t *src_zip, const char *name,
+                                   zip_int64_t idx, uint8_t **buffer,
+                                   uint64_t *buffer_size) {
+  zip_file_t *zfile = zip_fopen_index(src_zip, idx, 0);
+  if (!zfile) {
+    printfv(*cli_flags, RED,
+            "Error opening file %s within source zip archive\n", name);
+    return false;
+  }
+
+  zip_stat_t zstat;
+  zip_stat_index(src_zip, idx, 0, &zstat);
+  // an empty entry still gets a buffer, NULL means memory ran out
+  *buffer = (uint8_t *)mallocv(*cli_flags, "buffer", MAX(zstat.size, 1), -1);
+  if (!*buffer) {
+    zip_fclose(zfile);
+    return false;
+  }
+
+  zip_int64_t bytes_read = zip_fread(zfile, *buffer, zstat.size);
+  if (bytes_read < 0) {
+    printfv(*cli_flags, RED, "Failed to read %s within source zip archive\n ",
+            name);
+    zip_fclose(zfile);
+    freev(*cli_flags, *buffer, "buffer", -1);
+    return false;
+  }
+  zip_fclose(zfile);
+
+  *buffer_size = zstat.size;
+  return true;
+}
+
+/// a half of a spread comes out of split_cache when the other half was
+/// already extracted or is being split, otherwise the spread is read and
+/// split once and the half that was not asked for is left in split_cache. A
+/// failed split is reported to split_cache as well so a sheet that waits for
+/// the other half splits the spread itself. The entry comes out of
+/// prefetched when the read ahead thread got to it, otherwise it is read from
+/// its archive in pool
+static bool _extact_image_from_source_to_buffer(
+    const cli_flags_t *cli_flags, split_cache_t *split_cache,
+    reorder_buffer_t *prefetched, uint32_t slot, archive_pool_t *pool,
+    photo_t photo, uint8_t **buffer, uint64_t *buffer_size,
+    char new_filename[PATH_MAX]) {
+  /* create newfilename */
+  snprintf(new_filename, PATH_MAX, "%05u%s", photo.id, photo.ext);
+
+  zip_int64_t        idx   = (zip_int64_t)photo.index;
+  double_page_mode_e other = photo.double_page == DOUBLE_PAGE_LEFT
+                                 ? DOUBLE_PAGE_RIGHT
+                                 : DOUBLE_PAGE_LEFT;
+  if (photo.double_page != DOUBLE_PAGE_FALSE &&
+      split_cache_take(cli_flags, split_cache, photo.cbz_path, idx,
+                       photo.double_page, buffer, buffer_size)) {
+    return true;
+  }
+
+  /* extract image from source to buffer */
+  if (!prefetched || !reorder_buffer_take(cli_flags, prefetched, slot, buffer,
+                                          buffer_size)) {
+    zip_t *src_zip = archive_pool_get(cli_flags, pool, photo.cbz_path);
+    bool   read    = src_zip && _read_zip_entry_buffer(cli_flags, src_zip,
+                                                       photo.name, idx, buffer,
+                                                       buffer_size);
+    archive_pool_put(pool, src_zip);
+    if (!read) {
+      if (photo.double_page != DOUBLE_PAGE_FALSE) {
+        split_cache_put(cli_flags, split_cache, photo.cbz_path, idx, other,
+                        NULL, 0);
+      }
+      return false;
+    }
+  }
+
+  uint8_t *cropped;
+  uint64_t cropped_size;
+  if (photo.double_page == DOUBLE_PAGE_FALSE &&
+      cli_flags->autocrop_mode == AUTOCROP_ENABLED &&
+      _autocrop_image(cli_flags, photo, *buffer, *buffer_size, &cropped,
+                      &cropped_size)) {
+    freev(*cli_flags, *buffer, "buffer", -1);
+    *buffer      = cropped;
+    *buffer_size = cropped_size;
+  }
+  /* Handle double page */
+  if (photo.double_page != DOUBLE_PAGE_FALSE) {
+    bool     wanted[2] = {true, true};
+    uint8_t *halves[2];
+    uint64_t sizes[2];
+    if (!_split_image_halves(cli_flags, photo, *buffer, *buffer_size, wanted,
+                             halves, sizes)) {
+      printfv(*cli_flags, RED, "Failed to split %s, it is kept whole\n",
+              photo.name);
+      split_cache_put(cli_flags, split_cache, photo.cbz_path, idx, other, NULL,
+                      0);
+      return true;
+    }
+
+    int half = photo.double_page == DOUBLE_PAGE_RIGHT;
+    freev(*cli_flags, *buffer, "buffer", -1);
+    *buffer      = halves[half];
+    *buffer_size = sizes[half];
+    split_cache_put(cli_flags, split_cache, photo.cbz_path, idx, other,
+                    halves[!half], sizes[!half]);
+  }
+  return true;
+}
+/// scales an image that was added to the pdf to fit the available space and
+/// draws it centered in it
+static void _place_pdf_image(pdf_page_t *page, uint32_t number,
+                             const pdf_image_t *image, float x_position,
+                             float available_width, float available_height,
+                             float border) {
+  float img_width  = (float)image->width;
+  float img_height = (float)image->height;
+  float scale =
+      fmin(available_height / img_height, available_width / img_width);
+  img_width  *= scale;
+  img_height *= scale;
+
+  // Draw the image centered within the available space
+  float x_offset = (available_width - img_width) / 2;
+  float y_offset = (available_height - img_height) / 2;
+  pdf_page_draw_image(page, number, x_position + x_offset, border + y_offset,
+                      img_width, img_height);
+}
+
+/// a png's IDAT stream is what a pdf flate image with png predictors reads,
+/// as long as the png is not interlaced and has no alpha channel. A single
+/// transparent colour becomes a colour key mask
+static bool _png_pdf_passthrough(const png_chunks_t *png,
+                                 pdf_image_t        *image) {
+  if (png->interlaced || png->bit_depth > 8) {
+    return false;
+  }
+  memset(image, 0, sizeof(*image));
+  image->width      = png->width;
+  image->height     = png->height;
+  image->bits       = png->bit_depth;
+  image->filter     = PDF_FILTER_FLATE;
+  image->predictors = true;
+  switch (png->color_type) {
+  case PNG_COLOR_TYPE_GRAY:
+    image->components = 1;
+    break;
+  case PNG_COLOR_TYPE_RGB:
+    image->components = 3;
+    break;
+  case PNG_COLOR_TYPE_PALETTE:
+    // a palette with alpha needs a soft mask, which means decoding
+    for (uint32_t i = 0; png->trns && i < png->trns_size; i++) {
+      if (png->trns[i] != 0xFF) {
+        return false;
       }
-      if (src_zip2) {
-        zip_close(src_zip2);
+    }
+    image->components   = 1;
+    image->palette      = png->palette;
+    image->palette_size = png->palette_size;
+    return png->palette != NULL;
+  default:
+    return false; // the alpha is interleaved with the colour
+  }
+
+  if (png->trns) {
+    if (png->trns_size < image->components * 2) {
+      return false;
+    }
+    image->keyed = true;
+    for (uint32_t c = 0; c < image->components; c++) {
+      const uint8_t *key = png->trns + c * 2;
+      image->key[c]      = (uint16_t)((key[0] << 8) | key[1]);
+    }
+  }
+  return true;
+}
+
+/// deflates 8 bit rows with the png Up filter in front of every row, which a
+/// pdf reads back with /Predictor 15
+static bool _deflate_pdf_rows(const cli_flags_t *cli_flags,
+                              const uint8_t *rows, uint32_t stride,
+                              uint32_t height, uint8_t **out,
+                              uint64_t *out_size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return false;
+  }
+  uint64_t capacity = deflateBound(&stream, ((uint64_t)stride + 1) * height);
+  uint8_t *filtered = (uint8_t *)mallocv(*cli_flags, "filtered",
+                                         (size_t)stride + 1, -1);
+  *out = (uint8_t *)mallocv(*cli_flags, "out", capacity, -1);
+  if (!filtered || !*out || capacity > UINT32_MAX) {
+    freev(*cli_flags, filtered, "filtered", -1);
+    freev(*cli_flags, *out, "out", -1);
+    deflateEnd(&stream);
+    return false;
+  }
+
+  stream.next_out  = *out;
+  stream.avail_out = (uInt)capacity;
+  int status       = Z_OK;
+  filtered[0]      = 2; // Up
+  for (uint32_t y = 0; y < height && status == Z_OK; y++) {
+    const uint8_t *row   = rows + (size_t)y * stride;
+    const uint8_t *above = y > 0 ? row - stride : NULL;
+    for (uint32_t x = 0; x < stride; x++) {
+      filtered[x + 1] = (uint8_t)(row[x] - (above ? above[x] : 0));
+    }
+    stream.next_in  = filtered;
+    stream.avail_in = stride + 1;
+    status = deflate(&stream, y + 1 == height ? Z_FINISH : Z_NO_FLUSH);
+  }
+  *out_size = stream.total_out;
+  deflateEnd(&stream);
+  freev(*cli_flags, filtered, "filtered", -1);
+  if (status != Z_STREAM_END) {
+    freev(*cli_flags, *out, "out", -1);
+    return false;
+  }
+  return true;
+}
+
+/// one page of a sheet, read and parsed on a worker so writing it to the pdf
+/// is only a copy
+typedef struct {
+  uint8_t    *buffer; // the page as it was read, a palette points into it
+  uint64_t    buffer_size;
+  pdf_image_t image;
+  uint8_t    *data; // the image stream, NULL when it is the buffer itself
+  uint64_t    size;
+  pdf_image_t mask;      // the alpha of a decoded png
+  uint8_t    *mask_data; // NULL when there is no alpha
+  uint64_t    mask_size;
+  bool        ready;  // false for a blank page or one that failed
+  bool        failed; // the page could not be read or parsed
+} pdf_slot_t;
+
+/// pngs that can not be passed through are decoded to 8 bit gray or rgb and
+/// deflated again. Their alpha goes into a separate gray image that the
+/// colour uses as a soft mask, unless every pixel is opaque
+static bool _decode_pdf_png(const cli_flags_t *cli_flags, pdf_slot_t *slot) {
+  png_image png;
+  memset(&png, 0, sizeof(png));
+  png.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&png, slot->buffer,
+                                        slot->buffer_size)) {
+    return false;
+  }
+  bool alpha  = png.format & PNG_FORMAT_FLAG_ALPHA;
+  png.format  = png.format & PNG_FORMAT_FLAG_COLOR;
+  png.format |= alpha ? PNG_FORMAT_FLAG_ALPHA : 0;
+  uint32_t channels = PNG_IMAGE_PIXEL_CHANNELS(png.format);
+  uint64_t pixels   = (uint64_t)png.width * png.height;
+  uint8_t *data     = (uint8_t *)mallocv(*cli_flags, "data",
+                                         (size_t)(pixels * channels), -1);
+  if (!data) {
+    png_image_free(&png);
+    return false;
+  }
+  if (!png_image_finish_read(&png, NULL, data, 0, NULL)) {
+    png_image_free(&png);
+    freev(*cli_flags, data, "data", -1);
+    return false;
+  }
+
+  pdf_image_t *image = &slot->image;
+  memset(image, 0, sizeof(*image));
+  image->width      = png.width;
+  image->height     = png.height;
+  image->components = alpha ? channels - 1 : channels;
+  image->bits       = 8;
+  image->filter     = PDF_FILTER_FLATE;
+  image->predictors = true;
+
+  bool ok = true;
+  if (alpha) {
+    // the colour is packed in place in front of the alpha
+    uint8_t *mask   = (uint8_t *)mallocv(*cli_flags, "mask", pixels, -1);
+    bool     opaque = true;
+    ok              = mask != NULL;
+    for (uint64_t i = 0; ok && i < pixels; i++) {
+      const uint8_t *pixel = data + i * channels;
+      memmove(data + i * image->components, pixel, image->components);
+      mask[i]  = pixel[image->components];
+      opaque  &= mask[i] == 0xFF;
+    }
+    if (ok && !opaque) {
+      slot->mask            = *image;
+      slot->mask.components = 1;
+      ok = _deflate_pdf_rows(cli_flags, mask, image->width, image->height,
+                             &slot->mask_data, &slot->mask_size);
+    }
+    freev(*cli_flags, mask, "mask", -1);
+  }
+  ok = ok && _deflate_pdf_rows(cli_flags, data,
+                               image->width * image->components,
+                               image->height, &slot->data, &slot->size);
+  freev(*cli_flags, data, "data", -1);
+  return ok;
+}
+
+/// the IDAT stream goes into the pdf as it is when it can, otherwise the png
+/// is decoded and compressed again
+static bool _prepare_pdf_png(const cli_flags_t *cli_flags, pdf_slot_t *slot) {
+  png_chunks_t png;
+  if (png_chunks_read(slot->buffer, slot->buffer_size, &png) &&
+      _png_pdf_passthrough(&png, &slot->image)) {
+    slot->data = png.idat; // the slot takes ownership of the stream
+    slot->size = png.idat_size;
+    return true;
+  }
+  png_chunks_free(&png);
+  return _decode_pdf_png(cli_flags, slot);
+}
+
+/// reads what the pdf image object needs out of the jpeg header
+static bool _jpeg_pdf_image(const uint8_t *buffer, uint64_t buffer_size,
+                            pdf_image_t *image) {
+  struct jpeg_decompress_struct cinfo;
+  jpeg_error_t                  err;
+
+  cinfo.err          = jpeg_std_error(&err.pub);
+  err.pub.error_exit = _jpeg_error_exit;
+  jpeg_create_decompress(&cinfo);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  jpeg_mem_src(&cinfo, buffer, buffer_size);
+  jpeg_read_header(&cinfo, TRUE);
+  memset(image, 0, sizeof(*image));
+  image->width      = cinfo.image_width;
+  image->height     = cinfo.image_height;
+  image->components = (uint32_t)cinfo.num_components;
+  image->bits       = 8;
+  image->filter     = PDF_FILTER_DCT;
+  image->inverted   = cinfo.saw_Adobe_marker &&
+                    (cinfo.jpeg_color_space == JCS_CMYK ||
+                     cinfo.jpeg_color_space == JCS_YCCK);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+static void _draw_pdf_dashed_line(pdf_page_t *page, float page_width,
+                                  float page_height, float border) {
+  // Calculate the vertical center of the page
+  float y = border; // Starting Y coordinate of the dashed line
+  float line_height =
+      page_height - (2 * border); // Ending Y coordinate of the dashed line
+
+  // Calculate the horizontal position for the dashed line, which is in the
+  // middle of the page
+  float x = page_width / 2;
+
+  // Draw the dashed line from the top to the bottom at the middle of the page
+  pdf_page_dashed_line(page, x, y, x, y + line_height);
+}
+
+typedef struct {
+  pdf_slot_t slots[2]; // left and right
+} pdf_sheet_t;
+
+typedef struct {
+  const cli_flags_t  *cli_flags;
+  photo_t            *photos; // in reading order
+  uint32_t            photo_count;
+  const imposition_t *imposition; // the two photos of every sheet
+  const uint32_t     *entry_of;   // read ahead slot of every photo
+  const uint32_t     *need; // first sheet that draws every read ahead slot
+  reorder_buffer_t   *prefetched; // NULL when there is no read ahead thread
+  split_cache_t      *split_cache;
+  archive_pool_t     *pool;   // shared by every worker and the read ahead
+  pdf_sheet_t        *sheets; // ring of window slots
+  uint32_t            window;
+  pdf_writer_t       *pdf;
+} pdf_output_ctx_t;
+
+/// gives every archive entry that is drawn a read ahead slot, the two halves
+/// of a spread share one. need is the first sheet that draws the entry, or
+/// UINT32_MAX when no sheet does
+static uint32_t _map_pdf_entries(const photo_t *photos, uint32_t photo_count,
+                                 const imposition_t *imposition,
+                                 uint32_t *entry_of, uint32_t *need) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < photo_count; i++) {
+    // _reorder_double_page_photos keeps the halves of a spread next to
+    // each other
+    bool same = i > 0 && photos[i].index == photos[i - 1].index &&
+                strcmp(photos[i].cbz_path, photos[i - 1].cbz_path) == 0;
+    entry_of[i] = same ? entry_of[i - 1] : count++;
+    need[entry_of[i]] = UINT32_MAX;
+  }
+  for (uint32_t k = 0; k < imposition_sheet_count(imposition); k++) {
+    uint32_t sheet[2];
+    imposition_sheet(imposition, k, sheet);
+    for (uint32_t i = 0; i < 2; i++) {
+      if (sheet[i] != IMPOSITION_BLANK && photos[sheet[i]].ext[0] != '\0') {
+        uint32_t entry = entry_of[sheet[i]];
+        need[entry]    = MIN(need[entry], k);
       }
-      continue;
     }
+  }
+  return count;
+}
 
-    if (src_zip1) {
-      zip_close(src_zip1);
+/// reads every entry that is drawn in archive order, so the disk does not
+/// seek back and forth between the first and the last archive, and leaves
+/// them in the reorder buffer for the sheets. It stays within a window of the
+/// sheets, pages further ahead are left for the sheets to read themselves
+static void *_prefetch_pdf_pages(void *ctx) {
+  pdf_output_ctx_t *out = (pdf_output_ctx_t *)ctx;
+  for (uint32_t i = 0; i < out->photo_count; i++) {
+    const photo_t *photo = &out->photos[i];
+    uint32_t       entry = out->entry_of[i];
+    if ((i > 0 && out->entry_of[i - 1] == entry) ||
+        out->need[entry] == UINT32_MAX) {
+      continue;
     }
-    if (src_zip2) {
-      zip_close(src_zip2);
+    // a page that can not be read, or is too far ahead of the sheets, is put
+    // empty and the sheet reads it on its own
+    uint8_t *data      = NULL;
+    uint64_t data_size = 0;
+    zip_t   *src_zip =
+        reorder_buffer_wait(out->prefetched, entry)
+            ? archive_pool_get(out->cli_flags, out->pool, photo->cbz_path)
+            : NULL;
+    if (src_zip) {
+      _read_zip_entry_buffer(out->cli_flags, src_zip, photo->name,
+                             (zip_int64_t)photo->index, &data, &data_size);
+      archive_pool_put(out->pool, src_zip);
     }
+    reorder_buffer_put(out->cli_flags, out->prefetched, entry, data,
+                       data_size);
   }
+  return NULL;
+}
 
-  /* SAVE AND FREE */
-  HPDF_SaveToFile(pdf, output_file);
-  HPDF_Free(pdf);
+/// reads a page of a sheet, shrinks it and parses it, so nothing but copying
+/// is left for the writer. A page that can not be read or parsed is marked
+/// as failed
+static void _prepare_pdf_slot(const pdf_output_ctx_t *out, photo_t *photo,
+                              pdf_slot_t *slot) {
+  const cli_flags_t *cli_flags = out->cli_flags;
+  char               new_filename[PATH_MAX];
+  if (!_extact_image_from_source_to_buffer(
+          cli_flags, out->split_cache, out->prefetched,
+          out->entry_of[photo - out->photos], out->pool, *photo,
+          &slot->buffer, &slot->buffer_size, new_filename)) {
+    slot->failed = true;
+    return;
+  }
+  _shrink_image_buffer(cli_flags, photo, &slot->buffer, &slot->buffer_size,
+                       PDF_SLOT_WIDTH, PDF_SLOT_HEIGHT);
+
+  if (strncmp(photo->ext, ".jpg", 4) == 0) {
+    slot->ready =
+        _jpeg_pdf_image(slot->buffer, slot->buffer_size, &slot->image);
+  } else if (strncmp(photo->ext, ".png", 4) == 0) {
+    slot->ready = _prepare_pdf_png(cli_flags, slot);
+  } else {
+    printfv(*cli_flags, RED, "Error: Unsupported file type\n");
+  }
+  if (!slot->ready) {
+    printfv(*cli_flags, RED, "Failed to add %s to the pdf\n", photo->name);
+    slot->failed = true;
+  }
 }
 
-void extract_and_combine_cbz(const cli_flags_t   *cli_flags,
-                             const file_entry_t **sorted_files,
-                             const char          *output_file,
-                             const uint32_t      *file_count) {
-  uint32_t photo_counter  = 0;
-  uint32_t photos_arr_len = 10; // Initial array size
-  photo_t *photos         = (photo_t *)mallocv(*cli_flags, "photos",
-                                               photos_arr_len * sizeof(photo_t), -1);
-  if (photos == NULL) {
-    printfv(*cli_flags, RED, "Failed to allocate memory for photos\n");
+/// writes the image objects of a page and draws it centered in its half of
+/// the sheet
+static void _write_pdf_slot(const cli_flags_t *cli_flags, pdf_writer_t *pdf,
+                            pdf_page_t *page, pdf_slot_t *slot,
+                            float x_position) {
+  uint32_t number;
+  if (slot->mask_data &&
+      !pdf_writer_add_image(cli_flags, pdf, &slot->mask, slot->mask_data,
+                            slot->mask_size, &slot->image.smask)) {
     return;
   }
+  const uint8_t *data = slot->data ? slot->data : slot->buffer;
+  uint64_t       size = slot->data ? slot->size : slot->buffer_size;
+  if (pdf_writer_add_image(cli_flags, pdf, &slot->image, data, size,
+                           &number)) {
+    _place_pdf_image(page, number, &slot->image, x_position, PDF_SLOT_WIDTH,
+                     PDF_SLOT_HEIGHT, PDF_SHEET_BORDER);
+  }
+}
+
+static void _free_pdf_slot(const cli_flags_t *cli_flags, pdf_slot_t *slot) {
+  freev(*cli_flags, slot->buffer, "slot->buffer", -1);
+  freev(*cli_flags, slot->data, "slot->data", -1);
+  freev(*cli_flags, slot->mask_data, "slot->mask_data", -1);
+  slot->ready = false;
+}
+
+/// reads, splits, shrinks and parses both pages of a sheet on a worker
+static void _prepare_pdf_sheet_job(void *ctx, uint32_t index,
+                                   uint32_t worker) {
+  pdf_output_ctx_t *out   = (pdf_output_ctx_t *)ctx;
+  pdf_sheet_t      *sheet = &out->sheets[index % out->window];
+
+  uint32_t photos[2];
+  imposition_sheet(out->imposition, index, photos);
+  memset(sheet, 0, sizeof(*sheet));
+  for (uint32_t i = 0; i < 2; i++) {
+    if (photos[i] == IMPOSITION_BLANK) {
+      continue;
+    }
+    photo_t *photo = &out->photos[photos[i]];
+    if (photo->ext[0] != '\0') {
+      _prepare_pdf_slot(out, photo, &sheet->slots[i]);
+    }
+  }
+}
 
-  for (uint32_t i = 0; i < *file_count; i++) {
-    _handle_cbz_entry(cli_flags, (*sorted_files)[i].filename, &photo_counter,
-                      &photos, &photos_arr_len);
+/// called in sheet order, the images of a sheet are written to the pdf as
+/// soon as it is prepared and freed before the next sheet is written. A
+/// failed page fails the whole pdf, so no page goes missing silently
+static void _write_pdf_sheet(void *ctx, uint32_t index) {
+  pdf_output_ctx_t *out   = (pdf_output_ctx_t *)ctx;
+  pdf_sheet_t      *sheet = &out->sheets[index % out->window];
+
+  pdf_page_t page;
+  pdf_page_init(&page, PDF_SHEET_WIDTH, PDF_SHEET_HEIGHT);
+  for (uint32_t i = 0; i < 2; i++) {
+    if (sheet->slots[i].failed) {
+      out->pdf->failed = true;
+    }
+    if (sheet->slots[i].ready) {
+      _write_pdf_slot(out->cli_flags, out->pdf, &page, &sheet->slots[i],
+                      i * PDF_SHEET_WIDTH / 2 + PDF_SHEET_BORDER);
+    }
+    _free_pdf_slot(out->cli_flags, &sheet->slots[i]);
   }
-  // at this point we dont care about photos_arr_len
-  // only photo_counter will be used
-  photos = (photo_t *)reallocv(*cli_flags, photos, "photos",
-                               sizeof(photo_t) * photo_counter, -1);
-  // increase since and rename for double photos being left and right
-  _reorder_double_page_photos(cli_flags, &photos, &photo_counter);
+  _draw_pdf_dashed_line(&page, page.width, page.height, PDF_SHEET_BORDER);
+  pdf_writer_add_page(out->cli_flags, out->pdf, &page);
+}
 
-  if (_str_ends_with(output_file, ".cbz")) {
-    _make_output_cbz(cli_flags, photos, photo_counter, output_file);
-  } else if (_str_ends_with(output_file, ".pdf")) {
-    _make_output_pdf(cli_flags, photos, photo_counter, output_file);
+/// true if libzip says the entry is not encrypted, its stored bytes are only
+/// the compressed data then
+static bool _is_plain_zip_entry(const zip_stat_t *zstat) {
+  return (zstat->valid & ZIP_STAT_ENCRYPTION_METHOD) &&
+         zstat->encryption_method == ZIP_EM_NONE;
+}
+
+/// reads an entry as it is stored in the source archive, stored and deflated
+/// entries are not inflated so unsplit pages can be copied as is. Any other
+/// method is inflated by libzip and the blob is marked as stored. Encrypted
+/// entries are never read raw
+static bool _read_zip_entry_blob(const cli_flags_t *cli_flags, zip_t *src_zip,
+                                 zip_int64_t idx, const zip_stat_t *zstat,
+                                 zip_blob_t *blob) {
+  bool raw = _is_plain_zip_entry(zstat) &&
+             (zstat->valid & ZIP_STAT_COMP_METHOD) &&
+             (zstat->comp_method == COMPRESSION_METHOD_STORE ||
+              zstat->comp_method == COMPRESSION_METHOD_DEFLATE);
+  zip_uint64_t size = raw ? zstat->comp_size : zstat->size;
+
+  memset(blob, 0, sizeof(*blob));
+  zip_file_t *zfile =
+      zip_fopen_index(src_zip, idx, raw ? ZIP_FL_COMPRESSED : 0);
+  if (!zfile) {
+    return false;
+  }
+  blob->data = (uint8_t *)mallocv(*cli_flags, "blob->data", MAX(size, 1), -1);
+  if (!blob->data) {
+    zip_fclose(zfile);
+    return false;
+  }
+
+  zip_int64_t bytes_read = zip_fread(zfile, blob->data, size);
+  zip_fclose(zfile);
+  if (bytes_read < 0 || (zip_uint64_t)bytes_read != size) {
+    zip_blob_free(blob);
+    return false;
   }
 
-  for (uint32_t i = 0; i < photo_counter; i++) {
-    freev(*cli_flags, photos[i].cbz_path, "photos[].cbz_path", i);
-    freev(*cli_flags, photos[i].name, "photos[].name", i);
-    freev(*cli_flags, photos[i].ext, "photos[].ext", i);
+  blob->size              = size;
+  blob->uncompressed_size = zstat->size;
+  blob->crc               = zstat->crc;
+  blob->method = raw ? zstat->comp_method : COMPRESSION_METHOD_STORE;
+  blob->mtime  = zstat->mtime;
+  return true;
+}
+
+/// an entry of the source archives, the cbz output handles one per job
+typedef struct {
+  uint32_t              archive; // index into sorted_files
+  zip_uint64_t          index;   // entry index inside the archive
+  page_cache_archive_t *cached;  // NULL if there is no page cache
+} source_entry_t;
+
+/// what a source entry turns into, a double page becomes two pages
+typedef struct {
+  zip_blob_t     blobs[2];
+  uint32_t       count;
+  entry_source_e source;
+  char           ext[5];
+  uint64_t       progressive_size; // of the source, if it was made baseline
+  bool           failed; // the entry could not be read, nothing is written
+} cbz_page_t;
+
+/// what --baseline did in one run
+typedef struct {
+  uint32_t pages;
+  uint64_t progressive_bytes;
+  uint64_t baseline_bytes;
+} baseline_stats_t;
+
+/// splits a double page into its left and right half with a single decode,
+/// buffer is freed. A spread that can not be split marks the page as failed,
+/// so the ids after it do not shift
+static void _split_cbz_page(const cli_flags_t *cli_flags, photo_t photo,
+                            uint8_t *buffer, uint64_t buffer_size,
+                            time_t mtime, cbz_page_t *page) {
+  bool     wanted[2] = {true, true};
+  uint8_t *halves[2];
+  uint64_t sizes[2];
+  bool     split_ok = _split_image_halves(cli_flags, photo, buffer,
+                                          buffer_size, wanted, halves, sizes);
+  freev(*cli_flags, buffer, "buffer", -1);
+  if (!split_ok) {
+    printfv(*cli_flags, RED, "Failed to split %s\n", photo.name);
+    page->failed = true;
+    return;
   }
-  freev(*cli_flags, photos, "photos", -1);
+
+  page->source = ENTRY_SOURCE_ENCODED;
+  compression_choice_t choice = choose_compression(cli_flags);
+  // the blobs take ownership of the buffers
+  bool ok = zip_blob_from_buffer(&page->blobs[0], halves[0], sizes[0], choice);
+  ok = zip_blob_from_buffer(&page->blobs[1], halves[1], sizes[1], choice) && ok;
+  if (!ok) {
+    printfv(*cli_flags, RED, "Failed to compress the halves of %s\n",
+            photo.name);
+    zip_blob_free(&page->blobs[0]);
+    zip_blob_free(&page->blobs[1]);
+    page->failed = true;
+    return;
+  }
+  page->blobs[0].mtime = mtime;
+  page->blobs[1].mtime = mtime;
+  page->count          = 2;
+}
+
+/// trims the borders of a page that is not split. The page is only replaced
+/// if the crop is worth it, otherwise it goes on to be copied as it is, so
+/// contents is always the whole entry afterwards. source is freed on success
+static bool _autocrop_cbz_page(const cli_flags_t *cli_flags, photo_t photo,
+                               zip_blob_t *source, uint8_t **contents,
+                               uint64_t *contents_size, bool *complete,
+                               cbz_page_t *page) {
+  if (!*complete) {
+    free(*contents);
+    *contents = NULL;
+    *complete = zip_blob_inflate(source, UINT64_MAX, contents, contents_size);
+    if (!*complete) {
+      return false;
+    }
+  }
+  uint8_t *cropped;
+  uint64_t cropped_size;
+  if (!_autocrop_image(cli_flags, photo, *contents, *contents_size, &cropped,
+                       &cropped_size)) {
+    return false;
+  }
+  free(*contents);
+  time_t mtime = source->mtime;
+  zip_blob_free(source);
+
+  page->source = ENTRY_SOURCE_ENCODED;
+  // the blob takes ownership of the buffer
+  if (!zip_blob_from_buffer(&page->blobs[0], cropped, cropped_size,
+                            choose_compression(cli_flags))) {
+    printfv(*cli_flags, RED, "Failed to compress %s\n", photo.name);
+    page->failed = true;
+    return true;
+  }
+  page->blobs[0].mtime = mtime;
+  page->count          = 1;
+  return true;
+}
+
+/// rewrites a progressive page that is not split as a baseline one, other
+/// pages are left alone. contents is read further only as far as it takes to
+/// tell, complete says if it holds the whole entry afterwards. source is
+/// freed on success
+static bool _normalize_cbz_page(const cli_flags_t *cli_flags, const char *name,
+                                zip_blob_t *source, uint8_t **contents,
+                                uint64_t *contents_size, bool *complete,
+                                cbz_page_t *page) {
+  if (!*contents &&
+      !zip_blob_inflate(source, PROBE_HEADER_SIZE, contents, contents_size)) {
+    return false;
+  }
+  image_info_t   info;
+  probe_status_e status =
+      probe_image_header(*contents, *contents_size, &info);
+  if (status == PROBE_NEEDS_FULL_READ && !*complete) {
+    free(*contents);
+    *contents = NULL;
+    *complete = zip_blob_inflate(source, UINT64_MAX, contents, contents_size);
+    if (!*complete) {
+      return false;
+    }
+    status = probe_image_header(*contents, *contents_size, &info);
+  }
+  if (status != PROBE_OK || !info.progressive) {
+    return false;
+  }
+
+  if (!*complete) {
+    free(*contents);
+    *contents = NULL;
+    *complete = zip_blob_inflate(source, UINT64_MAX, contents, contents_size);
+    if (!*complete) {
+      return false;
+    }
+  }
+  uint8_t *baseline;
+  uint64_t baseline_size;
+  if (!_jpeg_to_baseline(cli_flags, *contents, *contents_size, &baseline,
+                         &baseline_size)) {
+    printfv(*cli_flags, RED, "Failed to make %s baseline, it is kept as is\n",
+            name);
+    return false;
+  }
+  printfv(*cli_flags, DARK_GREEN, "Made %s baseline\n", name);
+  free(*contents);
+  time_t mtime = source->mtime;
+  zip_blob_free(source);
+
+  page->source           = ENTRY_SOURCE_ENCODED;
+  page->progressive_size = *contents_size;
+  // the blob takes ownership of the buffer
+  if (!zip_blob_from_buffer(&page->blobs[0], baseline, baseline_size,
+                            choose_compression(cli_flags))) {
+    printfv(*cli_flags, RED, "Failed to compress %s\n", name);
+    page->failed = true;
+    return true;
+  }
+  page->blobs[0].mtime = mtime;
+  page->count          = 1;
+  return true;
+}
+
+/// classifies an entry from the bytes that were read out of the source
+/// archive, only the header is inflated unless it cannot be probed. contents
+/// is set to what was inflated
+static bool _classify_cbz_page(const cli_flags_t *cli_flags, const char *name,
+                               const zip_blob_t *source,
+                               page_cache_page_t *meta, uint8_t **contents,
+                               uint64_t *contents_size) {
+  if (!zip_blob_inflate(source, PROBE_HEADER_SIZE, contents, contents_size)) {
+    printfv(*cli_flags, RED, "Failed to read %s\n", name);
+    return false;
+  }
+
+  image_info_t   info;
+  probe_status_e status =
+      probe_image_header(*contents, *contents_size, &info);
+  if (status == PROBE_NEEDS_FULL_READ &&
+      *contents_size < source->uncompressed_size) {
+    printfv(*cli_flags, DARK_YELLOW,
+            "Header of %s could not be probed, reading the whole entry\n",
+            name);
+    free(*contents);
+    if (!zip_blob_inflate(source, UINT64_MAX, contents, contents_size)) {
+      printfv(*cli_flags, RED, "Failed to read %s\n", name);
+      return false;
+    }
+    status = probe_image_header(*contents, *contents_size, &info);
+  }
+
+  meta->type = IMAGE_TYPE_UNKNOWN;
+  if (_get_width_height_and_type(cli_flags, status, &info, &meta->width,
+                                 &meta->height, &meta->type, *contents,
+                                 *contents_size)) {
+    meta->double_page = (meta->width > meta->height) ? DOUBLE_PAGE_TRUE
+                                                     : DOUBLE_PAGE_FALSE;
+  }
+  return true;
+}
+
+/// turns an entry into its pages, nothing is read from the archive again. If
+/// known is true meta came from the page cache and the entry is not probed
+/// at all, otherwise meta is filled in
+static bool _handle_cbz_page(const cli_flags_t *cli_flags, const char *name,
+                             zip_blob_t *source, bool known,
+                             page_cache_page_t *meta, cbz_page_t *page) {
+  uint8_t *contents      = NULL;
+  uint64_t contents_size = 0;
+  if (!known && !_classify_cbz_page(cli_flags, name, source, meta, &contents,
+                                    &contents_size)) {
+    zip_blob_free(source);
+    return false;
+  }
+  if (meta->type == IMAGE_TYPE_UNKNOWN) {
+    free(contents); // not an image
+    zip_blob_free(source);
+    return true;
+  }
+  bool complete = contents && contents_size == source->uncompressed_size;
+
+  snprintf(page->ext, sizeof(page->ext), "%s", _image_type_ext(meta->type));
+  photo_t photo = {.name        = (char *)name,
+                   .ext         = page->ext,
+                   .width       = meta->width,
+                   .height      = meta->height,
+                   .double_page = meta->double_page};
+  compression_choice_t choice =
+      choose_passthrough_compression(cli_flags, source->method);
+  if (photo.double_page == DOUBLE_PAGE_FALSE &&
+      cli_flags->autocrop_mode == AUTOCROP_ENABLED &&
+      _autocrop_cbz_page(cli_flags, photo, source, &contents, &contents_size,
+                         &complete, page)) {
+    return true;
+  }
+  if (photo.double_page == DOUBLE_PAGE_FALSE &&
+      meta->type == IMAGE_TYPE_JPEG &&
+      cli_flags->baseline_mode != BASELINE_DISABLED &&
+      _normalize_cbz_page(cli_flags, name, source, &contents, &contents_size,
+                          &complete, page)) {
+    return true;
+  }
+  if (photo.double_page == DOUBLE_PAGE_FALSE &&
+      choice.method == source->method) {
+    // unsplit pages never change, so their compressed bytes, crc and sizes
+    // are copied straight from the source archive
+    free(contents);
+    page->source   = ENTRY_SOURCE_PASSTHROUGH;
+    page->blobs[0] = *source;
+    page->count    = 1;
+    printfv(*cli_flags, DARK_GREEN, "Copied %s without recompressing\n", name);
+    return true;
+  }
+
+  if (!complete) {
+    free(contents);
+    if (!zip_blob_inflate(source, UINT64_MAX, &contents, &contents_size)) {
+      printfv(*cli_flags, RED, "Failed to read %s\n", name);
+      zip_blob_free(source);
+      page->failed = true;
+      return true;
+    }
+  }
+  time_t mtime = source->mtime;
+  zip_blob_free(source);
+
+  if (photo.double_page != DOUBLE_PAGE_FALSE) {
+    _split_cbz_page(cli_flags, photo, contents, contents_size, mtime, page);
+    return true;
+  }
+
+  page->source = ENTRY_SOURCE_RECOMPRESSED;
+  // the blob takes ownership of the buffer
+  if (!zip_blob_from_buffer(&page->blobs[0], contents, contents_size,
+                            choose_compression(cli_flags))) {
+    printfv(*cli_flags, RED, "Failed to compress %s\n", name);
+    page->failed = true;
+    return true;
+  }
+  page->blobs[0].mtime = mtime;
+  page->count          = 1;
+  return true;
+}
+
+typedef struct {
+  const cli_flags_t    *cli_flags;
+  const file_entry_t   *sorted_files;
+  const source_entry_t *entries;
+  page_cache_t         *cache;
+  archive_pool_t       *pool;  // shared by every worker
+  cbz_page_t           *pages; // ring of window slots
+  uint32_t              window;
+  uint32_t              next_id;
+  zip_writer_t         *writer;
+  compression_stats_t   stats;
+  baseline_stats_t      baseline;
+} cbz_output_ctx_t;
+
+/// the names zip_stat_index gives point into src_zip, so it stays leased until
+/// the page is done. An entry that can not be read marks the page as failed
+static void _make_cbz_page(cbz_output_ctx_t *out, const source_entry_t *entry,
+                           zip_t *src_zip, const char *cbz_path,
+                           cbz_page_t *page) {
+  zip_stat_t zstat;
+  zip_stat_init(&zstat);
+  if (zip_stat_index(src_zip, entry->index, 0, &zstat) < 0) {
+    printfv(*out->cli_flags, RED, "Failed to stat entry %lu of %s\n",
+            (unsigned long)entry->index, cbz_path);
+    page->failed = true;
+    return;
+  }
+  if (!_is_plain_zip_entry(&zstat)) {
+    // there is no password to read it with, so it is skipped like before
+    printfv(*out->cli_flags, DARK_YELLOW, "Skipping encrypted %s in %s\n",
+            zstat.name, cbz_path);
+    return;
+  }
+
+  page_cache_page_t meta  = {.index = entry->index, .crc = zstat.crc};
+  bool              known = page_cache_get(out->cache, entry->cached,
+                                           entry->index, zstat.crc, &meta);
+  if (known && meta.type == IMAGE_TYPE_UNKNOWN) {
+    return; // not an image, so it is not even read
+  }
+
+  zip_blob_t source;
+  if (!_read_zip_entry_blob(out->cli_flags, src_zip, entry->index, &zstat,
+                            &source)) {
+    printfv(*out->cli_flags, RED, "Failed to read %s within %s\n", zstat.name,
+            cbz_path);
+    page->failed = true;
+    return;
+  }
+  if (!_handle_cbz_page(out->cli_flags, zstat.name, &source, known, &meta,
+                        page)) {
+    page->failed = true;
+  } else if (!known) {
+    page_cache_put(out->cache, entry->cached, &meta);
+  }
+}
+
+static void _make_cbz_page_job(void *ctx, uint32_t index, uint32_t worker) {
+  cbz_output_ctx_t     *out   = (cbz_output_ctx_t *)ctx;
+  const source_entry_t *entry = &out->entries[index];
+  cbz_page_t           *page  = &out->pages[index % out->window];
+  const char *cbz_path = out->sorted_files[entry->archive].filename;
+
+  memset(page, 0, sizeof(*page));
+  zip_t *src_zip = archive_pool_get(out->cli_flags, out->pool, cbz_path);
+  if (!src_zip) {
+    page->failed = true;
+    return;
+  }
+  _make_cbz_page(out, entry, src_zip, cbz_path, page);
+  archive_pool_put(out->pool, src_zip);
+}
+
+/// called in entry order, the pages are named and written right away so the
+/// ids match a full scan followed by _reorder_double_page_photos
+static void _write_cbz_page(void *ctx, uint32_t index) {
+  cbz_output_ctx_t *out  = (cbz_output_ctx_t *)ctx;
+  cbz_page_t       *page = &out->pages[index % out->window];
+
+  // a page that is missing would shift every page after it, so the output
+  // is dropped instead
+  if (page->failed) {
+    out->writer->failed = true;
+  }
+
+  if (page->progressive_size && page->count == 1) {
+    out->baseline.pages++;
+    out->baseline.progressive_bytes += page->progressive_size;
+    out->baseline.baseline_bytes    += page->blobs[0].uncompressed_size;
+  }
+  for (uint32_t i = 0; i < page->count; i++) {
+    zip_blob_t *blob = &page->blobs[i];
+    char        new_filename[PATH_MAX];
+    snprintf(new_filename, PATH_MAX, "%05u%s", out->next_id++, page->ext);
+    zip_writer_add(out->cli_flags, out->writer, new_filename, blob);
+    compression_stats_add(&out->stats, page->source, blob->method,
+                          blob->uncompressed_size, blob->size);
+    zip_blob_free(blob);
+  }
+  page->count = 0;
+}
+
+static void _print_baseline_report(const cli_flags_t      *cli_flags,
+                                   const baseline_stats_t *stats) {
+  int64_t delta =
+      (int64_t)stats->progressive_bytes - (int64_t)stats->baseline_bytes;
+  printfv(*cli_flags, BLUE,
+          "Made %u progressive pages baseline: %llu -> %llu bytes (%s %llu "
+          "bytes)\n",
+          stats->pages, (unsigned long long)stats->progressive_bytes,
+          (unsigned long long)stats->baseline_bytes,
+          delta >= 0 ? "saved" : "cost", (unsigned long long)llabs(delta));
+}
+
+/// lists every entry of the archives from first_file on, only the central
+/// directories are read. The archives are opened in pool so they are not
+/// opened again later
+static source_entry_t *_list_cbz_entries(const cli_flags_t  *cli_flags,
+                                         page_cache_t       *cache,
+                                         const file_entry_t *sorted_files,
+                                         uint32_t            first_file,
+                                         uint32_t            file_count,
+                                         archive_pool_t     *pool,
+                                         uint32_t           *entry_count) {
+  uint32_t        len     = 64;
+  source_entry_t *entries = (source_entry_t *)mallocv(
+      *cli_flags, "entries", len * sizeof(source_entry_t), -1);
+  *entry_count = 0;
+  for (uint32_t i = first_file; entries && i < file_count; i++) {
+    // an archive that can not be opened would be missing from the output
+    zip_t *src_zip =
+        archive_pool_get(cli_flags, pool, sorted_files[i].filename);
+    if (!src_zip) {
+      freev(*cli_flags, entries, "entries", -1);
+      return NULL;
+    }
+
+    page_cache_archive_t *cached =
+        page_cache_archive(cli_flags, cache, sorted_files[i].filename);
+    zip_int64_t num_entries = zip_get_num_entries(src_zip, 0);
+    for (zip_int64_t j = 0; j < num_entries; j++) {
+      // reallocv keeps the old pointer when it fails, so the list is grown
+      // with mallocv and a copy
+      if (*entry_count >= len) {
+        len                 *= 2;
+        source_entry_t *tmp  = (source_entry_t *)mallocv(
+            *cli_flags, "entries", len * sizeof(source_entry_t), -1);
+        if (!tmp) {
+          archive_pool_put(pool, src_zip);
+          freev(*cli_flags, entries, "entries", -1);
+          return NULL;
+        }
+        memcpy(tmp, entries, *entry_count * sizeof(source_entry_t));
+        freev(*cli_flags, entries, "entries", -1);
+        entries = tmp;
+      }
+      entries[*entry_count].archive = i;
+      entries[*entry_count].index   = (zip_uint64_t)j;
+      entries[*entry_count].cached  = cached;
+      (*entry_count)++;
+    }
+    archive_pool_put(pool, src_zip);
+  }
+  return entries;
+}
+
+/// where the items of a dedup pass are, every item is an entry of an archive
+typedef struct {
+  const cli_flags_t  *cli_flags;
+  archive_pool_t     *pool;
+  const char        **cbz_paths;
+  const zip_uint64_t *indexes;
+} dedup_source_t;
+
+/// hashes an entry while it is inflated, it is never held in memory whole
+static bool _hash_zip_entry(void *ctx, uint32_t item,
+                            uint8_t digest[SHA256_DIGEST_SIZE]) {
+  dedup_source_t *source = (dedup_source_t *)ctx;
+  zip_t          *src_zip = archive_pool_get(source->cli_flags, source->pool,
+                                             source->cbz_paths[item]);
+  zip_file_t *zfile =
+      src_zip ? zip_fopen_index(src_zip, source->indexes[item], 0) : NULL;
+  if (!zfile) {
+    archive_pool_put(source->pool, src_zip);
+    return false;
+  }
+
+  sha256_t sha;
+  sha256_init(&sha);
+  uint8_t     chunk[DEDUP_CHUNK_SIZE];
+  zip_int64_t bytes_read;
+  while ((bytes_read = zip_fread(zfile, chunk, sizeof(chunk))) > 0) {
+    sha256_update(&sha, chunk, (size_t)bytes_read);
+  }
+  zip_fclose(zfile);
+  archive_pool_put(source->pool, src_zip);
+  sha256_final(&sha, digest);
+  return bytes_read == 0; // libzip fails the last read on a crc mismatch
+}
+
+/// finds the entries that are a copy of an entry in an earlier archive, the
+/// items have to be ordered by archive. Only images are compared, entries the
+/// page cache does not know are probed and added to it. Every drop is logged
+/// and written to cli_flags->dedup_report
+static uint32_t *_find_duplicates(const cli_flags_t *cli_flags,
+                                  page_cache_t *cache, archive_pool_t *pool,
+                                  const char        **cbz_paths,
+                                  const zip_uint64_t *indexes, uint32_t count,
+                                  uint32_t *dropped) {
+  dedup_key_t *keys = (dedup_key_t *)callocv(*cli_flags, "keys",
+                                             MAX(count, 1),
+                                             sizeof(dedup_key_t), -1);
+  if (!keys) {
+    return NULL;
+  }
+
+  page_cache_archive_t *cached = NULL;
+  uint32_t              group  = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (i == 0 || strcmp(cbz_paths[i], cbz_paths[i - 1]) != 0) {
+      group  += i > 0;
+      cached  = page_cache_archive(cli_flags, cache, cbz_paths[i]);
+    }
+    keys[i].group = group;
+
+    zip_t     *src_zip = archive_pool_get(cli_flags, pool, cbz_paths[i]);
+    zip_stat_t zstat;
+    zip_stat_init(&zstat);
+    bool found = src_zip && zip_stat_index(src_zip, indexes[i], 0, &zstat) == 0;
+
+    page_cache_page_t meta = {.index = indexes[i], .crc = zstat.crc};
+    if (found && !page_cache_get(cache, cached, indexes[i], zstat.crc, &meta)) {
+      found = _probe_zip_entry(cli_flags, src_zip, &zstat, &meta);
+      if (found) {
+        page_cache_put(cache, cached, &meta);
+      }
+    }
+    archive_pool_put(pool, src_zip);
+    if (!found || meta.type == IMAGE_TYPE_UNKNOWN) {
+      continue; // not an image, so it is never written anyway
+    }
+    keys[i].crc  = zstat.crc;
+    keys[i].size = zstat.size;
+  }
+
+  dedup_source_t source = {.cli_flags = cli_flags,
+                           .pool      = pool,
+                           .cbz_paths = cbz_paths,
+                           .indexes   = indexes};
+  uint32_t      *duplicate_of =
+      dedup_find(cli_flags, keys, count, _hash_zip_entry, &source, dropped);
+  freev(*cli_flags, keys, "keys", -1);
+  if (!duplicate_of) {
+    return NULL;
+  }
+
+  FILE *report = NULL;
+  if (cli_flags->dedup_report) {
+    report = fopen(cli_flags->dedup_report, "w");
+    if (report) {
+      fprintf(report, "# dropped archive\tdropped entry\tkept archive\t"
+                      "kept entry\n");
+    } else {
+      printfv(*cli_flags, RED, "Failed to open the dedup report %s\n",
+              cli_flags->dedup_report);
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t kept = duplicate_of[i];
+    if (kept == DEDUP_KEPT) {
+      continue;
+    }
+    // the names point into the archives, so both stay leased until they
+    // are printed
+    zip_t      *zip       = archive_pool_get(cli_flags, pool, cbz_paths[i]);
+    zip_t      *kept_zip  = archive_pool_get(cli_flags, pool, cbz_paths[kept]);
+    const char *name      = zip ? zip_get_name(zip, indexes[i], 0) : NULL;
+    const char *kept_name =
+        kept_zip ? zip_get_name(kept_zip, indexes[kept], 0) : NULL;
+    name      = name ? name : "?";
+    kept_name = kept_name ? kept_name : "?";
+    printfv(*cli_flags, DARK_YELLOW, "Dropping %s in %s, it is %s in %s\n",
+            name, cbz_paths[i], kept_name, cbz_paths[kept]);
+    if (report) {
+      fprintf(report, "%s\t%s\t%s\t%s\n", cbz_paths[i], name,
+              cbz_paths[kept], kept_name);
+    }
+    archive_pool_put(pool, zip);
+    archive_pool_put(pool, kept_zip);
+  }
+  if (report) {
+    fclose(report);
+  }
+  return duplicate_of;
+}
+
+/// removes the entries that are a copy of an entry in an earlier archive
+static void _drop_duplicate_entries(const cli_flags_t  *cli_flags,
+                                    page_cache_t       *cache,
+                                    const file_entry_t *sorted_files,
+                                    archive_pool_t     *pool,
+                                    source_entry_t     *entries,
+                                    uint32_t           *entry_count) {
+  const char **cbz_paths = (const char **)mallocv(
+      *cli_flags, "cbz_paths", MAX(*entry_count, 1) * sizeof(char *), -1);
+  zip_uint64_t *indexes = (zip_uint64_t *)mallocv(
+      *cli_flags, "indexes", MAX(*entry_count, 1) * sizeof(zip_uint64_t), -1);
+  uint32_t  dropped      = 0;
+  uint32_t *duplicate_of = NULL;
+  if (cbz_paths && indexes) {
+    for (uint32_t i = 0; i < *entry_count; i++) {
+      cbz_paths[i] = sorted_files[entries[i].archive].filename;
+      indexes[i]   = entries[i].index;
+    }
+    duplicate_of = _find_duplicates(cli_flags, cache, pool, cbz_paths,
+                                    indexes, *entry_count, &dropped);
+  }
+  if (!duplicate_of) {
+    printfv(*cli_flags, RED, "Failed to look for duplicate pages\n");
+  } else {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < *entry_count; i++) {
+      if (duplicate_of[i] == DEDUP_KEPT) {
+        entries[kept++] = entries[i];
+      }
+    }
+    *entry_count = kept;
+    printfv(*cli_flags, BLUE, "Dropped %u duplicate pages\n", dropped);
+  }
+  freev(*cli_flags, cbz_paths, "cbz_paths", -1);
+  freev(*cli_flags, indexes, "indexes", -1);
+  freev(*cli_flags, duplicate_of, "duplicate_of", -1);
+}
+
+/// removes the entries of the archives before first_file, they are already
+/// in the output. The entries are in archive order
+static void _skip_written_entries(source_entry_t *entries,
+                                  uint32_t *entry_count, uint32_t first_file) {
+  uint32_t skipped = 0;
+  while (skipped < *entry_count && entries[skipped].archive < first_file) {
+    skipped++;
+  }
+  memmove(entries, entries + skipped,
+          (*entry_count - skipped) * sizeof(source_entry_t));
+  *entry_count -= skipped;
+}
+
+/// reads the chapter number of the last archive that an earlier run put in
+/// output_file (it is kept in the archive comment) and the next free page id
+static bool _read_output_cbz_state(const cli_flags_t *cli_flags,
+                                   const char        *output_file,
+                                   uint32_t *last_chapter, uint32_t *next_id) {
+  zip_t *zip = zip_open(output_file, ZIP_RDONLY, NULL);
+  if (!zip) {
+    return false;
+  }
+
+  int         comment_len = 0;
+  const char *comment =
+      zip_get_archive_comment(zip, &comment_len, ZIP_FL_ENC_RAW);
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*s", comment ? comment_len : 0,
+           comment ? comment : "");
+  bool ok = sscanf(buffer, OUTPUT_COMMENT_PREFIX "%u", last_chapter) == 1;
+
+  // the pages are named %05u<ext>
+  *next_id                = 0;
+  zip_int64_t num_entries = zip_get_num_entries(zip, 0);
+  for (zip_int64_t i = 0; ok && i < num_entries; i++) {
+    const char *name = zip_get_name(zip, i, ZIP_FL_ENC_RAW);
+    char       *end  = NULL;
+    uint32_t    id   = name ? (uint32_t)strtoul(name, &end, 10) : 0;
+    if (end != name) {
+      *next_id = MAX(*next_id, id + 1);
+    }
+  }
+  zip_discard(zip);
+  return ok;
+}
+
+/// opens the output, in append mode an output from an earlier run is kept
+/// and first_file and next_id are set to where that run stopped. Otherwise
+/// (or if the output cannot be appended to) it is rebuilt from the start
+static bool _open_output_cbz(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                             const file_entry_t *sorted_files,
+                             uint32_t file_count, const char *output_file,
+                             uint32_t *first_file, uint32_t *next_id) {
+  *first_file = 0;
+  *next_id    = 0;
+  if (cli_flags->append_mode != APPEND_ENABLED || !is_file(output_file)) {
+    return zip_writer_open(cli_flags, writer, output_file);
+  }
+
+  uint32_t last_chapter = 0;
+  if (!_read_output_cbz_state(cli_flags, output_file, &last_chapter,
+                              next_id)) {
+    printfv(*cli_flags, RED,
+            "%s was not made by this program, it will be rebuilt\n",
+            output_file);
+    *next_id = 0;
+    return zip_writer_open(cli_flags, writer, output_file);
+  }
+
+  // sorted_files is in chapter order, so everything up to last_chapter is
+  // already in the output
+  while (*first_file < file_count &&
+         sorted_files[*first_file].number <= last_chapter) {
+    (*first_file)++;
+  }
+  printfv(*cli_flags, DARK_GREEN,
+          "%s has chapters up to %u, appending %u archives from page %u\n",
+          output_file, last_chapter, file_count - *first_file, *next_id);
+  if (zip_writer_open_append(cli_flags, writer, output_file)) {
+    return true;
+  }
+
+  *first_file = 0;
+  *next_id    = 0;
+  return zip_writer_open(cli_flags, writer, output_file);
+}
+
+/// every source entry is read once, classified, split and compressed on the
+/// worker pool and streamed to the output as soon as the entries before it
+/// are written. No page needs the others, so there is no separate scan and at
+/// most cli_flags->window entries are held in memory
+static void _make_output_cbz(const cli_flags_t  *cli_flags,
+                             page_cache_t       *cache,
+                             const file_entry_t *sorted_files,
+                             uint32_t file_count, const char *output_file) {
+  zip_writer_t writer;
+  uint32_t     first_file, next_id;
+  if (!_open_output_cbz(cli_flags, &writer, sorted_files, file_count,
+                        output_file, &first_file, &next_id)) {
+    return;
+  }
+
+  uint32_t         jobs = MAX(cli_flags->jobs, 1);
+  archive_pool_t   pool;
+  cbz_output_ctx_t out = {.cli_flags    = cli_flags,
+                          .sorted_files = sorted_files,
+                          .cache        = cache,
+                          .pool         = &pool,
+                          .window       = MAX(cli_flags->window, 1),
+                          .next_id      = next_id,
+                          .writer       = &writer};
+  out.pages = (cbz_page_t *)callocv(*cli_flags, "pages", out.window,
+                                    sizeof(cbz_page_t), -1);
+  // every worker leases one archive at a time, looking for duplicates leases
+  // two
+  bool pooled = archive_pool_init(cli_flags, &pool, MAX(jobs, 2));
+  if (pooled && out.pages) {
+    // the workers reuse the archives opened here
+    // when appending, the pages already in the output still count as the
+    // earlier copies, so the archives they came from are listed as well and
+    // dedup drops the same pages a full rebuild would
+    bool            dedup       = cli_flags->dedup_mode == DEDUP_ENABLED;
+    uint32_t        entry_count = 0;
+    source_entry_t *entries =
+        _list_cbz_entries(cli_flags, cache, sorted_files,
+                          dedup ? 0 : first_file, file_count, &pool,
+                          &entry_count);
+    if (entries && dedup) {
+      _drop_duplicate_entries(cli_flags, cache, sorted_files, &pool, entries,
+                              &entry_count);
+      _skip_written_entries(entries, &entry_count, first_file);
+    }
+    if (entries) {
+      out.entries = entries;
+      run_ordered(jobs, entry_count, out.window, _make_cbz_page_job,
+                  _write_cbz_page, &out);
+      print_compression_report(cli_flags, &out.stats);
+      if (cli_flags->baseline_mode != BASELINE_DISABLED) {
+        _print_baseline_report(cli_flags, &out.baseline);
+      }
+      freev(*cli_flags, entries, "entries", -1);
+    } else {
+      // an archive that is left out would be missing from the output, so
+      // nothing is written at all
+      printfv(*cli_flags, RED, "Failed to list the source entries\n");
+      writer.failed = true;
+    }
+  } else {
+    printfv(*cli_flags, RED, "Failed to allocate memory for the output\n");
+    writer.failed = true;
+  }
+  archive_pool_close(cli_flags, &pool);
+
+  // a full rebuild writes the same comment, so appending gives the same bytes
+  if (file_count > 0) {
+    char comment[64];
+    snprintf(comment, sizeof(comment), OUTPUT_COMMENT_PREFIX "%u",
+             sorted_files[file_count - 1].number);
+    zip_writer_set_comment(&writer, comment);
+  }
+  zip_writer_close(cli_flags, &writer);
+
+  freev(*cli_flags, out.pages, "pages", -1);
+}
+
+static photo_t _deep_copy_photo(const photo_t *src) {
+  photo_t copy;
+  copy.cbz_path    = strdup(src->cbz_path);
+  copy.name        = strdup(src->name);
+  copy.ext         = strdup(src->ext);
+  copy.width       = src->width;
+  copy.height      = src->height;
+  copy.id          = src->id;
+  copy.index       = src->index;
+  copy.double_page = src->double_page;
+  return copy;
+}
+
+static void _reorder_double_page_photos(const cli_flags_t *cli_flags,
+                                        photo_t          **photos,
+                                        uint32_t          *photo_counter) {
+  for (uint32_t i = 0; i < *photo_counter; i++) {
+    if ((*photos)[i].double_page == DOUBLE_PAGE_FALSE) {
+      continue;
+    }
+    if ((*photos)[i].double_page == DOUBLE_PAGE_TRUE) {
+      *photos = realloc(*photos, sizeof(photo_t) * (*photo_counter + 1));
+      for (uint32_t j = *photo_counter; j > i + 1; j--) {
+        (*photos)[j] = (*photos)[j - 1]; // shift photos down by one
+        (*photos)[j].id++;
+      }
+      (*photos)[i + 1]              = _deep_copy_photo(&(*photos)[i]);
+      (*photos)[i + 1].id          += 1;
+      (*photos)[i + 1].double_page  = DOUBLE_PAGE_RIGHT;
+      (*photos)[i].double_page      = DOUBLE_PAGE_LEFT;
+      (*photo_counter)++;
+      i++; // skip the new photo to avoid reprocessing
+    }
+  }
+}
+
+/// removes the photos that are a copy of a photo in an earlier archive, the
+/// ids are given out again so they stay in order
+static void _drop_duplicate_photos(const cli_flags_t *cli_flags,
+                                   page_cache_t *cache, photo_t *photos,
+                                   uint32_t *photo_counter) {
+  const char **cbz_paths = (const char **)mallocv(
+      *cli_flags, "cbz_paths", MAX(*photo_counter, 1) * sizeof(char *), -1);
+  zip_uint64_t *indexes = (zip_uint64_t *)mallocv(
+      *cli_flags, "indexes", MAX(*photo_counter, 1) * sizeof(zip_uint64_t),
+      -1);
+  archive_pool_t pool;
+  uint32_t       dropped      = 0;
+  uint32_t      *duplicate_of = NULL;
+  // _find_duplicates leases two archives at once
+  if (archive_pool_init(cli_flags, &pool, 2) && cbz_paths && indexes) {
+    for (uint32_t i = 0; i < *photo_counter; i++) {
+      cbz_paths[i] = photos[i].cbz_path;
+      indexes[i]   = photos[i].index;
+    }
+    duplicate_of = _find_duplicates(cli_flags, cache, &pool, cbz_paths,
+                                    indexes, *photo_counter, &dropped);
+  }
+  archive_pool_close(cli_flags, &pool);
+
+  if (!duplicate_of) {
+    printfv(*cli_flags, RED, "Failed to look for duplicate pages\n");
+  } else {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < *photo_counter; i++) {
+      if (duplicate_of[i] != DEDUP_KEPT) {
+        freev(*cli_flags, photos[i].cbz_path, "photos[].cbz_path", i);
+        freev(*cli_flags, photos[i].name, "photos[].name", i);
+        freev(*cli_flags, photos[i].ext, "photos[].ext", i);
+        continue;
+      }
+      photos[kept]    = photos[i];
+      photos[kept].id = kept;
+      kept++;
+    }
+    *photo_counter = kept;
+    printfv(*cli_flags, BLUE, "Dropped %u duplicate pages\n", dropped);
+  }
+  freev(*cli_flags, cbz_paths, "cbz_paths", -1);
+  freev(*cli_flags, indexes, "indexes", -1);
+  freev(*cli_flags, duplicate_of, "duplicate_of", -1);
+}
+
+static bool _str_ends_with(const char *str, const char *suffix) {
+  if (!str || !suffix) {
+    return false;
+  }
+
+  size_t str_len    = strlen(str);
+  size_t suffix_len = strlen(suffix);
+
+  if (suffix_len > str_len) {
+    return false;
+  }
+
+  const char *start_pos = str + str_len - suffix_len;
+
+  return strcmp(start_pos, suffix) == 0;
+}
+
+static void _make_output_pdf(const cli_flags_t *cli_flags, photo_t *photos,
+                             uint32_t photos_count, const char *output_file) {
+  /* INIT */
+  pdf_writer_t pdf;
+  if (!pdf_writer_open(cli_flags, &pdf, output_file)) {
+    return;
+  }
+
+  /* REORDER */
+  // the sheets are mapped to their photos when they are prepared, so the
+  // printed order is never built
+  imposition_t imposition;
+  if (!imposition_init(cli_flags, &imposition, photos, photos_count,
+                       cli_flags->signature)) {
+    printfv(*cli_flags, RED, "Failed to allocate memory for the imposition\n");
+    pdf.failed = true;
+    pdf_writer_close(cli_flags, &pdf);
+    return;
+  }
+
+  /* WRITE IMAGES */
+  // sheets are prepared on the worker pool and written in order, at most
+  // cli_flags->window of them are held in memory
+  uint32_t         jobs = MAX(cli_flags->jobs, 1);
+  split_cache_t    split_cache;
+  pdf_output_ctx_t out = {.cli_flags   = cli_flags,
+                          .photos      = photos,
+                          .photo_count = photos_count,
+                          .imposition  = &imposition,
+                          .split_cache = &split_cache,
+                          .window      = MAX(cli_flags->window, 1),
+                          .pdf         = &pdf};
+  // every sheet in flight splits at most two spreads
+  bool      cached   = split_cache_init(cli_flags, &split_cache,
+                                        4 * out.window);
+  uint32_t *entry_of = (uint32_t *)callocv(*cli_flags, "entry_of",
+                                           MAX(photos_count, 1),
+                                           sizeof(uint32_t), -1);
+  uint32_t *need     = (uint32_t *)callocv(*cli_flags, "need",
+                                           MAX(photos_count, 1),
+                                           sizeof(uint32_t), -1);
+  out.sheets = (pdf_sheet_t *)callocv(*cli_flags, "sheets", out.window,
+                                      sizeof(pdf_sheet_t), -1);
+  // one pool for every worker and the read ahead thread
+  archive_pool_t pool;
+  bool           pooled = archive_pool_init(cli_flags, &pool, jobs + 1);
+  out.pool              = &pool;
+  if (cached && entry_of && need && pooled && out.sheets) {
+    out.entry_of = entry_of;
+    out.need     = need;
+
+    // the sheets jump between the first and the last archive, so the pages
+    // are read in archive order by a thread of their own and handed to the
+    // sheets through a reorder buffer. Without it every sheet reads its own
+    reorder_buffer_t prefetched;
+    pthread_t        reader;
+    uint32_t         entry_count = _map_pdf_entries(
+        photos, photos_count, &imposition, entry_of, need);
+    if (reorder_buffer_init(cli_flags, &prefetched, entry_count, need,
+                            out.window,
+                            (uint64_t)cli_flags->read_buffer << 20)) {
+      out.prefetched = &prefetched;
+      if (pthread_create(&reader, NULL, _prefetch_pdf_pages, &out) != 0) {
+        reorder_buffer_free(cli_flags, &prefetched);
+        out.prefetched = NULL;
+      }
+    }
+
+    run_ordered(jobs, imposition_sheet_count(&imposition), out.window,
+                _prepare_pdf_sheet_job, _write_pdf_sheet, &out);
+
+    if (out.prefetched) {
+      pthread_join(reader, NULL);
+      if (prefetched.spilled > 0) {
+        printfv(*cli_flags, BLUE,
+                "Spilled %u read ahead pages to a temp file\n",
+                prefetched.spilled);
+      }
+      reorder_buffer_free(cli_flags, &prefetched);
+    }
+  } else {
+    printfv(*cli_flags, RED, "Failed to allocate memory for the output\n");
+    pdf.failed = true;
+  }
+  archive_pool_close(cli_flags, &pool);
+  split_cache_free(cli_flags, &split_cache);
+  freev(*cli_flags, entry_of, "entry_of", -1);
+  freev(*cli_flags, need, "need", -1);
+  freev(*cli_flags, out.sheets, "sheets", -1);
+  imposition_free(cli_flags, &imposition);
+
+  /* FINISH */
+  pdf_writer_close(cli_flags, &pdf);
+}
+
+void extract_and_combine_cbz(const cli_flags_t   *cli_flags,
+                             const file_entry_t **sorted_files,
+                             const char          *output_file,
+                             const uint32_t      *file_count) {
+  page_cache_t cache;
+  page_cache_load(cli_flags, &cache);
+
+  if (_str_ends_with(output_file, ".cbz")) {
+    // every cbz page is handled on its own, so it does not need the scan
+    _make_output_cbz(cli_flags, &cache, *sorted_files, *file_count,
+                     output_file);
+  } else {
+    uint32_t photo_counter = 0;
+    photo_t *photos = _scan_cbz_files(cli_flags, &cache, *sorted_files,
+                                      *file_count, &photo_counter);
+    if (photos == NULL) {
+      printfv(*cli_flags, RED, "Failed to allocate memory for photos\n");
+      page_cache_free(cli_flags, &cache);
+      return;
+    }
+
+    if (cli_flags->dedup_mode == DEDUP_ENABLED) {
+      _drop_duplicate_photos(cli_flags, &cache, photos, &photo_counter);
+    }
+
+    // increase since and rename for double photos being left and right
+    _reorder_double_page_photos(cli_flags, &photos, &photo_counter);
+
+    if (_str_ends_with(output_file, ".pdf")) {
+      _make_output_pdf(cli_flags, photos, photo_counter, output_file);
+    }
+
+    for (uint32_t i = 0; i < photo_counter; i++) {
+      freev(*cli_flags, photos[i].cbz_path, "photos[].cbz_path", i);
+      freev(*cli_flags, photos[i].name, "photos[].name", i);
+      freev(*cli_flags, photos[i].ext, "photos[].ext", i);
+    }
+    freev(*cli_flags, photos, "photos", -1);
+  }
+
+  page_cache_save(cli_flags, &cache);
+  page_cache_free(cli_flags, &cache);
 }
@@ -24,6 +24,39 @@ typedef enum {
   DOUBLE_PAGE_RIGHT,
 } double_page_mode_e;
 
+typedef enum {
+  COMPRESSION_POLICY_AUTO,    // store images, keep passthrough pages as is
+  COMPRESSION_POLICY_STORE,   // store everything
+  COMPRESSION_POLICY_DEFLATE, // deflate everything at compression_level
+} compression_policy_e;
+
+typedef enum {
+  APPEND_DISABLED,
+  APPEND_ENABLED,
+} append_mode_e;
+
+typedef enum {
+  CACHE_ENABLED,
+  CACHE_DISABLED,
+  CACHE_REBUILD, // ignore the cache file and write a new one
+} cache_mode_e;
+
+typedef enum {
+  DEDUP_DISABLED,
+  DEDUP_ENABLED, // drop pages that are a copy of a page in an earlier archive
+} dedup_mode_e;
+
+typedef enum {
+  AUTOCROP_DISABLED,
+  AUTOCROP_ENABLED, // trim the white borders of every page
+} autocrop_mode_e;
+
+typedef enum {
+  BASELINE_DISABLED,
+  BASELINE_ENABLED,   // rewrite progressive jpegs as baseline ones
+  BASELINE_OPTIMIZED, // and give every rewritten jpeg its own huffman tables
+} baseline_mode_e;
+
 // colors
 #define RED         "\033[38;5;9m"
 #define BLUE        "\033[38;5;12m"
@@ -33,8 +66,13 @@ typedef enum {
 #define RESET       "\033[0m"
 
 #define DEFAULT_OUTPUT_FILE_NAME "combined_output.cbz"
+#define DEFAULT_WINDOW_SIZE 64
+
+/// MiB of pages the pdf read ahead keeps in memory before it uses a temp file
+#define DEFAULT_READ_BUFFER_MB 256
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define print_error_s(code, s)                                                 \
   do {                                                                         \
@@ -62,6 +100,27 @@ typedef enum {
         "  -d,  --dirs          List all dirs (cannot be used with --files)\n"                              \
         "  -o,  --output        Specify output file (default is combined.cbz)\n"                            \
         "  -c, --color          Specify output to use color\n"                                              \
+        "  -a,  --append        Only add the chapters newer than the ones already in the output cbz\n"      \
+        "  -j,  --jobs <n>      Number of worker threads (default is 1)\n"                                  \
+        "  -w,  --window <n>    Max pages held in memory while writing (default is 64)\n"                   \
+        "       --dpi <n>       Shrink pdf images to n dots per inch (default keeps them as they are)\n"    \
+        "       --read-buffer <n>\n"                                                                        \
+        "                       MiB of pdf pages read ahead before a temp file is used (default is 256)\n"  \
+        "       --signature <n> Fold the pdf in signatures of n pages, a multiple of 4 (default is one)\n"  \
+        "  -z,  --compression <auto|store|deflate[:1-9]>\n"                                                 \
+        "                       Compression of cbz entries (default is auto, store images)\n"               \
+        "       --cache         Keep page metadata in ~/.cache/cbz-combiner/pages.cache between runs\n"     \
+        "       --cache-file <file>\n"                                                                      \
+        "                       Same as --cache with the metadata kept in file\n"                           \
+        "       --no-cache      Do not read or write the page cache (default)\n"                            \
+        "       --rebuild-cache Same as --cache but ignores the cache and writes a new one\n"               \
+        "       --dedup         Drop pages that are a copy of a page in an earlier archive\n"               \
+        "       --dedup-report <file>\n"                                                                    \
+        "                       Same as --dedup and lists every dropped page in file\n"                     \
+        "       --autocrop      Trim the white borders of every page\n"                                     \
+        "       --baseline      Rewrite progressive jpegs as baseline ones without losing quality\n"        \
+        "       --baseline-optimize\n"                                                                      \
+        "                       Same as --baseline and optimizes the huffman tables of rewritten jpegs\n"   \
         "\nBecause of how the cli is parsed color then verbose options should go first (for good logs)\n",  \
         argv[0]);                                                                                           \
   } while (0)
@@ -18,6 +18,7 @@ typedef struct {
   uint32_t           width;
   uint32_t           height;
   uint32_t           id;
+  uint64_t           index; // entry index inside cbz_path
   double_page_mode_e double_page;
 } photo_t;
 
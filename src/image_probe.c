@@ -0,0 +1,122 @@
+#include "image_probe.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint16_t _read_be16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t _read_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/// SOF0-SOF15 minus DHT (C4), JPG (C8) and DAC (CC)
+static bool _is_sof_marker(uint8_t marker) {
+  return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+         marker != 0xC8 && marker != 0xCC;
+}
+
+static probe_status_e _probe_png(const uint8_t *data, size_t size,
+                                 image_info_t *info) {
+  static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+  if (size < 8) {
+    return size > 0 && data[0] == signature[0] ? PROBE_NEEDS_FULL_READ
+                                               : PROBE_NOT_AN_IMAGE;
+  }
+  if (memcmp(data, signature, 8) != 0) {
+    return PROBE_NOT_AN_IMAGE;
+  }
+
+  // signature | length (4) | "IHDR" | width (4) | height (4)
+  if (size < 24) {
+    return PROBE_NEEDS_FULL_READ;
+  }
+  if (memcmp(data + 12, "IHDR", 4) != 0) {
+    return PROBE_NEEDS_FULL_READ; // let libpng deal with it
+  }
+
+  info->type   = IMAGE_TYPE_PNG;
+  info->width  = _read_be32(data + 16);
+  info->height = _read_be32(data + 20);
+  if (info->width == 0 || info->height == 0) {
+    return PROBE_NEEDS_FULL_READ;
+  }
+  return PROBE_OK;
+}
+
+static probe_status_e _probe_jpeg(const uint8_t *data, size_t size,
+                                  image_info_t *info) {
+  if (size < 2 || data[0] != 0xFF || data[1] != 0xD8) {
+    return PROBE_NOT_AN_IMAGE;
+  }
+
+  size_t pos = 2;
+  while (pos < size) {
+    if (data[pos] != 0xFF) {
+      return PROBE_NEEDS_FULL_READ; // garbage between markers
+    }
+    // any number of 0xFF fill bytes can come before the marker
+    while (pos < size && data[pos] == 0xFF) {
+      pos++;
+    }
+    if (pos >= size) {
+      break;
+    }
+    uint8_t marker = data[pos++];
+
+    // standalone markers have no length
+    if (marker == 0x01 || marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7)) {
+      continue;
+    }
+    // reached the image data (or the end) without seeing a frame header
+    if (marker == 0xD9 || marker == 0xDA) {
+      return PROBE_NEEDS_FULL_READ;
+    }
+
+    if (pos + 2 > size) {
+      break;
+    }
+    uint16_t length = _read_be16(data + pos);
+    if (length < 2) {
+      return PROBE_NEEDS_FULL_READ;
+    }
+
+    if (_is_sof_marker(marker)) {
+      // length (2) | precision (1) | height (2) | width (2)
+      if (pos + 7 > size) {
+        break;
+      }
+      info->type        = IMAGE_TYPE_JPEG;
+      info->height      = _read_be16(data + pos + 3);
+      info->width       = _read_be16(data + pos + 5);
+      info->progressive = (marker & 0x03) == 0x02; // SOF2, 6, 10 and 14
+      // a height of 0 means it is defined later by a DNL marker
+      if (info->width == 0 || info->height == 0) {
+        return PROBE_NEEDS_FULL_READ;
+      }
+      return PROBE_OK;
+    }
+    pos += length;
+  }
+
+  return PROBE_NEEDS_FULL_READ; // truncated
+}
+
+probe_status_e probe_image_header(const uint8_t *data, size_t size,
+                                  image_info_t *info) {
+  info->type        = IMAGE_TYPE_UNKNOWN;
+  info->width       = 0;
+  info->height      = 0;
+  info->progressive = false;
+
+  if (size == 0) {
+    return PROBE_NOT_AN_IMAGE;
+  }
+  if (data[0] == 0xFF) {
+    return _probe_jpeg(data, size, info);
+  }
+  return _probe_png(data, size, info);
+}
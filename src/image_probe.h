@@ -0,0 +1,45 @@
+#ifndef IMAGE_PROBE_H
+#define IMAGE_PROBE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// how many bytes of an entry are read before trying to probe it, this is
+/// enough for the SOFn marker of almost every jpeg and always enough for the
+/// png IHDR chunk
+#define PROBE_HEADER_SIZE 4096
+
+typedef enum {
+  IMAGE_TYPE_UNKNOWN,
+  IMAGE_TYPE_JPEG,
+  IMAGE_TYPE_PNG,
+} image_type_e;
+
+typedef enum {
+  PROBE_OK,
+  PROBE_NEEDS_FULL_READ, // header is truncated or unusual
+  PROBE_NOT_AN_IMAGE,
+} probe_status_e;
+
+typedef struct {
+  image_type_e type;
+  uint32_t     width;
+  uint32_t     height;
+  bool         progressive; // only set for jpegs
+} image_info_t;
+
+/**
+ * Finds the type, width and height of an image by parsing the jpeg SOFn
+ * marker or the png IHDR chunk directly. Nothing is decoded, so only the first
+ * few KB of the image are needed
+ *
+ * @param data Pointer to the start of the image
+ * @param size The number of bytes available in data
+ * @param info Pointer to the info that will be filled in
+ * @return probe_status_e PROBE_OK if info was filled in
+ */
+probe_status_e probe_image_header(const uint8_t *data, size_t size,
+                                  image_info_t *info);
+
+#endif // IMAGE_PROBE_H
@@ -0,0 +1,118 @@
+#include "imposition.h"
+#include "cli.h"
+#include "extras.h"
+#include <stdlib.h>
+#include <string.h>
+
+static bool _get_bit(const uint64_t *bits, uint32_t i) {
+  return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static void _set_bit(uint64_t *bits, uint32_t i) {
+  bits[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+bool imposition_init(const cli_flags_t *cli_flags, imposition_t *imposition,
+                     const photo_t *photos, uint32_t photo_count,
+                     uint32_t signature_pages) {
+  memset(imposition, 0, sizeof(*imposition));
+  imposition->photos      = photos;
+  imposition->photo_count = photo_count;
+  // every photo has at most one blank before it, the ones at the end are
+  // within the last 3 positions
+  uint32_t words      = (photo_count * 2 + 4) / 64 + 1;
+  imposition->blanks  = (uint64_t *)callocv(*cli_flags, "imposition->blanks",
+                                            words, sizeof(uint64_t), -1);
+  imposition->ranks   = (uint32_t *)mallocv(*cli_flags, "imposition->ranks",
+                                            words * sizeof(uint32_t), -1);
+  imposition->spreads = (uint64_t *)callocv(*cli_flags, "imposition->spreads",
+                                            photo_count / 64 + 1,
+                                            sizeof(uint64_t), -1);
+  if (!imposition->blanks || !imposition->ranks || !imposition->spreads) {
+    imposition_free(cli_flags, imposition);
+    return false;
+  }
+
+  // the cover is a right page, so odd positions are left pages
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < photo_count; i++) {
+    bool left_next = len % 2 == 1;
+    bool last      = i + 1 == photo_count;
+    if (photos[i].double_page == DOUBLE_PAGE_FALSE || last) {
+      // a page right before a spread is moved to a right page, so the blank
+      // that aligns the spread comes before the page and not after it
+      if (left_next && !last &&
+          photos[i + 1].double_page != DOUBLE_PAGE_FALSE) {
+        _set_bit(imposition->blanks, len++);
+      }
+      len++;
+    } else {
+      if (!left_next) {
+        _set_bit(imposition->blanks, len++);
+      }
+      _set_bit(imposition->spreads, i);
+      imposition->spread_count++;
+      len += 2;
+      i++;
+    }
+  }
+  imposition->page_count = (len + 3) / 4 * 4;
+
+  for (uint32_t w = 0; w < words; w++) {
+    imposition->ranks[w]     = imposition->blank_count;
+    imposition->blank_count += __builtin_popcountll(imposition->blanks[w]);
+  }
+
+  imposition->signature_pages =
+      signature_pages == 0 ? imposition->page_count
+                           : MIN(signature_pages, imposition->page_count);
+  return true;
+}
+
+uint32_t imposition_sheet_count(const imposition_t *imposition) {
+  return imposition->page_count / 2;
+}
+
+uint32_t imposition_page(const imposition_t *imposition, uint32_t page) {
+  if (_get_bit(imposition->blanks, page)) {
+    return IMPOSITION_BLANK;
+  }
+  uint64_t below = imposition->blanks[page / 64] &
+                   (((uint64_t)1 << (page % 64)) - 1);
+  uint32_t photo =
+      page - imposition->ranks[page / 64] - __builtin_popcountll(below);
+  if (photo >= imposition->photo_count) {
+    return IMPOSITION_BLANK; // the end is filled up to a multiple of 4
+  }
+
+  // the right half of a spread is read first
+  if (_get_bit(imposition->spreads, photo)) {
+    return photo + 1;
+  }
+  if (photo > 0 && _get_bit(imposition->spreads, photo - 1)) {
+    return photo - 1;
+  }
+  return photo;
+}
+
+void imposition_sheet(const imposition_t *imposition, uint32_t sheet,
+                      uint32_t photos[2]) {
+  uint32_t sheets = imposition->signature_pages / 2; // per signature
+  uint32_t first  = sheet / sheets * imposition->signature_pages;
+  // the last signature gets whatever pages are left
+  uint32_t pages =
+      MIN(imposition->signature_pages, imposition->page_count - first);
+
+  // the outer sheet holds the first and the last page of the signature and
+  // every sheet after it folds inside the one before. Odd sheets are the
+  // backs, so their pages are swapped
+  uint32_t i = sheet % sheets, j = pages - 1 - i;
+  photos[0]  = imposition_page(imposition, first + (i % 2 ? j : i));
+  photos[1]  = imposition_page(imposition, first + (i % 2 ? i : j));
+}
+
+void imposition_free(const cli_flags_t *cli_flags, imposition_t *imposition) {
+  freev(*cli_flags, imposition->blanks, "imposition->blanks", -1);
+  freev(*cli_flags, imposition->ranks, "imposition->ranks", -1);
+  freev(*cli_flags, imposition->spreads, "imposition->spreads", -1);
+}
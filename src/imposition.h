@@ -0,0 +1,84 @@
+#ifndef IMPOSITION_H
+#define IMPOSITION_H
+
+#include "cli.h"
+#include "file_entry_t.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// what imposition_page and imposition_sheet give for a blank page
+#define IMPOSITION_BLANK UINT32_MAX
+
+/// Where every page of a booklet is printed. In reading order the halves of a
+/// spread are swapped (the right half comes first) and blank pages are put in
+/// so every spread starts on a right page and the page count is a multiple of
+/// 4. The pages are folded into signatures of signature_pages pages, each
+/// sheet holds two pages side by side.
+///
+/// Only a bit for every blank page and every spread is kept, so the pages of
+/// any sheet are found in constant time without building the whole order
+typedef struct {
+  const photo_t *photos;
+  uint32_t       photo_count;
+  uint64_t      *blanks; // a bit for every reading order position
+  uint32_t      *ranks;  // the number of blanks before every word of blanks
+  uint32_t       blank_count;
+  uint64_t      *spreads; // a bit for every photo that starts a spread
+  uint32_t       spread_count;
+  uint32_t       page_count;      // in reading order, a multiple of 4
+  uint32_t       signature_pages; // a multiple of 4, at most page_count
+} imposition_t;
+
+/**
+ * Finds the blank pages and the spreads of a booklet
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param imposition Pointer to the imposition
+ * @param photos The pages in reading order, the halves of a spread are next to
+ * each other. They are not copied, so they have to outlive the imposition
+ * @param photo_count The number of photos
+ * @param signature_pages Pages per signature, a multiple of 4. 0 folds the
+ * whole booklet as one signature
+ * @return bool false if memory ran out, nothing has to be freed then
+ */
+bool imposition_init(const cli_flags_t *cli_flags, imposition_t *imposition,
+                     const photo_t *photos, uint32_t photo_count,
+                     uint32_t signature_pages);
+
+/**
+ * @param imposition Pointer to the imposition
+ * @return uint32_t the number of sheets, two pages each
+ */
+uint32_t imposition_sheet_count(const imposition_t *imposition);
+
+/**
+ * Finds the photo at a position of the reading order
+ *
+ * @param imposition Pointer to the imposition
+ * @param page The position, less than page_count
+ * @return uint32_t the index of the photo or IMPOSITION_BLANK
+ */
+uint32_t imposition_page(const imposition_t *imposition, uint32_t page);
+
+/**
+ * Finds the two photos that are printed on a sheet
+ *
+ * @param imposition Pointer to the imposition
+ * @param sheet The sheet, less than imposition_sheet_count
+ * @param photos Will be set to the index of the left and the right photo, or
+ * IMPOSITION_BLANK
+ * @return void
+ */
+void imposition_sheet(const imposition_t *imposition, uint32_t sheet,
+                      uint32_t photos[2]);
+
+/**
+ * Frees the bits of the blanks and the spreads
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param imposition Pointer to the imposition
+ * @return void
+ */
+void imposition_free(const cli_flags_t *cli_flags, imposition_t *imposition);
+
+#endif // IMPOSITION_H
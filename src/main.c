@@ -12,6 +12,7 @@
  */
 
 #include "cli.h"
+#include "compression.h"
 #include "extract.h"
 #include "extras.h"
 #include "file_entry_t.h"
@@ -29,7 +30,15 @@ const char *error_messages[] = {
     /* 5 */ "Invalid parameter passed",
     /* 6 */ "--files or --dirs were used but no files were supplied",
     /* 7 */ "Invalid file was supplied",
-    /* 8 */ "Invlaid Directory was supplied"};
+    /* 8 */ "Invlaid Directory was supplied",
+    /* 9 */ "-j was used, but no valid number of jobs was supplied",
+    /* 10 */ "-z was used, but no valid compression policy was supplied",
+    /* 11 */ "-w was used, but no valid window size was supplied",
+    /* 12 */ "--cache-file was used, but no cache file was supplied",
+    /* 13 */ "--dpi was used, but no valid dpi was supplied",
+    /* 14 */ "--dedup-report was used, but no report file was supplied",
+    /* 15 */ "--read-buffer was used, but no valid size was supplied",
+    /* 16 */ "--signature was used, but no valid multiple of 4 was supplied"};
 
 static void print_log_info(const cli_flags_t *cli_flags,
                            const char *output_file, const uint32_t *input_count,
@@ -41,9 +50,23 @@ static void handle_input_parsing(const cli_flags_t *cli_flags,
 
 int main(int argc, char **argv) {
   uint32_t    input_count = 0;
-  cli_flags_t cli_flags   = {.input_mode   = INPUT_MODE_E_NONE,
-                             .color_mode   = COLOR_DISABLED,
-                             .verbose_mode = VERBOSE_MODE_E_NONE};
+  cli_flags_t cli_flags   = {.input_mode         = INPUT_MODE_E_NONE,
+                             .color_mode         = COLOR_DISABLED,
+                             .verbose_mode       = VERBOSE_MODE_E_NONE,
+                             .append_mode        = APPEND_DISABLED,
+                             .jobs               = 1,
+                             .window             = DEFAULT_WINDOW_SIZE,
+                             .dpi                = 0,
+                             .compression_policy = COMPRESSION_POLICY_AUTO,
+                             .compression_level  = DEFAULT_COMPRESSION_LEVEL,
+                             .cache_mode         = CACHE_DISABLED,
+                             .cache_file         = NULL,
+                             .dedup_mode         = DEDUP_DISABLED,
+                             .dedup_report       = NULL,
+                             .autocrop_mode      = AUTOCROP_DISABLED,
+                             .baseline_mode      = BASELINE_DISABLED,
+                             .read_buffer        = DEFAULT_READ_BUFFER_MB,
+                             .signature          = 0};
   char       *output_file = (char *)mallocv(cli_flags, "output_file",
                                             strlen(DEFAULT_OUTPUT_FILE_NAME) + 1, -1);
   strncpyv(cli_flags, output_file, DEFAULT_OUTPUT_FILE_NAME,
@@ -82,6 +105,21 @@ static void print_log_info(const cli_flags_t *cli_flags,
     printfv(*cli_flags, "", "verbose_mode: %d\n", cli_flags->verbose_mode);
     printfv(*cli_flags, "", "color_mode: %d\n", cli_flags->color_mode);
     printfv(*cli_flags, "", "input_mode: %d\n", cli_flags->input_mode);
+    printfv(*cli_flags, "", "append_mode: %d\n", cli_flags->append_mode);
+    printfv(*cli_flags, "", "jobs: %u\n", cli_flags->jobs);
+    printfv(*cli_flags, "", "window: %u\n", cli_flags->window);
+    printfv(*cli_flags, "", "dpi: %u\n", cli_flags->dpi);
+    printfv(*cli_flags, "", "compression_policy: %d (level %u)\n",
+            cli_flags->compression_policy, cli_flags->compression_level);
+    printfv(*cli_flags, "", "cache_mode: %d (%s)\n", cli_flags->cache_mode,
+            cli_flags->cache_file ? cli_flags->cache_file : "default");
+    printfv(*cli_flags, "", "dedup_mode: %d (report %s)\n",
+            cli_flags->dedup_mode,
+            cli_flags->dedup_report ? cli_flags->dedup_report : "none");
+    printfv(*cli_flags, "", "autocrop_mode: %d\n", cli_flags->autocrop_mode);
+    printfv(*cli_flags, "", "baseline_mode: %d\n", cli_flags->baseline_mode);
+    printfv(*cli_flags, "", "read_buffer: %u MiB\n", cli_flags->read_buffer);
+    printfv(*cli_flags, "", "signature: %u\n", cli_flags->signature);
     printfv(*cli_flags, "", "output_file: %s\n", output_file);
     printfv(*cli_flags, "", "output_file: %u\n", *input_count);
     for (uint32_t i = 0; i < *input_count; ++i) {
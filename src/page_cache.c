@@ -0,0 +1,429 @@
+#define _POSIX_C_SOURCE 200809L /* for strdup, getline and st_mtim */
+#include "page_cache.h"
+#include "cli.h"
+#include "extras.h"
+#include "image_probe.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/limits.h> // for PATH_MAX
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE_CACHE_MAGIC "cbz-combiner page cache 1"
+
+static bool _stat_archive(const char *cbz_path, uint64_t *size,
+                          int64_t *mtime_ns) {
+  struct stat st;
+  if (stat(cbz_path, &st) != 0) {
+    return false;
+  }
+  *size     = (uint64_t)st.st_size;
+  *mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+static void _free_archive(page_cache_archive_t *archive) {
+  free(archive->cbz_path);
+  free(archive->pages);
+  free(archive);
+}
+
+static page_cache_archive_t *_new_archive(const char *cbz_path, uint64_t size,
+                                          int64_t mtime_ns) {
+  page_cache_archive_t *archive =
+      (page_cache_archive_t *)calloc(1, sizeof(page_cache_archive_t));
+  if (!archive) {
+    return NULL;
+  }
+  archive->cbz_path = strdup(cbz_path);
+  if (!archive->cbz_path) {
+    free(archive);
+    return NULL;
+  }
+  archive->size     = size;
+  archive->mtime_ns = mtime_ns;
+  return archive;
+}
+
+static bool _append_archive(page_cache_t *cache,
+                            page_cache_archive_t *archive) {
+  if (cache->count >= cache->len) {
+    uint32_t               len      = cache->len ? cache->len * 2 : 16;
+    page_cache_archive_t **archives = (page_cache_archive_t **)realloc(
+        cache->archives, len * sizeof(page_cache_archive_t *));
+    if (!archives) {
+      return false;
+    }
+    cache->archives = archives;
+    cache->len      = len;
+  }
+  cache->archives[cache->count++] = archive;
+  return true;
+}
+
+static int64_t _find_archive(const page_cache_t *cache, const char *cbz_path) {
+  for (uint32_t i = 0; i < cache->count; i++) {
+    if (strcmp(cache->archives[i]->cbz_path, cbz_path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/// binary search, returns where the page is or where it would be inserted
+static uint32_t _find_page(const page_cache_archive_t *archive,
+                           uint64_t index) {
+  uint32_t low = 0, high = archive->count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (archive->pages[mid].index < index) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static bool _insert_page(page_cache_archive_t    *archive,
+                         const page_cache_page_t *page) {
+  uint32_t pos = _find_page(archive, page->index);
+  if (pos < archive->count && archive->pages[pos].index == page->index) {
+    archive->pages[pos] = *page;
+    return true;
+  }
+
+  if (archive->count >= archive->len) {
+    uint32_t           len   = archive->len ? archive->len * 2 : 32;
+    page_cache_page_t *pages = (page_cache_page_t *)realloc(
+        archive->pages, len * sizeof(page_cache_page_t));
+    if (!pages) {
+      return false;
+    }
+    archive->pages = pages;
+    archive->len   = len;
+  }
+  // pages almost always come in order so this rarely moves anything
+  memmove(&archive->pages[pos + 1], &archive->pages[pos],
+          (archive->count - pos) * sizeof(page_cache_page_t));
+  archive->pages[pos] = *page;
+  archive->count++;
+  return true;
+}
+
+/// the file is a header line followed by, for every archive, a line with
+/// "archive <size> <mtime_ns> <page count> <path>" and one line per page
+static bool _read_cache_file(const char *path, page_cache_t *cache) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return errno == ENOENT; // no cache yet
+  }
+
+  char   *line     = NULL;
+  size_t  line_len = 0;
+  ssize_t read     = getline(&line, &line_len, file);
+  bool    ok       = read > 0 && strcmp(line, PAGE_CACHE_MAGIC "\n") == 0;
+
+  while (ok && (read = getline(&line, &line_len, file)) > 0) {
+    line[read - 1] = '\0'; // the newline
+
+    uint64_t size;
+    int64_t  mtime_ns;
+    uint32_t count;
+    int      path_start = 0;
+    if (sscanf(line, "archive %" SCNu64 " %" SCNd64 " %" SCNu32 " %n", &size,
+               &mtime_ns, &count, &path_start) != 3 ||
+        path_start == 0) {
+      ok = false;
+      break;
+    }
+
+    page_cache_archive_t *archive =
+        _new_archive(line + path_start, size, mtime_ns);
+    if (!archive) {
+      ok = false;
+      break;
+    }
+    for (uint32_t i = 0; ok && i < count; i++) {
+      page_cache_page_t page;
+      uint32_t          type, double_page;
+      ok = getline(&line, &line_len, file) > 0 &&
+           sscanf(line, "%" SCNu64 " %" SCNu32 " %" SCNu32 " %" SCNu32
+                        " %" SCNu32 " %" SCNu32,
+                  &page.index, &page.crc, &type, &page.width, &page.height,
+                  &double_page) == 6 &&
+           type <= IMAGE_TYPE_PNG && double_page <= DOUBLE_PAGE_TRUE;
+      if (ok) {
+        page.type        = (image_type_e)type;
+        page.double_page = (double_page_mode_e)double_page;
+        ok               = _insert_page(archive, &page);
+      }
+    }
+    if (!ok || !_append_archive(cache, archive)) {
+      _free_archive(archive);
+      ok = false;
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return ok;
+}
+
+static bool _write_cache_file(const page_cache_t *cache, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+
+  fprintf(file, PAGE_CACHE_MAGIC "\n");
+  for (uint32_t i = 0; i < cache->count; i++) {
+    const page_cache_archive_t *archive = cache->archives[i];
+    uint64_t                    size;
+    int64_t                     mtime_ns;
+    // drop archives that were deleted and paths the format cannot hold
+    if (strchr(archive->cbz_path, '\n') ||
+        !_stat_archive(archive->cbz_path, &size, &mtime_ns)) {
+      continue;
+    }
+
+    fprintf(file, "archive %" PRIu64 " %" PRId64 " %" PRIu32 " %s\n",
+            archive->size, archive->mtime_ns, archive->count,
+            archive->cbz_path);
+    for (uint32_t j = 0; j < archive->count; j++) {
+      const page_cache_page_t *page = &archive->pages[j];
+      fprintf(file, "%" PRIu64 " %" PRIu32 " %d %" PRIu32 " %" PRIu32 " %d\n",
+              page->index, page->crc, (int)page->type, page->width,
+              page->height, (int)page->double_page);
+    }
+  }
+
+  bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+  return fclose(file) == 0 && ok;
+}
+
+/// readers and writers of the cache file take a flock on a side file, the
+/// cache file itself is replaced by rename so it cannot be locked
+static int _lock_cache_file(const char *path, int operation) {
+  char lock_path[PATH_MAX];
+  snprintf(lock_path, PATH_MAX, "%s.lock", path);
+
+  int fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  if (flock(fd, operation) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void _unlock_cache_file(int fd) {
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+/// $XDG_CACHE_HOME/cbz-combiner/pages.cache or ~/.cache/...
+static char *_default_cache_path(void) {
+  char        dir[PATH_MAX];
+  const char *xdg  = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0] != '\0') {
+    snprintf(dir, PATH_MAX, "%s", xdg);
+  } else if (home && home[0] != '\0') {
+    snprintf(dir, PATH_MAX, "%s/.cache", home);
+    mkdir(dir, 0755);
+  } else {
+    return NULL;
+  }
+
+  size_t len = strlen(dir);
+  snprintf(dir + len, PATH_MAX - len, "/%s", PAGE_CACHE_DIR_NAME);
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    return NULL;
+  }
+
+  char path[PATH_MAX];
+  if (snprintf(path, PATH_MAX, "%s/%s", dir, PAGE_CACHE_FILE_NAME) >=
+      PATH_MAX) {
+    return NULL;
+  }
+  return strdup(path);
+}
+
+void page_cache_load(const cli_flags_t *cli_flags, page_cache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
+  pthread_mutex_init(&cache->lock, NULL);
+  if (cli_flags->cache_mode == CACHE_DISABLED) {
+    return;
+  }
+
+  cache->path = cli_flags->cache_file ? strdup(cli_flags->cache_file)
+                                      : _default_cache_path();
+  if (!cache->path) {
+    printfv(*cli_flags, DARK_YELLOW,
+            "No cache dir could be found, the page cache is disabled\n");
+    return;
+  }
+  cache->enabled = true;
+  if (cli_flags->cache_mode == CACHE_REBUILD) {
+    printfv(*cli_flags, DARK_YELLOW, "Rebuilding the page cache %s\n",
+            cache->path);
+    return;
+  }
+
+  int fd = _lock_cache_file(cache->path, LOCK_SH);
+  if (!_read_cache_file(cache->path, cache)) {
+    printfv(*cli_flags, DARK_YELLOW,
+            "Page cache %s is unreadable, it will be rebuilt\n", cache->path);
+    for (uint32_t i = 0; i < cache->count; i++) {
+      _free_archive(cache->archives[i]);
+    }
+    cache->count = 0;
+  }
+  if (fd >= 0) {
+    _unlock_cache_file(fd);
+  }
+  printfv(*cli_flags, DARK_GREEN, "Loaded %u archives from the page cache %s\n",
+          cache->count, cache->path);
+}
+
+page_cache_archive_t *page_cache_archive(const cli_flags_t *cli_flags,
+                                         page_cache_t      *cache,
+                                         const char        *cbz_path) {
+  uint64_t size;
+  int64_t  mtime_ns;
+  if (!cache->enabled || !_stat_archive(cbz_path, &size, &mtime_ns)) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  page_cache_archive_t *archive = NULL;
+  int64_t               i       = _find_archive(cache, cbz_path);
+  if (i >= 0) {
+    archive = cache->archives[i];
+    if (archive->size != size || archive->mtime_ns != mtime_ns) {
+      printfv(*cli_flags, DARK_YELLOW, "Cached pages of %s are stale\n",
+              cbz_path);
+      archive->size     = size;
+      archive->mtime_ns = mtime_ns;
+      archive->count    = 0;
+      archive->dirty    = true;
+    }
+  } else {
+    archive = _new_archive(cbz_path, size, mtime_ns);
+    if (archive && !_append_archive(cache, archive)) {
+      _free_archive(archive);
+      archive = NULL;
+    }
+    if (archive) {
+      archive->dirty = true;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return archive;
+}
+
+bool page_cache_get(page_cache_t *cache, const page_cache_archive_t *archive,
+                    uint64_t index, uint32_t crc, page_cache_page_t *page) {
+  if (!archive) {
+    return false;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  uint32_t pos   = _find_page(archive, index);
+  bool     found = pos < archive->count &&
+               archive->pages[pos].index == index &&
+               archive->pages[pos].crc == crc;
+  if (found) {
+    *page = archive->pages[pos];
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return found;
+}
+
+void page_cache_put(page_cache_t *cache, page_cache_archive_t *archive,
+                    const page_cache_page_t *page) {
+  if (!archive) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  if (_insert_page(archive, page)) {
+    archive->dirty = true;
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+bool page_cache_save(const cli_flags_t *cli_flags, page_cache_t *cache) {
+  bool dirty = false;
+  for (uint32_t i = 0; i < cache->count; i++) {
+    dirty = dirty || cache->archives[i]->dirty;
+  }
+  if (!cache->enabled || (!dirty && cli_flags->cache_mode != CACHE_REBUILD)) {
+    return true;
+  }
+
+  int fd = _lock_cache_file(cache->path, LOCK_EX);
+  if (fd < 0) {
+    printfv(*cli_flags, RED, "Failed to lock the page cache %s\n",
+            cache->path);
+    return false;
+  }
+
+  // another run may have saved since this one loaded, keep everything it
+  // found unless this run changed the same archive
+  page_cache_t disk;
+  memset(&disk, 0, sizeof(disk));
+  if (cli_flags->cache_mode != CACHE_REBUILD) {
+    _read_cache_file(cache->path, &disk);
+  }
+  for (uint32_t i = 0; i < disk.count; i++) {
+    page_cache_archive_t *archive = disk.archives[i];
+    int64_t               j       = _find_archive(cache, archive->cbz_path);
+    if (j < 0 && _append_archive(cache, archive)) {
+      continue;
+    }
+    if (j >= 0 && !cache->archives[j]->dirty) {
+      _free_archive(cache->archives[j]);
+      cache->archives[j] = archive;
+      continue;
+    }
+    _free_archive(archive);
+  }
+  free(disk.archives);
+
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, PATH_MAX, "%s.%ld.tmp", cache->path, (long)getpid());
+  bool ok = _write_cache_file(cache, tmp_path) &&
+            rename(tmp_path, cache->path) == 0;
+  if (!ok) {
+    unlink(tmp_path);
+    printfv(*cli_flags, RED, "Failed to write the page cache %s\n",
+            cache->path);
+  } else {
+    printfv(*cli_flags, DARK_GREEN, "Saved %u archives to the page cache\n",
+            cache->count);
+  }
+  _unlock_cache_file(fd);
+  return ok;
+}
+
+void page_cache_free(const cli_flags_t *cli_flags, page_cache_t *cache) {
+  for (uint32_t i = 0; i < cache->count; i++) {
+    _free_archive(cache->archives[i]);
+  }
+  freev(*cli_flags, cache->archives, "cache->archives", -1);
+  freev(*cli_flags, cache->path, "cache->path", -1);
+  pthread_mutex_destroy(&cache->lock);
+  memset(cache, 0, sizeof(*cache));
+}
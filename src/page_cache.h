@@ -0,0 +1,117 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include "cli.h"
+#include "extras.h"
+#include "image_probe.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PAGE_CACHE_DIR_NAME  "cbz-combiner"
+#define PAGE_CACHE_FILE_NAME "pages.cache"
+
+/// what the scan found out about an entry, type is IMAGE_TYPE_UNKNOWN for
+/// entries that are not images
+typedef struct {
+  uint64_t           index; // entry index inside the archive
+  uint32_t           crc;
+  image_type_e       type;
+  uint32_t           width;
+  uint32_t           height;
+  double_page_mode_e double_page;
+} page_cache_page_t;
+
+typedef struct {
+  char              *cbz_path;
+  uint64_t           size;
+  int64_t            mtime_ns;
+  page_cache_page_t *pages; // sorted by index
+  uint32_t           count;
+  uint32_t           len;
+  bool               dirty; // changed by this run
+} page_cache_archive_t;
+
+/// Remembers the metadata of every page between runs so unchanged archives
+/// are not probed again. Archives are matched by path, size and mtime and
+/// their pages by entry index and crc. All functions but load, save and free
+/// are thread safe
+typedef struct {
+  char                  *path;
+  page_cache_archive_t **archives;
+  uint32_t               count;
+  uint32_t               len;
+  bool                   enabled;
+  pthread_mutex_t        lock;
+} page_cache_t;
+
+/**
+ * Loads the cache file given by cli_flags->cache_file (or the default one in
+ * the user cache dir). A missing or unreadable file gives an empty cache, and
+ * with CACHE_REBUILD the file is not read at all
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @return void
+ */
+void page_cache_load(const cli_flags_t *cli_flags, page_cache_t *cache);
+
+/**
+ * Gets the record of an archive, a record that does not match the size and
+ * mtime of the archive on disk is emptied first
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @param cbz_path The path of the archive
+ * @return page_cache_archive_t* the record or NULL if caching is disabled
+ */
+page_cache_archive_t *page_cache_archive(const cli_flags_t *cli_flags,
+                                         page_cache_t      *cache,
+                                         const char        *cbz_path);
+
+/**
+ * Looks up an entry of an archive
+ *
+ * @param cache Pointer to the cache
+ * @param archive Pointer to the record of the archive, can be NULL
+ * @param index The entry index inside the archive
+ * @param crc The crc of the entry
+ * @param page Pointer to the page that will be filled in
+ * @return bool true if the entry was found and its crc matches
+ */
+bool page_cache_get(page_cache_t *cache, const page_cache_archive_t *archive,
+                    uint64_t index, uint32_t crc, page_cache_page_t *page);
+
+/**
+ * Adds or replaces an entry of an archive
+ *
+ * @param cache Pointer to the cache
+ * @param archive Pointer to the record of the archive, can be NULL
+ * @param page Pointer to the page
+ * @return void
+ */
+void page_cache_put(page_cache_t *cache, page_cache_archive_t *archive,
+                    const page_cache_page_t *page);
+
+/**
+ * Writes the cache back if this run changed it. The file is locked while it
+ * is merged with whatever another run saved in the meantime and is replaced
+ * with a rename, so concurrent runs never see a partial file. Records gotten
+ * from page_cache_archive must not be used after this
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @return bool false if the cache could not be written
+ */
+bool page_cache_save(const cli_flags_t *cli_flags, page_cache_t *cache);
+
+/**
+ * Frees the cache
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @return void
+ */
+void page_cache_free(const cli_flags_t *cli_flags, page_cache_t *cache);
+
+#endif // PAGE_CACHE_H
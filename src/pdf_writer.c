@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200809L /* for mkstemp */
+#include "pdf_writer.h"
+#include "cli.h"
+#include "extras.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/// the page tree and the catalog are written last, but the pages point at
+/// the page tree, so both numbers are taken before anything else
+#define PDF_PAGES_OBJECT   1
+#define PDF_CATALOG_OBJECT 2
+
+#define PDF_WRITE_BUFFER_SIZE (1 << 20)
+
+/// an xref entry has room for 10 digits of offset
+#define PDF_MAX_OFFSET 9999999999ULL
+
+/// long enough for any dictionary that is written in one go
+#define PDF_LINE_SIZE 512
+
+/// an indexed color space has at most 256 entries
+#define PDF_MAX_PALETTE 256
+
+static bool _write(pdf_writer_t *writer, const void *data, uint64_t size) {
+  if (writer->failed) {
+    return false;
+  }
+  if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+    writer->failed = true;
+    return false;
+  }
+  writer->offset += size;
+  return true;
+}
+
+static bool _writef(pdf_writer_t *writer, const char *format, ...) {
+  char    line[PDF_LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (len < 0 || (size_t)len >= sizeof(line)) {
+    writer->failed = true;
+    return false;
+  }
+  return _write(writer, line, (uint64_t)len);
+}
+
+static bool _grow_objects(pdf_writer_t *writer) {
+  if (writer->count < writer->len) {
+    return true;
+  }
+  uint32_t  len     = writer->len ? writer->len * 2 : 256;
+  uint64_t *objects = (uint64_t *)realloc(writer->objects,
+                                          len * sizeof(uint64_t));
+  if (!objects) {
+    return false;
+  }
+  writer->objects = objects;
+  writer->len     = len;
+  return true;
+}
+
+/// hands out the next object number without writing anything
+static uint32_t _reserve_object(pdf_writer_t *writer) {
+  if (!_grow_objects(writer)) {
+    writer->failed = true;
+    return 0;
+  }
+  writer->objects[writer->count] = 0;
+  return ++writer->count;
+}
+
+/// records where an object starts and writes its header
+static bool _begin_object(pdf_writer_t *writer, uint32_t number) {
+  if (writer->failed || number == 0) {
+    return false;
+  }
+  writer->objects[number - 1] = writer->offset;
+  return _writef(writer, "%u 0 obj\n", number);
+}
+
+static bool _end_object(pdf_writer_t *writer) {
+  return _writef(writer, "endobj\n");
+}
+
+/// creates path.XXXXXX for the writer to fill, it is renamed over path by
+/// pdf_writer_close
+static bool _open_temp(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                       const char *path) {
+  size_t path_size = strlen(path) + 1;
+  writer->path     = (char *)mallocv(*cli_flags, "writer->path", path_size, -1);
+  writer->tmp_path = (char *)mallocv(*cli_flags, "writer->tmp_path",
+                                     path_size + 7, -1);
+  if (!writer->path || !writer->tmp_path) {
+    return false;
+  }
+  memcpy(writer->path, path, path_size);
+  snprintf(writer->tmp_path, path_size + 7, "%s.XXXXXX", path);
+
+  int fd = mkstemp(writer->tmp_path);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp makes the file 0600, the output gets the usual mode instead
+  mode_t mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+  writer->file = fdopen(fd, "wb");
+  if (!writer->file) {
+    close(fd);
+    unlink(writer->tmp_path);
+    return false;
+  }
+  setvbuf(writer->file, NULL, _IOFBF, PDF_WRITE_BUFFER_SIZE);
+  return true;
+}
+
+static void _free_writer(const cli_flags_t *cli_flags, pdf_writer_t *writer) {
+  freev(*cli_flags, writer->objects, "writer->objects", -1);
+  freev(*cli_flags, writer->pages, "writer->pages", -1);
+  freev(*cli_flags, writer->path, "writer->path", -1);
+  freev(*cli_flags, writer->tmp_path, "writer->tmp_path", -1);
+  writer->file       = NULL;
+  writer->count      = 0;
+  writer->len        = 0;
+  writer->page_count = 0;
+  writer->page_len   = 0;
+}
+
+bool pdf_writer_open(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                     const char *path) {
+  memset(writer, 0, sizeof(*writer));
+  if (!_open_temp(cli_flags, writer, path)) {
+    printfv(*cli_flags, RED, "Failed to open destination pdf file: %s\n",
+            path);
+    _free_writer(cli_flags, writer);
+    return false;
+  }
+
+  _reserve_object(writer); // PDF_PAGES_OBJECT
+  _reserve_object(writer); // PDF_CATALOG_OBJECT
+  // the binary comment tells transfer tools that the file is not text
+  _writef(writer, "%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+  return !writer->failed;
+}
+
+static const char *_color_space(uint32_t components) {
+  switch (components) {
+  case 1:
+    return "/DeviceGray";
+  case 3:
+    return "/DeviceRGB";
+  case 4:
+    return "/DeviceCMYK";
+  default:
+    return NULL;
+  }
+}
+
+/// an indexed image names its palette inline as a hex string
+static bool _write_color_space(pdf_writer_t *writer, const pdf_image_t *image,
+                               const char *color_space) {
+  if (!image->palette) {
+    return _writef(writer, " /ColorSpace %s", color_space);
+  }
+  static const char digits[] = "0123456789ABCDEF";
+  char              hex[PDF_MAX_PALETTE * 6];
+  uint32_t          bytes = image->palette_size * 3;
+  for (uint32_t i = 0; i < bytes; i++) {
+    hex[i * 2]     = digits[image->palette[i] >> 4];
+    hex[i * 2 + 1] = digits[image->palette[i] & 0x0F];
+  }
+  return _writef(writer, " /ColorSpace [/Indexed /DeviceRGB %u <",
+                 image->palette_size - 1) &&
+         _write(writer, hex, (uint64_t)bytes * 2) && _writef(writer, ">]");
+}
+
+static bool _write_image_dictionary(pdf_writer_t *writer,
+                                    const pdf_image_t *image,
+                                    const char *color_space, uint64_t size) {
+  bool ok = _writef(writer,
+                    "<< /Type /XObject /Subtype /Image /Width %u /Height %u "
+                    "/BitsPerComponent %u",
+                    image->width, image->height, image->bits) &&
+            _write_color_space(writer, image, color_space);
+  if (image->filter == PDF_FILTER_DCT) {
+    ok = ok && _writef(writer, " /Filter /DCTDecode");
+  } else {
+    ok = ok && _writef(writer, " /Filter /FlateDecode");
+  }
+  if (image->predictors) {
+    ok = ok && _writef(writer,
+                       " /DecodeParms << /Predictor 15 /Colors %u "
+                       "/BitsPerComponent %u /Columns %u >>",
+                       image->components, image->bits, image->width);
+  }
+  if (image->inverted) {
+    ok = ok && _writef(writer, " /Decode [1 0 1 0 1 0 1 0]");
+  }
+  if (image->keyed) {
+    ok = ok && _writef(writer, " /Mask [");
+    for (uint32_t c = 0; ok && c < image->components; c++) {
+      ok = _writef(writer, "%u %u ", image->key[c], image->key[c]);
+    }
+    ok = ok && _writef(writer, "]");
+  }
+  if (image->smask) {
+    ok = ok && _writef(writer, " /SMask %u 0 R", image->smask);
+  }
+  return ok && _writef(writer, " /Length %llu >>\nstream\n",
+                       (unsigned long long)size);
+}
+
+bool pdf_writer_add_image(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                          const pdf_image_t *image, const uint8_t *data,
+                          uint64_t size, uint32_t *number) {
+  const char *color_space = _color_space(image->components);
+  if (!color_space || (image->palette && (image->components != 1 ||
+                                          image->palette_size == 0 ||
+                                          image->palette_size >
+                                              PDF_MAX_PALETTE))) {
+    printfv(*cli_flags, RED, "An image with %u components can not be drawn\n",
+            image->components);
+    return false;
+  }
+
+  *number = _reserve_object(writer);
+  bool ok = _begin_object(writer, *number) &&
+            _write_image_dictionary(writer, image, color_space, size) &&
+            _write(writer, data, size) && _writef(writer, "\nendstream\n") &&
+            _end_object(writer);
+  if (!ok) {
+    printfv(*cli_flags, RED, "Failed to write an image to the pdf file\n");
+  }
+  return ok;
+}
+
+void pdf_page_init(pdf_page_t *page, float width, float height) {
+  page->width        = width;
+  page->height       = height;
+  page->image_count  = 0;
+  page->content_size = 0;
+  page->overflowed   = false;
+}
+
+static bool _append_content(pdf_page_t *page, const char *format, ...) {
+  size_t  room = sizeof(page->content) - page->content_size;
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(page->content + page->content_size, room, format, args);
+  va_end(args);
+  if (len < 0 || (size_t)len >= room) {
+    page->content[page->content_size] = '\0';
+    page->overflowed                  = true;
+    return false;
+  }
+  page->content_size += (size_t)len;
+  return true;
+}
+
+bool pdf_page_draw_image(pdf_page_t *page, uint32_t number, float x, float y,
+                         float width, float height) {
+  if (page->image_count == PDF_PAGE_MAX_IMAGES) {
+    page->overflowed = true;
+    return false;
+  }
+  // the image space is a unit square, cm stretches it over the box
+  if (!_append_content(page, "q %.4f 0 0 %.4f %.4f %.4f cm /Im%u Do Q\n",
+                       width, height, x, y, page->image_count)) {
+    return false;
+  }
+  page->images[page->image_count++] = number;
+  return true;
+}
+
+bool pdf_page_dashed_line(pdf_page_t *page, float x1, float y1, float x2,
+                          float y2) {
+  return _append_content(page,
+                         "q [3 3] 0 d 1 w %.4f %.4f m %.4f %.4f l S Q\n", x1,
+                         y1, x2, y2);
+}
+
+static bool _grow_pages(pdf_writer_t *writer) {
+  if (writer->page_count < writer->page_len) {
+    return true;
+  }
+  uint32_t  len   = writer->page_len ? writer->page_len * 2 : 64;
+  uint32_t *pages = (uint32_t *)realloc(writer->pages, len * sizeof(uint32_t));
+  if (!pages) {
+    return false;
+  }
+  writer->pages    = pages;
+  writer->page_len = len;
+  return true;
+}
+
+bool pdf_writer_add_page(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                         const pdf_page_t *page) {
+  if (page->overflowed) {
+    printfv(*cli_flags, RED, "A pdf page was too full, some of it is left "
+                             "out\n");
+  }
+  if (!_grow_pages(writer)) {
+    printfv(*cli_flags, RED, "Failed to grow the pdf pages\n");
+    writer->failed = true;
+    return false;
+  }
+
+  uint32_t contents = _reserve_object(writer);
+  uint32_t number   = _reserve_object(writer);
+  bool     ok       = _begin_object(writer, contents) &&
+              _writef(writer, "<< /Length %zu >>\nstream\n",
+                      page->content_size) &&
+              _write(writer, page->content, page->content_size) &&
+              _writef(writer, "endstream\n") && _end_object(writer);
+
+  ok = ok && _begin_object(writer, number) &&
+       _writef(writer,
+               "<< /Type /Page /Parent %u 0 R /MediaBox [0 0 %.4f %.4f] "
+               "/Contents %u 0 R /Resources << /XObject <<",
+               PDF_PAGES_OBJECT, page->width, page->height, contents);
+  for (uint32_t i = 0; ok && i < page->image_count; i++) {
+    ok = _writef(writer, " /Im%u %u 0 R", i, page->images[i]);
+  }
+  ok = ok && _writef(writer, " >> >> >>\n") && _end_object(writer);
+  if (!ok) {
+    printfv(*cli_flags, RED, "Failed to write a page to the pdf file\n");
+    return false;
+  }
+  writer->pages[writer->page_count++] = number;
+  return true;
+}
+
+static bool _write_page_tree(pdf_writer_t *writer) {
+  bool ok = _begin_object(writer, PDF_PAGES_OBJECT) &&
+            _writef(writer, "<< /Type /Pages /Count %u /Kids [",
+                    writer->page_count);
+  for (uint32_t i = 0; ok && i < writer->page_count; i++) {
+    ok = _writef(writer, i % 8 == 7 ? "%u 0 R\n" : "%u 0 R ",
+                 writer->pages[i]);
+  }
+  return ok && _writef(writer, "] >>\n") && _end_object(writer) &&
+         _begin_object(writer, PDF_CATALOG_OBJECT) &&
+         _writef(writer, "<< /Type /Catalog /Pages %u 0 R >>\n",
+                 PDF_PAGES_OBJECT) &&
+         _end_object(writer);
+}
+
+static bool _write_xref(pdf_writer_t *writer) {
+  uint64_t xref = writer->offset;
+  bool     ok   = _writef(writer, "xref\n0 %u\n0000000000 65535 f \n",
+                          writer->count + 1);
+  for (uint32_t i = 0; ok && i < writer->count; i++) {
+    // every entry is exactly 20 bytes, the space before the newline counts
+    if (writer->objects[i] > PDF_MAX_OFFSET) {
+      writer->failed = true;
+      return false;
+    }
+    ok = _writef(writer, "%010llu 00000 n \n",
+                 (unsigned long long)writer->objects[i]);
+  }
+  return ok && _writef(writer,
+                       "trailer\n<< /Size %u /Root %u 0 R >>\nstartxref\n"
+                       "%llu\n%%%%EOF\n",
+                       writer->count + 1, PDF_CATALOG_OBJECT,
+                       (unsigned long long)xref);
+}
+
+bool pdf_writer_close(const cli_flags_t *cli_flags, pdf_writer_t *writer) {
+  bool ok = !writer->failed && _write_page_tree(writer) && _write_xref(writer);
+  // the data has to be on disk before the rename makes it the output
+  ok = ok && fflush(writer->file) == 0 && fsync(fileno(writer->file)) == 0;
+  if (fclose(writer->file) != 0) {
+    ok = false;
+  }
+  ok = ok && rename(writer->tmp_path, writer->path) == 0;
+  if (!ok) {
+    printfv(*cli_flags, RED,
+            "Failed to finish writing the pdf file, %s was not changed\n",
+            writer->path);
+    unlink(writer->tmp_path);
+  }
+
+  _free_writer(cli_flags, writer);
+  return ok;
+}
@@ -0,0 +1,158 @@
+#ifndef PDF_WRITER_H
+#define PDF_WRITER_H
+
+#include "cli.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// the most images one page can draw
+#define PDF_PAGE_MAX_IMAGES 4
+
+/// a page only holds a few drawing operators, this is plenty for them
+#define PDF_CONTENT_SIZE 1024
+
+typedef enum {
+  PDF_FILTER_DCT,   // a whole jpeg
+  PDF_FILTER_FLATE, // a zlib stream
+} pdf_filter_e;
+
+/// What the pdf needs to know about an image, the data itself is written as
+/// it is
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  // samples per pixel, 1 for gray and indexed images, 3 for rgb, 4 for cmyk
+  uint32_t       components;
+  uint32_t       bits; // per sample
+  pdf_filter_e   filter;
+  bool           predictors;   // flate rows start with a png filter type byte
+  bool           inverted;     // adobe cmyk jpegs store their ink inverted
+  const uint8_t *palette;      // rgb triples, NULL if the image is not indexed
+  uint32_t       palette_size; // number of entries, at most 256
+  bool           keyed;        // samples equal to key are left transparent
+  uint16_t       key[3];       // one value per component
+  uint32_t       smask;        // object number of the alpha, 0 for none
+} pdf_image_t;
+
+/// A page that is being composed. The images it draws are already in the
+/// file, only their object numbers and the drawing operators are kept
+typedef struct {
+  float    width; // in pdf points
+  float    height;
+  uint32_t images[PDF_PAGE_MAX_IMAGES]; // object numbers
+  uint32_t image_count;
+  char     content[PDF_CONTENT_SIZE];
+  size_t   content_size;
+  bool     overflowed; // something did not fit and was left out
+} pdf_page_t;
+
+/// A pdf writer that streams every object to the file as soon as it is
+/// added, so images do not stay in memory until the end. Only the byte offset
+/// of every object and the page object numbers are kept, pdf_writer_close
+/// writes the page tree, the catalog, the xref table and the trailer.
+/// Everything goes to a temporary file next to path, which only replaces path
+/// once it is complete
+typedef struct {
+  FILE     *file;
+  char     *path;
+  char     *tmp_path;
+  uint64_t  offset;
+  uint64_t *objects; // byte offset of every object, by object number - 1
+  uint32_t  count;   // object numbers handed out so far
+  uint32_t  len;
+  uint32_t *pages; // object numbers of the pages, in order
+  uint32_t  page_count;
+  uint32_t  page_len;
+  bool      failed; // set by the caller too, when a page could not be made
+} pdf_writer_t;
+
+/**
+ * Creates a pdf file and writes its header, an existing file at path is left
+ * untouched until pdf_writer_close replaces it
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param path The path of the pdf file
+ * @return bool false if the temporary file could not be created
+ */
+bool pdf_writer_open(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                     const char *path);
+
+/**
+ * Writes an image object, the data is embedded as it is
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param image Pointer to the description of the data
+ * @param data The jpeg or the zlib stream, it is not freed and can be freed
+ * right after
+ * @param size The size of data
+ * @param number Pointer that will be set to the object number of the image
+ * @return bool false if the image could not be written
+ */
+bool pdf_writer_add_image(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                          const pdf_image_t *image, const uint8_t *data,
+                          uint64_t size, uint32_t *number);
+
+/**
+ * Starts an empty page
+ *
+ * @param page Pointer to the page
+ * @param width The width of the page in pdf points
+ * @param height The height of the page in pdf points
+ * @return void
+ */
+void pdf_page_init(pdf_page_t *page, float width, float height);
+
+/**
+ * Draws an image that was added to the writer on a page
+ *
+ * @param page Pointer to the page
+ * @param number The object number of the image
+ * @param x The left edge of the image in pdf points
+ * @param y The bottom edge of the image in pdf points
+ * @param width The width the image is drawn with
+ * @param height The height the image is drawn with
+ * @return bool false if the page is full, the image is left out then
+ */
+bool pdf_page_draw_image(pdf_page_t *page, uint32_t number, float x, float y,
+                         float width, float height);
+
+/**
+ * Draws a 1 point wide line that is dashed 3 points on and 3 points off
+ *
+ * @param page Pointer to the page
+ * @param x1 The x of the start of the line
+ * @param y1 The y of the start of the line
+ * @param x2 The x of the end of the line
+ * @param y2 The y of the end of the line
+ * @return bool false if the page is full, the line is left out then
+ */
+bool pdf_page_dashed_line(pdf_page_t *page, float x1, float y1, float x2,
+                          float y2);
+
+/**
+ * Writes the content stream and the page object of a page
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param page Pointer to the page, it can be reused right after
+ * @return bool false if the page could not be written
+ */
+bool pdf_writer_add_page(const cli_flags_t *cli_flags, pdf_writer_t *writer,
+                         const pdf_page_t *page);
+
+/**
+ * Writes the page tree, the catalog, the xref table and the trailer, closes
+ * the file and frees the writer. The file is synced and renamed over path, if
+ * anything failed (or failed was set) it is removed and path keeps what it had
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @return bool false if anything failed to be written
+ */
+bool pdf_writer_close(const cli_flags_t *cli_flags, pdf_writer_t *writer);
+
+#endif // PDF_WRITER_H
@@ -0,0 +1,418 @@
+#include "pixels.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define PIXELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+/// the weights of r, g and b out of 256, they add up to 256
+#define GRAY_WEIGHT_R 77
+#define GRAY_WEIGHT_G 150
+#define GRAY_WEIGHT_B 29
+
+#define MAX_PIXEL_KERNELS 4
+
+/// these are also the tails of the wider variants, so everything rounds alike
+static bool _rgb_to_gray_scalar(const uint8_t *rgb, uint8_t *gray,
+                                uint32_t width, uint8_t tolerance) {
+  int too_far = 0;
+  for (uint32_t x = 0; x < width; x++) {
+    int r = rgb[x * 3], g = rgb[x * 3 + 1], b = rgb[x * 3 + 2];
+    too_far |= (abs(r - g) > tolerance) | (abs(g - b) > tolerance) |
+               (abs(r - b) > tolerance);
+    gray[x] = (uint8_t)((r * GRAY_WEIGHT_R + g * GRAY_WEIGHT_G +
+                         b * GRAY_WEIGHT_B + 128) >>
+                        8);
+  }
+  return !too_far;
+}
+
+static void _min_max_scalar(const uint8_t *data, size_t size, uint8_t *min,
+                            uint8_t *max) {
+  uint8_t lo = data[0];
+  uint8_t hi = data[0];
+  for (size_t i = 1; i < size; i++) {
+    lo = data[i] < lo ? data[i] : lo;
+    hi = data[i] > hi ? data[i] : hi;
+  }
+  *min = lo;
+  *max = hi;
+}
+
+static void _min_into_scalar(uint8_t *acc, const uint8_t *row, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    acc[i] = row[i] < acc[i] ? row[i] : acc[i];
+  }
+}
+
+static const pixel_kernels_t _scalar_kernels = {
+    .name        = "scalar",
+    .rgb_to_gray = _rgb_to_gray_scalar,
+    .min_max     = _min_max_scalar,
+    .min_into    = _min_into_scalar,
+};
+
+#ifdef PIXELS_X86
+/// pshufb masks that pull one channel of 16 rgb pixels out of each of the 3
+/// loads that hold them, -1 leaves the byte 0
+static const int8_t _rgb_masks[3][3][16] __attribute__((aligned(16))) = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+
+#define SSE_TARGET  __attribute__((target("sse4.2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+SSE_TARGET static inline __m128i _channel_sse(__m128i a, __m128i b, __m128i c,
+                                              int channel) {
+  const __m128i *masks = (const __m128i *)_rgb_masks[channel];
+  return _mm_or_si128(
+      _mm_or_si128(_mm_shuffle_epi8(a, _mm_load_si128(&masks[0])),
+                   _mm_shuffle_epi8(b, _mm_load_si128(&masks[1]))),
+      _mm_shuffle_epi8(c, _mm_load_si128(&masks[2])));
+}
+
+SSE_TARGET static inline __m128i _abs_diff_sse(__m128i x, __m128i y) {
+  return _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+}
+
+/// the largest channel difference of every pixel
+SSE_TARGET static inline __m128i _spread_sse(__m128i r, __m128i g, __m128i b) {
+  return _mm_max_epu8(_mm_max_epu8(_abs_diff_sse(r, g), _abs_diff_sse(g, b)),
+                      _abs_diff_sse(r, b));
+}
+
+/// 8 pixels of one channel times its weight, in 16 bits
+SSE_TARGET static inline __m128i _weigh_sse(__m128i r, __m128i g, __m128i b) {
+  __m128i sum = _mm_mullo_epi16(r, _mm_set1_epi16(GRAY_WEIGHT_R));
+  sum = _mm_add_epi16(sum, _mm_mullo_epi16(g, _mm_set1_epi16(GRAY_WEIGHT_G)));
+  sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(GRAY_WEIGHT_B)));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+SSE_TARGET static bool _rgb_to_gray_sse(const uint8_t *rgb, uint8_t *gray,
+                                        uint32_t width, uint8_t tolerance) {
+  const __m128i zero   = _mm_setzero_si128();
+  __m128i       spread = zero;
+  uint32_t      x      = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i *in = (const __m128i *)(rgb + (size_t)x * 3);
+    __m128i        a  = _mm_loadu_si128(in);
+    __m128i        b  = _mm_loadu_si128(in + 1);
+    __m128i        c  = _mm_loadu_si128(in + 2);
+    __m128i        r  = _channel_sse(a, b, c, 0);
+    __m128i        g  = _channel_sse(a, b, c, 1);
+    __m128i        bl = _channel_sse(a, b, c, 2);
+    spread            = _mm_max_epu8(spread, _spread_sse(r, g, bl));
+
+    __m128i lo = _weigh_sse(_mm_unpacklo_epi8(r, zero),
+                            _mm_unpacklo_epi8(g, zero),
+                            _mm_unpacklo_epi8(bl, zero));
+    __m128i hi = _weigh_sse(_mm_unpackhi_epi8(r, zero),
+                            _mm_unpackhi_epi8(g, zero),
+                            _mm_unpackhi_epi8(bl, zero));
+    _mm_storeu_si128((__m128i *)(gray + x), _mm_packus_epi16(lo, hi));
+  }
+  __m128i limit = _mm_set1_epi8((char)tolerance);
+  bool    ok    = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                      _mm_max_epu8(spread, limit), limit)) == 0xFFFF;
+  return _rgb_to_gray_scalar(rgb + (size_t)x * 3, gray + x, width - x,
+                             tolerance) &&
+         ok;
+}
+
+SSE_TARGET static void _min_max_sse(const uint8_t *data, size_t size,
+                                    uint8_t *min, uint8_t *max) {
+  size_t i = 0;
+  if (size >= 16) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)data);
+    __m128i hi = lo;
+    for (i = 16; i + 16 <= size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+      lo        = _mm_min_epu8(lo, v);
+      hi        = _mm_max_epu8(hi, v);
+    }
+    uint8_t lanes[2][16];
+    _mm_storeu_si128((__m128i *)lanes[0], lo);
+    _mm_storeu_si128((__m128i *)lanes[1], hi);
+    uint8_t unused;
+    _min_max_scalar(lanes[0], 16, min, &unused);
+    _min_max_scalar(lanes[1], 16, &unused, max);
+  } else {
+    _min_max_scalar(data, size, min, max);
+    return;
+  }
+  if (i < size) {
+    uint8_t lo, hi;
+    _min_max_scalar(data + i, size - i, &lo, &hi);
+    *min = lo < *min ? lo : *min;
+    *max = hi > *max ? hi : *max;
+  }
+}
+
+SSE_TARGET static void _min_into_sse(uint8_t *acc, const uint8_t *row,
+                                     size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i *out = (__m128i *)(acc + i);
+    _mm_storeu_si128(
+        out, _mm_min_epu8(_mm_loadu_si128(out),
+                          _mm_loadu_si128((const __m128i *)(row + i))));
+  }
+  _min_into_scalar(acc + i, row + i, size - i);
+}
+
+static const pixel_kernels_t _sse_kernels = {
+    .name        = "sse4.2",
+    .rgb_to_gray = _rgb_to_gray_sse,
+    .min_max     = _min_max_sse,
+    .min_into    = _min_into_sse,
+};
+
+/// the 256 bit shuffles stay inside their 128 bit lane, so every load holds
+/// 16 pixels in its low lane and the next 16 in its high lane and each lane
+/// is split exactly like in the sse variant
+AVX2_TARGET static inline __m256i _load_lanes_avx2(const uint8_t *low,
+                                                   const uint8_t *high) {
+  return _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)low)),
+      _mm_loadu_si128((const __m128i *)high), 1);
+}
+
+AVX2_TARGET static inline __m256i _channel_avx2(__m256i a, __m256i b,
+                                                __m256i c, int channel) {
+  const __m128i *masks = (const __m128i *)_rgb_masks[channel];
+  return _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(masks[0])),
+          _mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(masks[1]))),
+      _mm256_shuffle_epi8(c, _mm256_broadcastsi128_si256(masks[2])));
+}
+
+AVX2_TARGET static inline __m256i _abs_diff_avx2(__m256i x, __m256i y) {
+  return _mm256_or_si256(_mm256_subs_epu8(x, y), _mm256_subs_epu8(y, x));
+}
+
+AVX2_TARGET static inline __m256i _spread_avx2(__m256i r, __m256i g,
+                                               __m256i b) {
+  return _mm256_max_epu8(
+      _mm256_max_epu8(_abs_diff_avx2(r, g), _abs_diff_avx2(g, b)),
+      _abs_diff_avx2(r, b));
+}
+
+AVX2_TARGET static inline __m256i _weigh_avx2(__m256i r, __m256i g,
+                                              __m256i b) {
+  __m256i sum = _mm256_mullo_epi16(r, _mm256_set1_epi16(GRAY_WEIGHT_R));
+  sum         = _mm256_add_epi16(
+      sum, _mm256_mullo_epi16(g, _mm256_set1_epi16(GRAY_WEIGHT_G)));
+  sum = _mm256_add_epi16(
+      sum, _mm256_mullo_epi16(b, _mm256_set1_epi16(GRAY_WEIGHT_B)));
+  return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+AVX2_TARGET static bool _rgb_to_gray_avx2(const uint8_t *rgb, uint8_t *gray,
+                                          uint32_t width, uint8_t tolerance) {
+  const __m256i zero   = _mm256_setzero_si256();
+  __m256i       spread = zero;
+  uint32_t      x      = 0;
+  for (; x + 32 <= width; x += 32) {
+    const uint8_t *in = rgb + (size_t)x * 3;
+    __m256i        a  = _load_lanes_avx2(in, in + 48);
+    __m256i        b  = _load_lanes_avx2(in + 16, in + 64);
+    __m256i        c  = _load_lanes_avx2(in + 32, in + 80);
+    __m256i        r  = _channel_avx2(a, b, c, 0);
+    __m256i        g  = _channel_avx2(a, b, c, 1);
+    __m256i        bl = _channel_avx2(a, b, c, 2);
+    spread            = _mm256_max_epu8(spread, _spread_avx2(r, g, bl));
+
+    __m256i lo = _weigh_avx2(_mm256_unpacklo_epi8(r, zero),
+                             _mm256_unpacklo_epi8(g, zero),
+                             _mm256_unpacklo_epi8(bl, zero));
+    __m256i hi = _weigh_avx2(_mm256_unpackhi_epi8(r, zero),
+                             _mm256_unpackhi_epi8(g, zero),
+                             _mm256_unpackhi_epi8(bl, zero));
+    _mm256_storeu_si256((__m256i *)(gray + x), _mm256_packus_epi16(lo, hi));
+  }
+  __m256i limit = _mm256_set1_epi8((char)tolerance);
+  bool    ok    = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                      _mm256_max_epu8(spread, limit), limit)) == UINT32_MAX;
+  return _rgb_to_gray_sse(rgb + (size_t)x * 3, gray + x, width - x,
+                          tolerance) &&
+         ok;
+}
+
+AVX2_TARGET static void _min_max_avx2(const uint8_t *data, size_t size,
+                                      uint8_t *min, uint8_t *max) {
+  if (size < 32) {
+    _min_max_sse(data, size, min, max);
+    return;
+  }
+  __m256i lo = _mm256_loadu_si256((const __m256i *)data);
+  __m256i hi = lo;
+  size_t  i  = 32;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    lo        = _mm256_min_epu8(lo, v);
+    hi        = _mm256_max_epu8(hi, v);
+  }
+  uint8_t lanes[2][32];
+  _mm256_storeu_si256((__m256i *)lanes[0], lo);
+  _mm256_storeu_si256((__m256i *)lanes[1], hi);
+  uint8_t unused;
+  _min_max_scalar(lanes[0], 32, min, &unused);
+  _min_max_scalar(lanes[1], 32, &unused, max);
+  if (i < size) {
+    uint8_t tail_lo, tail_hi;
+    _min_max_sse(data + i, size - i, &tail_lo, &tail_hi);
+    *min = tail_lo < *min ? tail_lo : *min;
+    *max = tail_hi > *max ? tail_hi : *max;
+  }
+}
+
+AVX2_TARGET static void _min_into_avx2(uint8_t *acc, const uint8_t *row,
+                                       size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i *out = (__m256i *)(acc + i);
+    _mm256_storeu_si256(
+        out, _mm256_min_epu8(_mm256_loadu_si256(out),
+                             _mm256_loadu_si256((const __m256i *)(row + i))));
+  }
+  _min_into_sse(acc + i, row + i, size - i);
+}
+
+static const pixel_kernels_t _avx2_kernels = {
+    .name        = "avx2",
+    .rgb_to_gray = _rgb_to_gray_avx2,
+    .min_max     = _min_max_avx2,
+    .min_into    = _min_into_avx2,
+};
+#endif // PIXELS_X86
+
+#ifdef PIXELS_NEON
+static inline uint8x16_t _spread_neon(uint8x16x3_t px) {
+  return vmaxq_u8(vmaxq_u8(vabdq_u8(px.val[0], px.val[1]),
+                           vabdq_u8(px.val[1], px.val[2])),
+                  vabdq_u8(px.val[0], px.val[2]));
+}
+
+/// 8 gray pixels, vrshrn adds the 128 before it shifts
+static inline uint8x8_t _weigh_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+  uint16x8_t sum = vmull_u8(r, vdup_n_u8(GRAY_WEIGHT_R));
+  sum            = vmlal_u8(sum, g, vdup_n_u8(GRAY_WEIGHT_G));
+  sum            = vmlal_u8(sum, b, vdup_n_u8(GRAY_WEIGHT_B));
+  return vrshrn_n_u16(sum, 8);
+}
+
+static bool _rgb_to_gray_neon(const uint8_t *rgb, uint8_t *gray,
+                              uint32_t width, uint8_t tolerance) {
+  uint8x16_t spread = vdupq_n_u8(0);
+  uint32_t   x      = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t px = vld3q_u8(rgb + (size_t)x * 3);
+    spread          = vmaxq_u8(spread, _spread_neon(px));
+    uint8x8_t lo    = _weigh_neon(vget_low_u8(px.val[0]),
+                                  vget_low_u8(px.val[1]),
+                                  vget_low_u8(px.val[2]));
+    uint8x8_t hi    = _weigh_neon(vget_high_u8(px.val[0]),
+                                  vget_high_u8(px.val[1]),
+                                  vget_high_u8(px.val[2]));
+    vst1q_u8(gray + x, vcombine_u8(lo, hi));
+  }
+  bool ok = vmaxvq_u8(spread) <= tolerance;
+  return _rgb_to_gray_scalar(rgb + (size_t)x * 3, gray + x, width - x,
+                             tolerance) &&
+         ok;
+}
+
+static void _min_max_neon(const uint8_t *data, size_t size, uint8_t *min,
+                          uint8_t *max) {
+  if (size < 16) {
+    _min_max_scalar(data, size, min, max);
+    return;
+  }
+  uint8x16_t lo = vld1q_u8(data);
+  uint8x16_t hi = lo;
+  size_t     i  = 16;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t v = vld1q_u8(data + i);
+    lo           = vminq_u8(lo, v);
+    hi           = vmaxq_u8(hi, v);
+  }
+  *min = vminvq_u8(lo);
+  *max = vmaxvq_u8(hi);
+  if (i < size) {
+    uint8_t tail_lo, tail_hi;
+    _min_max_scalar(data + i, size - i, &tail_lo, &tail_hi);
+    *min = tail_lo < *min ? tail_lo : *min;
+    *max = tail_hi > *max ? tail_hi : *max;
+  }
+}
+
+static void _min_into_neon(uint8_t *acc, const uint8_t *row, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    vst1q_u8(acc + i, vminq_u8(vld1q_u8(acc + i), vld1q_u8(row + i)));
+  }
+  _min_into_scalar(acc + i, row + i, size - i);
+}
+
+static const pixel_kernels_t _neon_kernels = {
+    .name        = "neon",
+    .rgb_to_gray = _rgb_to_gray_neon,
+    .min_max     = _min_max_neon,
+    .min_into    = _min_into_neon,
+};
+#endif // PIXELS_NEON
+
+uint32_t pixel_kernels_available(const pixel_kernels_t **variants,
+                                 uint32_t                max) {
+  const pixel_kernels_t *found[MAX_PIXEL_KERNELS];
+  uint32_t               count = 0;
+  found[count++]               = &_scalar_kernels;
+#ifdef PIXELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    found[count++] = &_sse_kernels;
+    // the avx2 tails run the sse variant
+    if (__builtin_cpu_supports("avx2")) {
+      found[count++] = &_avx2_kernels;
+    }
+  }
+#elif defined(PIXELS_NEON)
+  found[count++] = &_neon_kernels; // neon is always there on aarch64
+#endif
+
+  count = count < max ? count : max;
+  for (uint32_t i = 0; i < count; i++) {
+    variants[i] = found[i];
+  }
+  return count;
+}
+
+static pthread_once_t         _pick_once = PTHREAD_ONCE_INIT;
+static const pixel_kernels_t *_picked    = &_scalar_kernels;
+
+/// the variants are listed from slowest to fastest
+static void _pick_kernels(void) {
+  const pixel_kernels_t *variants[MAX_PIXEL_KERNELS];
+  uint32_t count = pixel_kernels_available(variants, MAX_PIXEL_KERNELS);
+  _picked        = variants[count - 1];
+}
+
+const pixel_kernels_t *pixel_kernels(void) {
+  pthread_once(&_pick_once, _pick_kernels);
+  return _picked;
+}
@@ -0,0 +1,69 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// The pixel loops that run over whole pages. Every variant gives exactly the
+/// same results as the scalar one, they only differ in speed
+typedef struct {
+  const char *name;
+
+  /**
+   * Turns a row of rgb pixels into one channel with the weights 77, 150 and
+   * 29 (out of 256)
+   *
+   * @param rgb The row, 3 bytes per pixel
+   * @param gray The output row, 1 byte per pixel
+   * @param width The number of pixels
+   * @param tolerance How far apart the channels of a pixel can be
+   * @return bool false if any pixel has channels more than tolerance apart,
+   * the whole row is converted either way
+   */
+  bool (*rgb_to_gray)(const uint8_t *rgb, uint8_t *gray, uint32_t width,
+                      uint8_t tolerance);
+
+  /**
+   * Finds the smallest and largest byte of a row, the channels are not told
+   * apart
+   *
+   * @param data The row
+   * @param size The number of bytes, at least 1
+   * @param min Pointer that will be set to the smallest byte
+   * @param max Pointer that will be set to the largest byte
+   * @return void
+   */
+  void (*min_max)(const uint8_t *data, size_t size, uint8_t *min,
+                  uint8_t *max);
+
+  /**
+   * Lowers every byte of acc to the byte of row at the same place if that one
+   * is smaller, which gives the min of every column over a run of rows
+   *
+   * @param acc The column mins so far
+   * @param row The row
+   * @param size The number of bytes of both
+   * @return void
+   */
+  void (*min_into)(uint8_t *acc, const uint8_t *row, size_t size);
+} pixel_kernels_t;
+
+/**
+ * Gets the fastest kernels this cpu can run, they are picked on the first call
+ *
+ * @return const pixel_kernels_t* the kernels, never NULL
+ */
+const pixel_kernels_t *pixel_kernels(void);
+
+/**
+ * Lists every variant this cpu can run, starting with the scalar one
+ *
+ * @param variants Array that will be filled in
+ * @param max The length of variants
+ * @return uint32_t the number of variants that were filled in
+ */
+uint32_t pixel_kernels_available(const pixel_kernels_t **variants,
+                                 uint32_t                max);
+
+#endif // PIXELS_H
@@ -0,0 +1,92 @@
+#include "png_chunks.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t _read_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/// calls visit for every chunk after the signature, stops at IEND
+static bool _walk_chunks(const uint8_t *data, uint64_t size,
+                         bool (*visit)(png_chunks_t *, const uint8_t *,
+                                       const uint8_t *, uint32_t),
+                         png_chunks_t *png) {
+  uint64_t pos = 8;
+  // length (4) | type (4) | data | crc (4)
+  while (pos + 12 <= size) {
+    uint32_t       length = _read_be32(data + pos);
+    const uint8_t *type   = data + pos + 4;
+    if (length > size - pos - 12) {
+      return false;
+    }
+    if (memcmp(type, "IEND", 4) == 0) {
+      return true;
+    }
+    if (!visit(png, type, data + pos + 8, length)) {
+      return false;
+    }
+    pos += 12 + (uint64_t)length;
+  }
+  return false; // no IEND
+}
+
+static bool _read_header_chunk(png_chunks_t *png, const uint8_t *type,
+                               const uint8_t *chunk, uint32_t length) {
+  if (memcmp(type, "IHDR", 4) == 0) {
+    if (length < 13) {
+      return false;
+    }
+    png->width      = _read_be32(chunk);
+    png->height     = _read_be32(chunk + 4);
+    png->bit_depth  = chunk[8];
+    png->color_type = chunk[9];
+    png->interlaced = chunk[12] != 0;
+  } else if (memcmp(type, "PLTE", 4) == 0) {
+    png->palette      = chunk;
+    png->palette_size = length / 3;
+  } else if (memcmp(type, "tRNS", 4) == 0) {
+    png->trns      = chunk;
+    png->trns_size = length;
+  } else if (memcmp(type, "IDAT", 4) == 0) {
+    png->idat_size += length;
+  }
+  return true;
+}
+
+static bool _copy_idat_chunk(png_chunks_t *png, const uint8_t *type,
+                             const uint8_t *chunk, uint32_t length) {
+  if (memcmp(type, "IDAT", 4) == 0) {
+    memcpy(png->idat + png->idat_size, chunk, length);
+    png->idat_size += length;
+  }
+  return true;
+}
+
+bool png_chunks_read(const uint8_t *data, uint64_t size, png_chunks_t *png) {
+  static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+  memset(png, 0, sizeof(*png));
+  if (size < 8 || memcmp(data, signature, 8) != 0) {
+    return false;
+  }
+
+  // the first walk finds the size of the stream, the second one copies it
+  if (!_walk_chunks(data, size, _read_header_chunk, png) || png->width == 0 ||
+      png->height == 0 || png->idat_size == 0) {
+    return false;
+  }
+  png->idat = (uint8_t *)malloc(png->idat_size);
+  if (!png->idat) {
+    return false;
+  }
+  png->idat_size = 0;
+  _walk_chunks(data, size, _copy_idat_chunk, png);
+  return true;
+}
+
+void png_chunks_free(png_chunks_t *png) {
+  free(png->idat);
+  png->idat      = NULL;
+  png->idat_size = 0;
+}
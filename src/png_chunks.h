@@ -0,0 +1,43 @@
+#ifndef PNG_CHUNKS_H
+#define PNG_CHUNKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// The chunks of a png that say how its pixels are stored, read without
+/// decoding anything. The palette and the transparency point into the png,
+/// the IDAT chunks are joined into one zlib stream
+typedef struct {
+  uint32_t       width;
+  uint32_t       height;
+  uint8_t        bit_depth;
+  uint8_t        color_type; // as PNG_COLOR_TYPE_* of libpng
+  bool           interlaced;
+  const uint8_t *palette; // rgb triples, NULL if there is no PLTE chunk
+  uint32_t       palette_size; // number of entries
+  const uint8_t *trns;         // the tRNS chunk, NULL if there is none
+  uint32_t       trns_size;
+  uint8_t       *idat; // the zlib stream, free with png_chunks_free
+  uint64_t       idat_size;
+} png_chunks_t;
+
+/**
+ * Walks the chunks of a png up to IEND
+ *
+ * @param data The png, it has to outlive the chunks
+ * @param size The size of data
+ * @param png Pointer to the chunks that will be filled in
+ * @return bool false if the png is malformed or memory ran out, nothing has
+ * to be freed then
+ */
+bool png_chunks_read(const uint8_t *data, uint64_t size, png_chunks_t *png);
+
+/**
+ * Frees the joined IDAT stream
+ *
+ * @param png Pointer to the chunks
+ * @return void
+ */
+void png_chunks_free(png_chunks_t *png);
+
+#endif // PNG_CHUNKS_H
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L /* for pread, pwrite and fileno */
+#include "reorder_buffer.h"
+#include "cli.h"
+#include "extras.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// pread and pwrite can stop short, so they are repeated until everything is
+/// done
+static bool _pwrite_all(int fd, const uint8_t *data, uint64_t size,
+                        uint64_t offset) {
+  while (size > 0) {
+    ssize_t done = pwrite(fd, data, size, (off_t)offset);
+    if (done <= 0) {
+      return false;
+    }
+    data   += done;
+    size   -= (uint64_t)done;
+    offset += (uint64_t)done;
+  }
+  return true;
+}
+
+static bool _pread_all(int fd, uint8_t *data, uint64_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t done = pread(fd, data, size, (off_t)offset);
+    if (done <= 0) {
+      return false;
+    }
+    data   += done;
+    size   -= (uint64_t)done;
+    offset += (uint64_t)done;
+  }
+  return true;
+}
+
+bool reorder_buffer_init(const cli_flags_t *cli_flags,
+                         reorder_buffer_t *buffer, uint32_t count,
+                         const uint32_t needs[], uint32_t window,
+                         uint64_t memory_limit) {
+  memset(buffer, 0, sizeof(*buffer));
+  // calloc leaves every slot REORDER_PENDING
+  buffer->slots = (reorder_slot_t *)callocv(*cli_flags, "slots", MAX(count, 1),
+                                            sizeof(reorder_slot_t), -1);
+  // every freed stretch was a slot, the ones next to each other are merged
+  buffer->free_spill = (reorder_extent_t *)callocv(
+      *cli_flags, "free_spill", MAX(count, 1), sizeof(reorder_extent_t), -1);
+  if (!buffer->slots || !buffer->free_spill) {
+    freev(*cli_flags, buffer->slots, "slots", -1);
+    freev(*cli_flags, buffer->free_spill, "free_spill", -1);
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    buffer->slots[i].need = needs[i];
+  }
+  buffer->count        = count;
+  buffer->window       = MAX(window, 1);
+  buffer->memory_limit = memory_limit;
+  pthread_mutex_init(&buffer->lock, NULL);
+  pthread_cond_init(&buffer->changed, NULL);
+  return true;
+}
+
+/// the slot in memory that is needed last, -1 if there is none. Empty slots
+/// free nothing when they are spilled
+static int64_t _pick_spill(const reorder_buffer_t *buffer) {
+  int64_t last = -1;
+  for (uint32_t i = 0; i < buffer->count; i++) {
+    const reorder_slot_t *slot = &buffer->slots[i];
+    if (slot->state == REORDER_MEMORY && slot->size > 0 &&
+        (last < 0 || slot->need > buffer->slots[last].need)) {
+      last = i;
+    }
+  }
+  return last;
+}
+
+/// the first freed stretch of the spill file that fits size bytes, -1 if the
+/// slot has to go at the end of the file
+static int64_t _find_spill(const reorder_buffer_t *buffer, uint64_t size) {
+  for (uint32_t i = 0; i < buffer->free_count; i++) {
+    if (buffer->free_spill[i].size >= size) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/// uses up the front of freed stretch i, or the end of the file for -1
+static void _claim_spill(reorder_buffer_t *buffer, int64_t i, uint64_t size) {
+  if (i < 0) {
+    buffer->spill_size += size;
+    return;
+  }
+  reorder_extent_t *extent  = &buffer->free_spill[i];
+  extent->offset           += size;
+  extent->size             -= size;
+  if (extent->size == 0) {
+    buffer->free_count--;
+    memmove(extent, extent + 1,
+            (buffer->free_count - i) * sizeof(reorder_extent_t));
+  }
+}
+
+/// gives a stretch of the spill file back, it is merged with the freed
+/// stretches next to it and the end of the file
+static void _release_spill(reorder_buffer_t *buffer, uint64_t offset,
+                           uint64_t size) {
+  if (size == 0) {
+    return;
+  }
+  uint32_t i = 0;
+  while (i < buffer->free_count && buffer->free_spill[i].offset < offset) {
+    i++;
+  }
+  reorder_extent_t *before = i > 0 ? &buffer->free_spill[i - 1] : NULL;
+  reorder_extent_t *after =
+      i < buffer->free_count ? &buffer->free_spill[i] : NULL;
+  if (before && before->offset + before->size == offset) {
+    before->size += size;
+    if (after && offset + size == after->offset) {
+      before->size += after->size;
+      buffer->free_count--;
+      memmove(after, after + 1,
+              (buffer->free_count - i) * sizeof(reorder_extent_t));
+    }
+  } else if (after && offset + size == after->offset) {
+    after->offset  = offset;
+    after->size   += size;
+  } else {
+    memmove(&buffer->free_spill[i + 1], &buffer->free_spill[i],
+            (buffer->free_count - i) * sizeof(reorder_extent_t));
+    buffer->free_spill[i] = (reorder_extent_t){offset, size};
+    buffer->free_count++;
+  }
+  // the last stretch is not kept, the end of the file moves back instead
+  reorder_extent_t *last = &buffer->free_spill[buffer->free_count - 1];
+  if (last->offset + last->size == buffer->spill_size) {
+    buffer->spill_size = last->offset;
+    buffer->free_count--;
+  }
+}
+
+/// moves slots to the temp file until the buffer is back under its limit, a
+/// slot that can not be written is kept in memory
+static void _spill(const cli_flags_t *cli_flags, reorder_buffer_t *buffer) {
+  while (buffer->memory > buffer->memory_limit) {
+    int64_t i = _pick_spill(buffer);
+    if (i < 0) {
+      return;
+    }
+    if (!buffer->spill && !(buffer->spill = tmpfile())) {
+      printfv(*cli_flags, RED, "Failed to create the read ahead temp file\n");
+      buffer->memory_limit = UINT64_MAX; // keep everything in memory
+      return;
+    }
+
+    reorder_slot_t *slot   = &buffer->slots[i];
+    int64_t         extent = _find_spill(buffer, slot->size);
+    uint64_t        offset =
+        extent < 0 ? buffer->spill_size : buffer->free_spill[extent].offset;
+    if (!_pwrite_all(fileno(buffer->spill), slot->data, slot->size, offset)) {
+      printfv(*cli_flags, RED, "Failed to write the read ahead temp file\n");
+      buffer->memory_limit = UINT64_MAX;
+      return;
+    }
+    _claim_spill(buffer, extent, slot->size);
+    freev(*cli_flags, slot->data, "slot->data", -1);
+    slot->state     = REORDER_SPILLED;
+    slot->offset    = offset;
+    buffer->memory -= slot->size;
+    buffer->spilled++;
+  }
+}
+
+bool reorder_buffer_wait(reorder_buffer_t *buffer, uint32_t slot) {
+  uint32_t need = buffer->slots[slot].need;
+  pthread_mutex_lock(&buffer->lock);
+  while ((uint64_t)need >= (uint64_t)buffer->reached + buffer->window &&
+         buffer->starving == 0) {
+    pthread_cond_wait(&buffer->changed, &buffer->lock);
+  }
+  bool keep = (uint64_t)need < (uint64_t)buffer->reached + buffer->window;
+  pthread_mutex_unlock(&buffer->lock);
+  return keep;
+}
+
+void reorder_buffer_put(const cli_flags_t *cli_flags, reorder_buffer_t *buffer,
+                        uint32_t slot, uint8_t *data, uint64_t size) {
+  pthread_mutex_lock(&buffer->lock);
+  reorder_slot_t *entry = &buffer->slots[slot];
+  entry->data           = data;
+  entry->size           = data ? size : 0;
+  entry->state          = data ? REORDER_MEMORY : REORDER_GONE;
+  buffer->memory       += entry->size;
+  if (entry->wanted) {
+    buffer->starving--;
+  }
+  _spill(cli_flags, buffer);
+  pthread_cond_broadcast(&buffer->changed);
+  pthread_mutex_unlock(&buffer->lock);
+}
+
+bool reorder_buffer_take(const cli_flags_t *cli_flags,
+                         reorder_buffer_t *buffer, uint32_t slot,
+                         uint8_t **data, uint64_t *size) {
+  pthread_mutex_lock(&buffer->lock);
+  reorder_slot_t *entry = &buffer->slots[slot];
+  // the producer may be waiting to read further ahead, and while this
+  // consumer starves it has to skip ahead to the slot instead
+  buffer->reached = MAX(buffer->reached, entry->need);
+  if (entry->state == REORDER_PENDING && !entry->wanted) {
+    entry->wanted = true;
+    buffer->starving++;
+  }
+  pthread_cond_broadcast(&buffer->changed);
+  while (entry->state == REORDER_PENDING) {
+    pthread_cond_wait(&buffer->changed, &buffer->lock);
+  }
+  reorder_state_e state = entry->state;
+  *data                 = entry->data;
+  *size                 = entry->size;
+  if (state == REORDER_MEMORY) {
+    buffer->memory -= entry->size;
+  }
+  uint64_t offset = entry->offset;
+  entry->state    = REORDER_GONE;
+  entry->data     = NULL;
+  pthread_mutex_unlock(&buffer->lock);
+
+  if (state != REORDER_SPILLED) {
+    return state == REORDER_MEMORY;
+  }
+  // the stretch is only given back once it is read, so it is read without
+  // the lock
+  *data   = (uint8_t *)mallocv(*cli_flags, "data", MAX(*size, 1), -1);
+  bool ok = *data && _pread_all(fileno(buffer->spill), *data, *size, offset);
+  if (*data && !ok) {
+    printfv(*cli_flags, RED, "Failed to read back the read ahead temp file\n");
+    freev(*cli_flags, *data, "data", -1);
+  }
+  pthread_mutex_lock(&buffer->lock);
+  _release_spill(buffer, offset, *size);
+  pthread_mutex_unlock(&buffer->lock);
+  return ok;
+}
+
+void reorder_buffer_free(const cli_flags_t *cli_flags,
+                         reorder_buffer_t  *buffer) {
+  for (uint32_t i = 0; i < buffer->count; i++) {
+    freev(*cli_flags, buffer->slots[i].data, "slots[].data", i);
+  }
+  freev(*cli_flags, buffer->slots, "slots", -1);
+  freev(*cli_flags, buffer->free_spill, "free_spill", -1);
+  if (buffer->spill) {
+    fclose(buffer->spill);
+    buffer->spill = NULL;
+  }
+  pthread_mutex_destroy(&buffer->lock);
+  pthread_cond_destroy(&buffer->changed);
+}
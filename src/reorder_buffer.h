@@ -0,0 +1,126 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include "cli.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  REORDER_PENDING, // not put yet
+  REORDER_MEMORY,
+  REORDER_SPILLED,
+  REORDER_GONE, // taken already, or put without data
+} reorder_state_e;
+
+/// a free stretch of the spill file
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+} reorder_extent_t;
+
+typedef struct {
+  reorder_state_e state;
+  uint32_t        need; // when the slot will be taken, lower is sooner
+  uint8_t        *data; // only for REORDER_MEMORY
+  uint64_t        offset; // in the spill file, only for REORDER_SPILLED
+  uint64_t        size;
+  bool            wanted; // a consumer waits for it while it is pending
+} reorder_slot_t;
+
+/// Hands buffers from a producer that puts them in one order to consumers
+/// that take them in another. The producer only reads a window of needs past
+/// the latest slot a consumer asked for, so the buffer stays bounded. Buffers
+/// stay in memory up to memory_limit bytes, past that the ones that are
+/// needed last are moved to a temp file whose freed stretches are reused.
+/// All functions but init and free are thread safe
+typedef struct {
+  reorder_slot_t   *slots;
+  uint32_t          count;
+  uint32_t          window;
+  uint32_t          reached;  // highest need a consumer asked for so far
+  uint32_t          starving; // pending slots that a consumer waits for
+  uint64_t          memory;   // bytes of the slots in memory
+  uint64_t          memory_limit;
+  FILE             *spill;      // created on the first spill, deleted later
+  uint64_t          spill_size; // end of the spill file
+  reorder_extent_t *free_spill; // freed stretches, sorted by offset
+  uint32_t          free_count;
+  uint32_t          spilled; // number of slots that were spilled
+  pthread_mutex_t   lock;
+  pthread_cond_t    changed;
+} reorder_buffer_t;
+
+/**
+ * Initializes a buffer with count pending slots
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param buffer Pointer to the buffer
+ * @param count The number of slots
+ * @param needs When every slot will be taken, lower is sooner
+ * @param window How many needs past the latest slot a consumer asked for are
+ * read ahead
+ * @param memory_limit The max bytes held in memory before slots are spilled
+ * @return bool false if memory ran out
+ */
+bool reorder_buffer_init(const cli_flags_t *cli_flags,
+                         reorder_buffer_t *buffer, uint32_t count,
+                         const uint32_t needs[], uint32_t window,
+                         uint64_t memory_limit);
+
+/**
+ * Called by the producer before it reads a slot. Waits while the slot is
+ * needed more than a window past the latest slot a consumer asked for, but
+ * not while a consumer waits for a pending slot, since that slot may only
+ * come after this one
+ *
+ * @param buffer Pointer to the buffer
+ * @param slot The slot that is about to be read
+ * @return bool false if the slot is too far ahead and should be put without
+ * data, its consumer then reads it on its own
+ */
+bool reorder_buffer_wait(reorder_buffer_t *buffer, uint32_t slot);
+
+/**
+ * Fills a slot and wakes whoever waits for it. If the buffer goes over its
+ * memory limit the slots that are needed last are spilled, which can be the
+ * one that was just put
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param buffer Pointer to the buffer
+ * @param slot The slot to fill, it has to be pending
+ * @param data The buffer takes ownership of it, NULL if it could not be read
+ * @param size The size of data
+ * @return void
+ */
+void reorder_buffer_put(const cli_flags_t *cli_flags, reorder_buffer_t *buffer,
+                        uint32_t slot, uint8_t *data, uint64_t size);
+
+/**
+ * Takes the data out of a slot, waits until it is put if it is pending. A
+ * slot can only be taken once
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param buffer Pointer to the buffer
+ * @param slot The slot to take
+ * @param data Pointer that will be set to the data, free with free
+ * @param size Pointer that will be set to the size of data
+ * @return bool false if the slot was taken already, was put without data or
+ * could not be read back from the temp file
+ */
+bool reorder_buffer_take(const cli_flags_t *cli_flags,
+                         reorder_buffer_t *buffer, uint32_t slot,
+                         uint8_t **data, uint64_t *size);
+
+/**
+ * Frees every slot that was not taken and deletes the temp file
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param buffer Pointer to the buffer
+ * @return void
+ */
+void reorder_buffer_free(const cli_flags_t *cli_flags,
+                         reorder_buffer_t  *buffer);
+
+#endif // REORDER_BUFFER_H
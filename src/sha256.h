@@ -0,0 +1,43 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length; // bytes hashed so far
+  uint8_t  block[64];
+  uint32_t block_len;
+} sha256_t;
+
+/**
+ * Starts a new hash
+ *
+ * @param sha Pointer to the hash state
+ * @return void
+ */
+void sha256_init(sha256_t *sha);
+
+/**
+ * Hashes more data, can be called any number of times
+ *
+ * @param sha Pointer to the hash state
+ * @param data The data
+ * @param size The size of data
+ * @return void
+ */
+void sha256_update(sha256_t *sha, const void *data, size_t size);
+
+/**
+ * Finishes the hash
+ *
+ * @param sha Pointer to the hash state, it has to be started again after this
+ * @param digest The digest that will be filled in
+ * @return void
+ */
+void sha256_final(sha256_t *sha, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif // SHA256_H
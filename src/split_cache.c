@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L /* for strdup */
+#include "split_cache.h"
+#include "cli.h"
+#include "extras.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void _clear_entry(const cli_flags_t *cli_flags,
+                         split_cache_entry_t *entry) {
+  free(entry->cbz_path);
+  freev(*cli_flags, entry->data, "entry->data", -1);
+  memset(entry, 0, sizeof(*entry));
+}
+
+static int64_t _find_entry(const split_cache_t *cache, const char *cbz_path,
+                           uint64_t index) {
+  for (uint32_t i = 0; i < cache->capacity; i++) {
+    const split_cache_entry_t *entry = &cache->entries[i];
+    if (entry->cbz_path && entry->index == index &&
+        strcmp(entry->cbz_path, cbz_path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/// a free slot if there is one, otherwise the least recently stored half.
+/// Spreads that are still being split are never dropped, -1 if every slot
+/// holds one
+static int64_t _pick_slot(const split_cache_t *cache) {
+  int64_t oldest = -1;
+  for (uint32_t i = 0; i < cache->capacity; i++) {
+    const split_cache_entry_t *entry = &cache->entries[i];
+    if (!entry->cbz_path) {
+      return i;
+    }
+    if (entry->half != DOUBLE_PAGE_FALSE &&
+        (oldest < 0 || entry->last_used < cache->entries[oldest].last_used)) {
+      oldest = i;
+    }
+  }
+  return oldest;
+}
+
+bool split_cache_init(const cli_flags_t *cli_flags, split_cache_t *cache,
+                      uint32_t capacity) {
+  memset(cache, 0, sizeof(*cache));
+  cache->capacity = MAX(capacity, 1);
+  cache->entries  = (split_cache_entry_t *)callocv(
+      *cli_flags, "cache->entries", cache->capacity,
+      sizeof(split_cache_entry_t), -1);
+  if (!cache->entries) {
+    return false;
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+  pthread_cond_init(&cache->stored, NULL);
+  return true;
+}
+
+/// drops the oldest half to make room, the thread that splits the spread
+/// drops its placeholder in split_cache_put
+static void _make_room(const cli_flags_t *cli_flags, split_cache_t *cache,
+                       split_cache_entry_t *entry) {
+  if (!entry->cbz_path) {
+    return;
+  }
+  printfv(*cli_flags, DARK_YELLOW,
+          "Dropping the cached half of entry %" PRIu64 " in %s\n",
+          entry->index, entry->cbz_path);
+  _clear_entry(cli_flags, entry);
+}
+
+bool split_cache_take(const cli_flags_t *cli_flags, split_cache_t *cache,
+                      const char *cbz_path, uint64_t index,
+                      double_page_mode_e half, uint8_t **data,
+                      uint64_t *size) {
+  char *path = strdup(cbz_path);
+
+  pthread_mutex_lock(&cache->lock);
+  int64_t i;
+  while ((i = _find_entry(cache, cbz_path, index)) >= 0 &&
+         cache->entries[i].half == DOUBLE_PAGE_FALSE) {
+    pthread_cond_wait(&cache->stored, &cache->lock);
+  }
+  if (i >= 0 && cache->entries[i].half == half) {
+    split_cache_entry_t *entry = &cache->entries[i];
+    *data                      = entry->data;
+    *size                      = entry->size;
+    free(entry->cbz_path);
+    memset(entry, 0, sizeof(*entry));
+    pthread_mutex_unlock(&cache->lock);
+    free(path);
+    return true;
+  }
+
+  // this thread splits the spread, a placeholder makes the other half wait
+  // for it. Without room the other half may be split a second time
+  if (i < 0 && path && (i = _pick_slot(cache)) >= 0) {
+    split_cache_entry_t *entry = &cache->entries[i];
+    _make_room(cli_flags, cache, entry);
+    entry->cbz_path  = path;
+    entry->index     = index;
+    entry->half      = DOUBLE_PAGE_FALSE;
+    entry->last_used = ++cache->clock;
+    path             = NULL;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  free(path);
+  return false;
+}
+
+void split_cache_put(const cli_flags_t *cli_flags, split_cache_t *cache,
+                     const char *cbz_path, uint64_t index,
+                     double_page_mode_e half, uint8_t *data, uint64_t size) {
+  pthread_mutex_lock(&cache->lock);
+  int64_t i = _find_entry(cache, cbz_path, index);
+  if (i >= 0 && cache->entries[i].half != DOUBLE_PAGE_FALSE) {
+    i = -1; // a half that was stored already is not the placeholder
+  }
+  if (!data) {
+    if (i >= 0) {
+      _clear_entry(cli_flags, &cache->entries[i]);
+    }
+  } else if (i < 0) {
+    // the placeholder could not be made, so the half only fits if there is
+    // room for it
+    char *path = strdup(cbz_path);
+    i          = path ? _pick_slot(cache) : -1;
+    if (i >= 0) {
+      _make_room(cli_flags, cache, &cache->entries[i]);
+      cache->entries[i].cbz_path = path;
+      cache->entries[i].index    = index;
+    } else {
+      free(path);
+      freev(*cli_flags, data, "data", -1);
+    }
+  }
+  if (data && i >= 0) {
+    split_cache_entry_t *entry = &cache->entries[i];
+    entry->half                = half;
+    entry->data                = data;
+    entry->size                = size;
+    entry->last_used           = ++cache->clock;
+  }
+  pthread_cond_broadcast(&cache->stored);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void split_cache_free(const cli_flags_t *cli_flags, split_cache_t *cache) {
+  if (!cache->entries) {
+    return;
+  }
+  for (uint32_t i = 0; i < cache->capacity; i++) {
+    if (cache->entries[i].cbz_path) {
+      _clear_entry(cli_flags, &cache->entries[i]);
+    }
+  }
+  freev(*cli_flags, cache->entries, "cache->entries", -1);
+  pthread_mutex_destroy(&cache->lock);
+  pthread_cond_destroy(&cache->stored);
+}
@@ -0,0 +1,95 @@
+#ifndef SPLIT_CACHE_H
+#define SPLIT_CACHE_H
+
+#include "cli.h"
+#include "extras.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  char              *cbz_path; // NULL for a free slot
+  uint64_t           index;    // entry index inside the archive
+  double_page_mode_e half; // the half that is kept, DOUBLE_PAGE_FALSE while
+                           // the spread is still being split
+  uint8_t           *data;
+  uint64_t           size;
+  uint64_t           last_used;
+} split_cache_entry_t;
+
+/// Holds the half of a split spread that was not asked for yet, so a spread
+/// is only read and decoded once even when its halves end up on different
+/// sheets. The first sheet to ask for a spread gets to split it, a sheet that
+/// asks for the other half meanwhile waits for it instead of splitting the
+/// spread again. A half is handed out once and then dropped, the least
+/// recently stored one is dropped when the cache is full. All functions but
+/// init and free are thread safe
+typedef struct {
+  split_cache_entry_t *entries;
+  uint32_t             capacity;
+  uint64_t             clock;
+  pthread_mutex_t      lock;
+  pthread_cond_t       stored;
+} split_cache_t;
+
+/**
+ * Initializes an empty split cache
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @param capacity The most spreads that are held or being split at once,
+ * twice the pages in flight leaves room for a half next to every split
+ * @return bool false if memory ran out
+ */
+bool split_cache_init(const cli_flags_t *cli_flags, split_cache_t *cache,
+                      uint32_t capacity);
+
+/**
+ * Takes a half out of the cache, the caller owns the data afterwards. Waits
+ * while another thread splits the spread. If the spread is not in the cache
+ * the caller is made the one to split it and has to call split_cache_put
+ * afterwards, even when the split fails
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @param cbz_path The path of the archive the spread is in
+ * @param index The entry index of the spread inside the archive
+ * @param half DOUBLE_PAGE_LEFT or DOUBLE_PAGE_RIGHT
+ * @param data Pointer that will be set to the half, free with free
+ * @param size Pointer that will be set to the size of the half
+ * @return bool true if the half was in the cache
+ */
+bool split_cache_take(const cli_flags_t *cli_flags, split_cache_t *cache,
+                      const char *cbz_path, uint64_t index,
+                      double_page_mode_e half, uint8_t **data,
+                      uint64_t *size);
+
+/**
+ * Stores the half that was not asked for after a split and wakes the threads
+ * that wait for it, the cache takes ownership of data. data is freed right
+ * away if it cannot be stored
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @param cbz_path The path of the archive the spread is in
+ * @param index The entry index of the spread inside the archive
+ * @param half DOUBLE_PAGE_LEFT or DOUBLE_PAGE_RIGHT
+ * @param data The half, allocated with malloc. NULL if the split failed, a
+ * waiting thread then splits the spread itself
+ * @param size The size of data
+ * @return void
+ */
+void split_cache_put(const cli_flags_t *cli_flags, split_cache_t *cache,
+                     const char *cbz_path, uint64_t index,
+                     double_page_mode_e half, uint8_t *data, uint64_t size);
+
+/**
+ * Frees every half that was never taken
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param cache Pointer to the cache
+ * @return void
+ */
+void split_cache_free(const cli_flags_t *cli_flags, split_cache_t *cache);
+
+#endif // SPLIT_CACHE_H
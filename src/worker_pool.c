@@ -0,0 +1,192 @@
+#include "worker_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+  worker_job_fn        job;
+  void                *ctx;
+  uint32_t             count;
+  atomic_uint_fast32_t next;
+} worker_pool_t;
+
+typedef struct {
+  worker_job_fn   job;
+  worker_emit_fn  emit;
+  void           *ctx;
+  uint32_t        count;
+  uint32_t        window;
+  uint32_t        next;      // next index to hand out
+  uint32_t        next_emit; // next index to emit
+  bool            emitting;
+  bool           *done;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} ordered_pool_t;
+
+typedef struct {
+  worker_pool_t  *pool;
+  ordered_pool_t *ordered;
+  uint32_t        worker;
+} worker_t;
+
+static void *_worker_main(void *arg) {
+  worker_t      *worker = (worker_t *)arg;
+  worker_pool_t *pool   = worker->pool;
+
+  for (;;) {
+    uint32_t index = (uint32_t)atomic_fetch_add(&pool->next, 1);
+    if (index >= pool->count) {
+      break;
+    }
+    pool->job(pool->ctx, index, worker->worker);
+  }
+  return NULL;
+}
+
+void run_parallel(uint32_t jobs, uint32_t count, worker_job_fn job, void *ctx) {
+  if (jobs > count) {
+    jobs = count;
+  }
+  if (jobs <= 1) {
+    for (uint32_t i = 0; i < count; i++) {
+      job(ctx, i, 0);
+    }
+    return;
+  }
+
+  worker_pool_t pool = {.job = job, .ctx = ctx, .count = count};
+  atomic_init(&pool.next, 0);
+
+  pthread_t *threads = (pthread_t *)malloc(jobs * sizeof(pthread_t));
+  worker_t  *workers = (worker_t *)malloc(jobs * sizeof(worker_t));
+  if (!threads || !workers) {
+    free(threads);
+    free(workers);
+    for (uint32_t i = 0; i < count; i++) {
+      job(ctx, i, 0);
+    }
+    return;
+  }
+
+  // the caller is worker 0, so only jobs - 1 threads are spawned
+  uint32_t spawned = 0;
+  for (uint32_t i = 1; i < jobs; i++) {
+    workers[i].pool   = &pool;
+    workers[i].worker = i;
+    if (pthread_create(&threads[i], NULL, _worker_main, &workers[i]) != 0) {
+      break;
+    }
+    spawned++;
+  }
+  workers[0].pool   = &pool;
+  workers[0].worker = 0;
+  _worker_main(&workers[0]);
+
+  for (uint32_t i = 1; i <= spawned; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  free(workers);
+}
+
+static void *_ordered_worker_main(void *arg) {
+  worker_t       *worker = (worker_t *)arg;
+  ordered_pool_t *pool   = worker->ordered;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    // wait until the index is inside the window
+    while (pool->next < pool->count &&
+           pool->next - pool->next_emit >= pool->window) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->next >= pool->count) {
+      break;
+    }
+    uint32_t index = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->job(pool->ctx, index, worker->worker);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->done[index] = true;
+    // only one thread emits at a time, any other finished index is picked up
+    // by the loop of the thread that is already emitting
+    if (pool->emitting) {
+      continue;
+    }
+    pool->emitting = true;
+    while (pool->next_emit < pool->count && pool->done[pool->next_emit]) {
+      uint32_t emit_index = pool->next_emit;
+      pthread_mutex_unlock(&pool->lock);
+      pool->emit(pool->ctx, emit_index);
+      pthread_mutex_lock(&pool->lock);
+      pool->next_emit++;
+      pthread_cond_broadcast(&pool->cond);
+    }
+    pool->emitting = false;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+void run_ordered(uint32_t jobs, uint32_t count, uint32_t window,
+                 worker_job_fn job, worker_emit_fn emit, void *ctx) {
+  if (window == 0) {
+    window = 1;
+  }
+  if (jobs > window) {
+    jobs = window; // any more could never start
+  }
+  if (jobs > count) {
+    jobs = count;
+  }
+
+  ordered_pool_t pool = {.job    = job,
+                         .emit   = emit,
+                         .ctx    = ctx,
+                         .count  = count,
+                         .window = window,
+                         .done   = (bool *)calloc(count ? count : 1, 1)};
+  pthread_t     *threads = (pthread_t *)malloc(jobs * sizeof(pthread_t));
+  worker_t      *workers = (worker_t *)malloc(jobs * sizeof(worker_t));
+  if (jobs <= 1 || !pool.done || !threads || !workers) {
+    free(pool.done);
+    free(threads);
+    free(workers);
+    for (uint32_t i = 0; i < count; i++) {
+      job(ctx, i, 0);
+      emit(ctx, i);
+    }
+    return;
+  }
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+
+  // the caller is worker 0, so only jobs - 1 threads are spawned
+  uint32_t spawned = 0;
+  for (uint32_t i = 1; i < jobs; i++) {
+    workers[i].ordered = &pool;
+    workers[i].worker  = i;
+    if (pthread_create(&threads[i], NULL, _ordered_worker_main, &workers[i]) !=
+        0) {
+      break;
+    }
+    spawned++;
+  }
+  workers[0].ordered = &pool;
+  workers[0].worker  = 0;
+  _ordered_worker_main(&workers[0]);
+
+  for (uint32_t i = 1; i <= spawned; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.done);
+  free(threads);
+  free(workers);
+}
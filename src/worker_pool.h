@@ -0,0 +1,56 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdint.h>
+
+/**
+ * A job that is run once for every index
+ *
+ * @param ctx Pointer to the shared context passed to run_parallel
+ * @param index The index of the item to work on
+ * @param worker The id of the worker running the job, [0, jobs)
+ * @return void
+ */
+typedef void (*worker_job_fn)(void *ctx, uint32_t index, uint32_t worker);
+
+/**
+ * Runs job for every index in [0, count) on a pool of worker threads and
+ * waits for all of them to finish. Indexes are handed out in increasing order
+ * but may finish in any order, so the job should write its result into a slot
+ * owned by its index
+ *
+ * @param jobs The number of worker threads, 1 or less runs on the caller
+ * @param count The number of indexes
+ * @param job The job to run
+ * @param ctx Pointer to the shared context
+ * @return void
+ */
+void run_parallel(uint32_t jobs, uint32_t count, worker_job_fn job, void *ctx);
+
+/**
+ * Called once for every index, in increasing order and never concurrently
+ *
+ * @param ctx Pointer to the shared context passed to run_ordered
+ * @param index The index whose job has finished
+ * @return void
+ */
+typedef void (*worker_emit_fn)(void *ctx, uint32_t index);
+
+/**
+ * Runs job for every index in [0, count) on a pool of worker threads and
+ * calls emit for each index in order as soon as it and every index before it
+ * are done. At most window indexes are in flight (started but not emitted),
+ * which bounds the memory held by finished but unemitted results
+ *
+ * @param jobs The number of worker threads, 1 or less runs on the caller
+ * @param count The number of indexes
+ * @param window The max number of indexes in flight, at least 1
+ * @param job The job to run
+ * @param emit The function to call in order
+ * @param ctx Pointer to the shared context
+ * @return void
+ */
+void run_ordered(uint32_t jobs, uint32_t count, uint32_t window,
+                 worker_job_fn job, worker_emit_fn emit, void *ctx);
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,654 @@
+#define _POSIX_C_SOURCE 200809L /* for strdup, localtime_r, fseeko, mkstemp */
+#include "zip_writer.h"
+#include "cli.h"
+#include "compression.h"
+#include "extras.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ZIP_LOCAL_HEADER_SIG   0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define ZIP_EOCD_SIG           0x06054b50
+#define ZIP64_EOCD_SIG         0x06064b50
+#define ZIP64_LOCATOR_SIG      0x07064b50
+#define ZIP64_EXTRA_ID         0x0001
+#define ZIP_UINT16_MAX         0xFFFF
+#define ZIP_UINT32_MAX         0xFFFFFFFF
+#define ZIP_VERSION_MADE_BY    ((3 << 8) | 45) // unix, spec 4.5
+#define ZIP_WRITE_BUFFER_SIZE  (1 << 20)
+
+/// zlib takes uInt lengths, anything bigger is fed in chunks
+#define ZLIB_CHUNK_SIZE (1u << 30)
+
+static uint8_t *_put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  return p + 2;
+}
+
+static uint8_t *_put32(uint8_t *p, uint32_t v) {
+  p = _put16(p, v & 0xFFFF);
+  return _put16(p, (v >> 16) & 0xFFFF);
+}
+
+static uint8_t *_put64(uint8_t *p, uint64_t v) {
+  p = _put32(p, v & ZIP_UINT32_MAX);
+  return _put32(p, (v >> 32) & ZIP_UINT32_MAX);
+}
+
+static uint16_t _get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t _get32(const uint8_t *p) {
+  return (uint32_t)_get16(p) | ((uint32_t)_get16(p + 2) << 16);
+}
+
+static uint64_t _get64(const uint8_t *p) {
+  return (uint64_t)_get32(p) | ((uint64_t)_get32(p + 4) << 32);
+}
+
+static uint32_t _crc32(const uint8_t *data, uint64_t size) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  while (size > 0) {
+    uInt chunk = (uInt)MIN(size, (uint64_t)ZLIB_CHUNK_SIZE);
+    crc        = crc32(crc, data, chunk);
+    data      += chunk;
+    size      -= chunk;
+  }
+  return (uint32_t)crc;
+}
+
+static bool _deflate(zip_blob_t *blob, const uint8_t *data, uint64_t size,
+                     uint32_t level) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // negative window bits give a raw deflate stream, which is what zip wants
+  if (deflateInit2(&stream, (int)level, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  uint64_t capacity = deflateBound(&stream, size);
+  blob->data        = (uint8_t *)malloc(capacity);
+  if (!blob->data) {
+    deflateEnd(&stream);
+    return false;
+  }
+
+  uint64_t in_left  = size;
+  uint64_t out_left = capacity;
+  stream.next_in    = (Bytef *)data;
+  stream.next_out   = blob->data;
+  int ret;
+  do {
+    if (stream.avail_in == 0) {
+      stream.avail_in  = (uInt)MIN(in_left, (uint64_t)ZLIB_CHUNK_SIZE);
+      in_left         -= stream.avail_in;
+    }
+    if (stream.avail_out == 0) {
+      stream.avail_out  = (uInt)MIN(out_left, (uint64_t)ZLIB_CHUNK_SIZE);
+      out_left         -= stream.avail_out;
+    }
+    ret = deflate(&stream, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+  } while (ret == Z_OK);
+  deflateEnd(&stream);
+
+  if (ret != Z_STREAM_END) {
+    free(blob->data);
+    blob->data = NULL;
+    return false;
+  }
+  blob->size = stream.total_out;
+  return true;
+}
+
+bool zip_blob_from_buffer(zip_blob_t *blob, uint8_t *data, uint64_t size,
+                          compression_choice_t choice) {
+  blob->uncompressed_size = size;
+  blob->crc               = _crc32(data, size);
+
+  if (choice.method == COMPRESSION_METHOD_DEFLATE) {
+    blob->method = COMPRESSION_METHOD_DEFLATE;
+    bool ok      = _deflate(blob, data, size, choice.level);
+    free(data);
+    return ok;
+  }
+
+  blob->method = COMPRESSION_METHOD_STORE;
+  blob->data   = data;
+  blob->size   = size;
+  return true;
+}
+
+static bool _inflate(const zip_blob_t *blob, uint8_t *data, uint64_t size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    return false;
+  }
+
+  uint64_t in_left  = blob->size;
+  uint64_t out_left = size;
+  stream.next_in    = blob->data;
+  stream.next_out   = data;
+  int ret           = Z_OK;
+  while (ret == Z_OK && stream.total_out < size) {
+    if (stream.avail_in == 0) {
+      if (in_left == 0) {
+        break; // truncated
+      }
+      stream.avail_in  = (uInt)MIN(in_left, (uint64_t)ZLIB_CHUNK_SIZE);
+      in_left         -= stream.avail_in;
+    }
+    if (stream.avail_out == 0) {
+      stream.avail_out  = (uInt)MIN(out_left, (uint64_t)ZLIB_CHUNK_SIZE);
+      out_left         -= stream.avail_out;
+    }
+    ret = inflate(&stream, Z_NO_FLUSH);
+  }
+  uint64_t total_out = stream.total_out;
+  inflateEnd(&stream);
+  return (ret == Z_OK || ret == Z_STREAM_END) && total_out == size;
+}
+
+bool zip_blob_inflate(const zip_blob_t *blob, uint64_t limit, uint8_t **data,
+                      uint64_t *size) {
+  uint64_t want = MIN(limit, blob->uncompressed_size);
+  *data         = (uint8_t *)malloc(MAX(want, 1));
+  if (!*data) {
+    return false;
+  }
+
+  bool ok = false;
+  if (blob->method == COMPRESSION_METHOD_STORE) {
+    ok = blob->size >= want;
+    if (ok) {
+      memcpy(*data, blob->data, want);
+    }
+  } else if (blob->method == COMPRESSION_METHOD_DEFLATE) {
+    ok = _inflate(blob, *data, want);
+  }
+  if (ok && want == blob->uncompressed_size) {
+    ok = _crc32(*data, want) == blob->crc;
+  }
+
+  if (!ok) {
+    free(*data);
+    *data = NULL;
+    return false;
+  }
+  *size = want;
+  return true;
+}
+
+void zip_blob_free(zip_blob_t *blob) {
+  free(blob->data);
+  blob->data = NULL;
+  blob->size = 0;
+}
+
+static void _to_dos_time(time_t mtime, uint16_t *dos_time, uint16_t *dos_date) {
+  struct tm tm;
+  if (mtime <= 0 || !localtime_r(&mtime, &tm) || tm.tm_year < 80) {
+    *dos_time = 0;
+    *dos_date = (1 << 5) | 1; // 1980-01-01
+    return;
+  }
+  *dos_time =
+      (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+  *dos_date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) |
+                         tm.tm_mday);
+}
+
+static bool _write(zip_writer_t *writer, const void *data, uint64_t size) {
+  if (writer->failed) {
+    return false;
+  }
+  if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+    writer->failed = true;
+    return false;
+  }
+  writer->offset += size;
+  return true;
+}
+
+/// creates <path>.XXXXXX in the same directory, so the rename in
+/// zip_writer_close never crosses a file system
+static bool _open_temp(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                       const char *path) {
+  size_t path_size = strlen(path) + 1;
+  writer->path     = (char *)mallocv(*cli_flags, "writer->path", path_size, -1);
+  writer->tmp_path = (char *)mallocv(*cli_flags, "writer->tmp_path",
+                                     path_size + 7, -1);
+  if (!writer->path || !writer->tmp_path) {
+    return false;
+  }
+  memcpy(writer->path, path, path_size);
+  snprintf(writer->tmp_path, path_size + 7, "%s.XXXXXX", path);
+
+  int fd = mkstemp(writer->tmp_path);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp makes the file 0600, the output gets the usual mode instead
+  mode_t mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+  writer->file = fdopen(fd, "wb");
+  if (!writer->file) {
+    close(fd);
+    unlink(writer->tmp_path);
+    return false;
+  }
+  setvbuf(writer->file, NULL, _IOFBF, ZIP_WRITE_BUFFER_SIZE);
+  return true;
+}
+
+static void _free_writer(const cli_flags_t *cli_flags, zip_writer_t *writer) {
+  for (uint32_t i = 0; i < writer->count; i++) {
+    freev(*cli_flags, writer->entries[i].name, "writer->entries[].name", i);
+  }
+  freev(*cli_flags, writer->entries, "writer->entries", -1);
+  freev(*cli_flags, writer->comment, "writer->comment", -1);
+  freev(*cli_flags, writer->path, "writer->path", -1);
+  freev(*cli_flags, writer->tmp_path, "writer->tmp_path", -1);
+  writer->file  = NULL;
+  writer->count = 0;
+  writer->len   = 0;
+}
+
+bool zip_writer_open(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                     const char *path) {
+  memset(writer, 0, sizeof(*writer));
+  if (!_open_temp(cli_flags, writer, path)) {
+    printfv(*cli_flags, RED, "Failed to open destination zip file: %s\n",
+            path);
+    _free_writer(cli_flags, writer);
+    return false;
+  }
+  return true;
+}
+
+static bool _read_at(FILE *file, uint64_t offset, void *data, uint64_t size) {
+  return fseeko(file, (off_t)offset, SEEK_SET) == 0 &&
+         fread(data, 1, size, file) == size;
+}
+
+static bool _grow_entries(zip_writer_t *writer) {
+  if (writer->count < writer->len) {
+    return true;
+  }
+  uint32_t            len     = writer->len ? writer->len * 2 : 64;
+  zip_writer_entry_t *entries = (zip_writer_entry_t *)realloc(
+      writer->entries, len * sizeof(zip_writer_entry_t));
+  if (!entries) {
+    return false;
+  }
+  writer->entries = entries;
+  writer->len     = len;
+  return true;
+}
+
+/// finds the end of central directory record, the zip64 one if there is one,
+/// and reads the entry count, the central directory and the comment
+static bool _read_end_of_central_directory(FILE *file, zip_writer_t *writer,
+                                           uint64_t *cd_offset,
+                                           uint64_t *cd_size,
+                                           uint64_t *count) {
+  if (fseeko(file, 0, SEEK_END) != 0) {
+    return false;
+  }
+  uint64_t file_size = (uint64_t)ftello(file);
+  uint64_t tail_size = MIN(file_size, (uint64_t)22 + ZIP_UINT16_MAX);
+  uint8_t *tail      = (uint8_t *)malloc(MAX(tail_size, 1));
+  if (!tail || !_read_at(file, file_size - tail_size, tail, tail_size)) {
+    free(tail);
+    return false;
+  }
+
+  // the record is 22 bytes followed by the comment, which ends the file
+  int64_t eocd = -1;
+  for (int64_t i = (int64_t)tail_size - 22; i >= 0 && eocd < 0; i--) {
+    if (_get32(tail + i) == ZIP_EOCD_SIG &&
+        (uint64_t)i + 22 + _get16(tail + i + 20) == tail_size) {
+      eocd = i;
+    }
+  }
+  if (eocd < 0) {
+    free(tail);
+    return false;
+  }
+
+  const uint8_t *p = tail + eocd;
+  *count           = _get16(p + 10);
+  *cd_size         = _get32(p + 12);
+  *cd_offset       = _get32(p + 16);
+  uint16_t comment_len = _get16(p + 20);
+  if (comment_len > 0) {
+    writer->comment = (char *)malloc(comment_len + 1);
+    if (writer->comment) {
+      memcpy(writer->comment, p + 22, comment_len);
+      writer->comment[comment_len] = '\0';
+    }
+  }
+
+  bool     ok          = true;
+  uint64_t eocd_offset = file_size - tail_size + eocd;
+  if (*count == ZIP_UINT16_MAX || *cd_size == ZIP_UINT32_MAX ||
+      *cd_offset == ZIP_UINT32_MAX) {
+    uint8_t locator[20], record[56];
+    ok = eocd_offset >= 20 &&
+         _read_at(file, eocd_offset - 20, locator, sizeof(locator)) &&
+         _get32(locator) == ZIP64_LOCATOR_SIG &&
+         _read_at(file, _get64(locator + 8), record, sizeof(record)) &&
+         _get32(record) == ZIP64_EOCD_SIG;
+    if (ok) {
+      *count     = _get64(record + 32);
+      *cd_size   = _get64(record + 40);
+      *cd_offset = _get64(record + 48);
+    }
+  }
+  free(tail);
+  return ok && *cd_offset + *cd_size <= eocd_offset;
+}
+
+static bool _read_central_directory(const uint8_t *cd, uint64_t cd_size,
+                                    uint64_t count, zip_writer_t *writer) {
+  uint64_t pos = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    if (pos + 46 > cd_size || _get32(cd + pos) != ZIP_CENTRAL_HEADER_SIG) {
+      return false;
+    }
+    const uint8_t *p           = cd + pos;
+    uint16_t       name_len    = _get16(p + 28);
+    uint16_t       extra_len   = _get16(p + 30);
+    uint16_t       comment_len = _get16(p + 32);
+    if (pos + 46 + name_len + extra_len + comment_len > cd_size ||
+        !_grow_entries(writer)) {
+      return false;
+    }
+
+    zip_writer_entry_t *entry = &writer->entries[writer->count];
+    entry->method             = _get16(p + 10);
+    entry->dos_time           = _get16(p + 12);
+    entry->dos_date           = _get16(p + 14);
+    entry->crc                = _get32(p + 16);
+    entry->size               = _get32(p + 20);
+    entry->uncompressed_size  = _get32(p + 24);
+    entry->offset             = _get32(p + 42);
+    entry->name               = strndup((const char *)p + 46, name_len);
+    if (!entry->name) {
+      return false;
+    }
+    writer->count++;
+
+    // the zip64 extra only has the fields that did not fit, in this order
+    const uint8_t *extra = p + 46 + name_len;
+    for (uint16_t e = 0; e + 4 <= extra_len;) {
+      uint16_t id = _get16(extra + e), len = _get16(extra + e + 2);
+      if (id == ZIP64_EXTRA_ID) {
+        const uint8_t *field = extra + e + 4, *end = field + len;
+        if (entry->uncompressed_size == ZIP_UINT32_MAX && field + 8 <= end) {
+          entry->uncompressed_size  = _get64(field);
+          field                    += 8;
+        }
+        if (entry->size == ZIP_UINT32_MAX && field + 8 <= end) {
+          entry->size  = _get64(field);
+          field       += 8;
+        }
+        if (entry->offset == ZIP_UINT32_MAX && field + 8 <= end) {
+          entry->offset = _get64(field);
+        }
+      }
+      e += 4 + len;
+    }
+    pos += 46 + name_len + extra_len + comment_len;
+  }
+  return true;
+}
+
+/// copies the first size bytes of src to the start of dst
+static bool _copy_prefix(FILE *src, FILE *dst, uint64_t size) {
+  uint8_t *buffer = (uint8_t *)malloc(ZIP_WRITE_BUFFER_SIZE);
+  bool     ok     = buffer && fseeko(src, 0, SEEK_SET) == 0;
+  while (ok && size > 0) {
+    size_t chunk = (size_t)MIN(size, (uint64_t)ZIP_WRITE_BUFFER_SIZE);
+    ok           = fread(buffer, 1, chunk, src) == chunk &&
+         fwrite(buffer, 1, chunk, dst) == chunk;
+    size -= chunk;
+  }
+  free(buffer);
+  return ok;
+}
+
+bool zip_writer_open_append(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                            const char *path) {
+  memset(writer, 0, sizeof(*writer));
+  FILE *old = fopen(path, "rb");
+  if (!old) {
+    printfv(*cli_flags, RED, "Failed to open zip file for appending: %s\n",
+            path);
+    return false;
+  }
+
+  uint64_t cd_offset = 0, cd_size = 0, count = 0;
+  uint8_t *cd = NULL;
+  bool     ok = _read_end_of_central_directory(old, writer, &cd_offset,
+                                               &cd_size, &count) &&
+            (cd = (uint8_t *)malloc(MAX(cd_size, 1))) != NULL &&
+            _read_at(old, cd_offset, cd, cd_size) &&
+            _read_central_directory(cd, cd_size, count, writer);
+  free(cd);
+  if (!ok) {
+    printfv(*cli_flags, RED, "Failed to read the central directory of %s\n",
+            path);
+  }
+
+  // the old entries are copied to the temporary file, so path is never
+  // changed until zip_writer_close renames a complete archive over it
+  if (ok && (!_open_temp(cli_flags, writer, path) ||
+             !_copy_prefix(old, writer->file, cd_offset))) {
+    printfv(*cli_flags, RED, "Failed to copy the entries of %s\n", path);
+    if (writer->file) {
+      fclose(writer->file);
+      unlink(writer->tmp_path);
+    }
+    ok = false;
+  }
+  fclose(old);
+  if (!ok) {
+    _free_writer(cli_flags, writer);
+    memset(writer, 0, sizeof(*writer));
+    return false;
+  }
+
+  writer->offset = cd_offset;
+  printfv(*cli_flags, DARK_GREEN, "Appending to %s after %u entries\n", path,
+          writer->count);
+  return true;
+}
+
+bool zip_writer_set_comment(zip_writer_t *writer, const char *comment) {
+  free(writer->comment);
+  writer->comment = strndup(comment, ZIP_UINT16_MAX);
+  return writer->comment != NULL;
+}
+
+bool zip_writer_add(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                    const char *name, const zip_blob_t *blob) {
+  if (!_grow_entries(writer)) {
+    printfv(*cli_flags, RED, "Failed to grow the zip entries\n");
+    writer->failed = true;
+    return false;
+  }
+
+  zip_writer_entry_t *entry = &writer->entries[writer->count];
+  entry->name               = strdup(name);
+  entry->offset             = writer->offset;
+  entry->size               = blob->size;
+  entry->uncompressed_size  = blob->uncompressed_size;
+  entry->crc                = blob->crc;
+  entry->method             = blob->method;
+  _to_dos_time(blob->mtime, &entry->dos_time, &entry->dos_date);
+  if (!entry->name) {
+    writer->failed = true;
+    return false;
+  }
+
+  // the data is already final, so the sizes can go in the local header
+  bool zip64 = entry->size >= ZIP_UINT32_MAX ||
+               entry->uncompressed_size >= ZIP_UINT32_MAX;
+
+  uint16_t name_len = (uint16_t)strlen(name);
+  uint8_t  header[30 + 20], *p = header;
+  p = _put32(p, ZIP_LOCAL_HEADER_SIG);
+  p = _put16(p, zip64 ? 45 : (entry->method ? 20 : 10));
+  p = _put16(p, 0); // flags
+  p = _put16(p, entry->method);
+  p = _put16(p, entry->dos_time);
+  p = _put16(p, entry->dos_date);
+  p = _put32(p, entry->crc);
+  p = _put32(p, zip64 ? ZIP_UINT32_MAX : (uint32_t)entry->size);
+  p = _put32(p, zip64 ? ZIP_UINT32_MAX : (uint32_t)entry->uncompressed_size);
+  p = _put16(p, name_len);
+  p = _put16(p, zip64 ? 20 : 0);
+  if (zip64) {
+    p = _put16(p, ZIP64_EXTRA_ID);
+    p = _put16(p, 16);
+    p = _put64(p, entry->uncompressed_size);
+    p = _put64(p, entry->size);
+  }
+
+  writer->count++;
+  if (!_write(writer, header, 30) || !_write(writer, name, name_len) ||
+      !_write(writer, header + 30, p - header - 30) ||
+      !_write(writer, blob->data, blob->size)) {
+    printfv(*cli_flags, RED, "Failed to write %s to the zip file\n", name);
+    return false;
+  }
+  return true;
+}
+
+static bool _write_central_directory(zip_writer_t *writer) {
+  for (uint32_t i = 0; i < writer->count; i++) {
+    const zip_writer_entry_t *entry = &writer->entries[i];
+
+    bool big_uncompressed = entry->uncompressed_size >= ZIP_UINT32_MAX;
+    bool big_size         = entry->size >= ZIP_UINT32_MAX;
+    bool big_offset       = entry->offset >= ZIP_UINT32_MAX;
+    // the local header decides if it has zip64 sizes, this has to match it
+    bool     zip64_sizes = big_uncompressed || big_size;
+    uint16_t extra_len   = (zip64_sizes ? 16 : 0) + (big_offset ? 8 : 0);
+    uint16_t name_len    = (uint16_t)strlen(entry->name);
+
+    uint8_t header[46 + 4 + 24], *p = header;
+    p = _put32(p, ZIP_CENTRAL_HEADER_SIG);
+    p = _put16(p, ZIP_VERSION_MADE_BY);
+    p = _put16(p,
+               (zip64_sizes || big_offset) ? 45 : (entry->method ? 20 : 10));
+    p = _put16(p, 0); // flags
+    p = _put16(p, entry->method);
+    p = _put16(p, entry->dos_time);
+    p = _put16(p, entry->dos_date);
+    p = _put32(p, entry->crc);
+    p = _put32(p, zip64_sizes ? ZIP_UINT32_MAX : (uint32_t)entry->size);
+    p = _put32(p, zip64_sizes ? ZIP_UINT32_MAX
+                              : (uint32_t)entry->uncompressed_size);
+    p = _put16(p, name_len);
+    p = _put16(p, extra_len ? extra_len + 4 : 0);
+    p = _put16(p, 0);                // comment length
+    p = _put16(p, 0);                // disk number
+    p = _put16(p, 0);                // internal attributes
+    p = _put32(p, (0100644u << 16)); // -rw-r--r--
+    p = _put32(p, big_offset ? ZIP_UINT32_MAX : (uint32_t)entry->offset);
+    if (extra_len) {
+      p = _put16(p, ZIP64_EXTRA_ID);
+      p = _put16(p, extra_len);
+      if (zip64_sizes) {
+        p = _put64(p, entry->uncompressed_size);
+        p = _put64(p, entry->size);
+      }
+      if (big_offset) {
+        p = _put64(p, entry->offset);
+      }
+    }
+
+    if (!_write(writer, header, 46) ||
+        !_write(writer, entry->name, name_len) ||
+        !_write(writer, header + 46, p - header - 46)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool _write_end_of_central_directory(zip_writer_t *writer,
+                                            uint64_t      cd_offset) {
+  uint64_t cd_size       = writer->offset - cd_offset;
+  uint64_t eocd64_offset = writer->offset;
+  bool     zip64         = writer->count >= ZIP_UINT16_MAX ||
+               cd_offset >= ZIP_UINT32_MAX || cd_size >= ZIP_UINT32_MAX;
+  uint8_t record[56 + 20 + 22], *p = record;
+
+  if (zip64) {
+    p = _put32(p, ZIP64_EOCD_SIG);
+    p = _put64(p, 44); // size of the rest of the record
+    p = _put16(p, ZIP_VERSION_MADE_BY);
+    p = _put16(p, 45);
+    p = _put32(p, 0); // this disk
+    p = _put32(p, 0); // disk with the central directory
+    p = _put64(p, writer->count);
+    p = _put64(p, writer->count);
+    p = _put64(p, cd_size);
+    p = _put64(p, cd_offset);
+
+    p = _put32(p, ZIP64_LOCATOR_SIG);
+    p = _put32(p, 0); // disk with the zip64 end of central directory
+    p = _put64(p, eocd64_offset);
+    p = _put32(p, 1); // total disks
+  }
+
+  p = _put32(p, ZIP_EOCD_SIG);
+  p = _put16(p, 0); // this disk
+  p = _put16(p, 0); // disk with the central directory
+  p = _put16(p, zip64 ? ZIP_UINT16_MAX : (uint16_t)writer->count);
+  p = _put16(p, zip64 ? ZIP_UINT16_MAX : (uint16_t)writer->count);
+  p = _put32(p, zip64 ? ZIP_UINT32_MAX : (uint32_t)cd_size);
+  p = _put32(p, zip64 ? ZIP_UINT32_MAX : (uint32_t)cd_offset);
+  uint16_t comment_len =
+      writer->comment ? (uint16_t)strlen(writer->comment) : 0;
+  p = _put16(p, comment_len);
+
+  return _write(writer, record, p - record) &&
+         _write(writer, writer->comment, comment_len);
+}
+
+bool zip_writer_close(const cli_flags_t *cli_flags, zip_writer_t *writer) {
+  uint64_t cd_offset = writer->offset;
+  bool     ok        = !writer->failed && _write_central_directory(writer) &&
+              _write_end_of_central_directory(writer, cd_offset);
+  // the data has to be on disk before the rename makes it the output
+  ok = ok && fflush(writer->file) == 0 && fsync(fileno(writer->file)) == 0;
+  if (fclose(writer->file) != 0) {
+    ok = false;
+  }
+  ok = ok && rename(writer->tmp_path, writer->path) == 0;
+  if (!ok) {
+    printfv(*cli_flags, RED,
+            "Failed to finish writing the zip file, %s was not changed\n",
+            writer->path);
+    unlink(writer->tmp_path);
+  }
+
+  _free_writer(cli_flags, writer);
+  return ok;
+}
@@ -0,0 +1,141 @@
+#ifndef ZIP_WRITER_H
+#define ZIP_WRITER_H
+
+#include "cli.h"
+#include "compression.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/// A finished entry, the data is already in its final (compressed) form
+typedef struct {
+  uint8_t *data;
+  uint64_t size; // size of data
+  uint64_t uncompressed_size;
+  uint32_t crc;
+  uint16_t method;
+  time_t   mtime;
+} zip_blob_t;
+
+typedef struct {
+  char    *name;
+  uint64_t offset; // of the local header
+  uint64_t size;
+  uint64_t uncompressed_size;
+  uint32_t crc;
+  uint16_t method;
+  uint16_t dos_time;
+  uint16_t dos_date;
+} zip_writer_entry_t;
+
+/// A minimal zip writer, entries are appended to the file as they are added
+/// and the central directory is written by zip_writer_close. Zip64 records
+/// are only written when they are needed. Everything goes to a temporary file
+/// next to path, which only replaces path once it is complete
+typedef struct {
+  FILE               *file;
+  char               *path;
+  char               *tmp_path;
+  uint64_t            offset;
+  zip_writer_entry_t *entries;
+  uint32_t            count;
+  uint32_t            len;
+  char               *comment; // archive comment, NULL for none
+  bool                failed;
+} zip_writer_t;
+
+/**
+ * Makes a blob out of a buffer, the blob takes ownership of data (a stored
+ * blob keeps it, a deflated one frees it). data is freed on failure as well
+ *
+ * @param blob Pointer to the blob that will be filled in
+ * @param data Pointer to the uncompressed data, allocated with malloc
+ * @param size The size of data
+ * @param choice The method and level to compress with
+ * @return bool false if the blob could not be made
+ */
+bool zip_blob_from_buffer(zip_blob_t *blob, uint8_t *data, uint64_t size,
+                          compression_choice_t choice);
+
+/**
+ * Inflates the start of a blob, a limit of at least uncompressed_size inflates
+ * all of it and also checks the crc
+ *
+ * @param blob Pointer to a stored or deflated blob
+ * @param limit The max number of bytes to inflate
+ * @param data Pointer that will be set to the inflated bytes, free with free
+ * @param size Pointer that will be set to the number of inflated bytes
+ * @return bool false if the blob is corrupt or memory ran out
+ */
+bool zip_blob_inflate(const zip_blob_t *blob, uint64_t limit, uint8_t **data,
+                      uint64_t *size);
+
+/**
+ * Frees the data of a blob
+ *
+ * @param blob Pointer to the blob
+ * @return void
+ */
+void zip_blob_free(zip_blob_t *blob);
+
+/**
+ * Creates a zip file for writing, an existing file at path is left untouched
+ * until zip_writer_close replaces it
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param path The path of the zip file
+ * @return bool false if the temporary file could not be created
+ */
+bool zip_writer_open(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                     const char *path);
+
+/**
+ * Opens a zip file that was written by zip_writer to add more entries to it.
+ * The existing entries are copied as they are to the temporary file, up to
+ * where the central directory started, and zip_writer_close writes it again
+ * with the new entries after the old ones. The old archive comment is kept
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param path The path of the zip file
+ * @return bool false if the file could not be opened or parsed, it is left
+ * untouched then
+ */
+bool zip_writer_open_append(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                            const char *path);
+
+/**
+ * Sets the archive comment that zip_writer_close will write
+ *
+ * @param writer Pointer to the writer
+ * @param comment The comment, at most 65535 bytes are kept
+ * @return bool false if memory ran out
+ */
+bool zip_writer_set_comment(zip_writer_t *writer, const char *comment);
+
+/**
+ * Writes the local header and the data of a blob
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @param name The name of the entry
+ * @param blob Pointer to the blob, it is not freed
+ * @return bool false if the entry could not be written
+ */
+bool zip_writer_add(const cli_flags_t *cli_flags, zip_writer_t *writer,
+                    const char *name, const zip_blob_t *blob);
+
+/**
+ * Writes the central directory, closes the file and frees the writer. The
+ * file is synced and renamed over path, if anything failed (or failed was
+ * set) it is removed and path keeps what it had
+ *
+ * @param cli_flags Pointer to the cli flags
+ * @param writer Pointer to the writer
+ * @return bool false if anything failed to be written
+ */
+bool zip_writer_close(const cli_flags_t *cli_flags, zip_writer_t *writer);
+
+#endif // ZIP_WRITER_H